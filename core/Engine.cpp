@@ -2,7 +2,9 @@
 #include "Loden/PipelineStateManager.hpp"
 #include "Loden/Printing.hpp"
 #include "Loden/Settings.hpp"
+#include "Loden/ThreadPool.hpp"
 #include "Loden/GUI/FontManager.hpp"
+#include <algorithm>
 
 namespace Loden
 {
@@ -28,6 +30,9 @@ bool Engine::initialize(int argc, const char **argv)
     if (!loadSettings(argc, argv))
         return false;
 
+    if (!createThreadPool())
+        return false;
+
     if (!createPipelineStateManager())
         return false;
 
@@ -53,6 +58,11 @@ void Engine::shutdown()
         pipelineStateManager.reset();
     }
 
+    if (threadPool)
+    {
+        threadPool->shutdown();
+        threadPool.reset();
+    }
 }
 
 bool Engine::createDevice()
@@ -105,6 +115,19 @@ bool Engine::loadSettings(int argc, const char **argv)
     return true;
 }
 
+bool Engine::createThreadPool()
+{
+    threadPool = std::make_shared<ThreadPool> ();
+    auto threadCount = settings->getIntValue("Engine", "WorkerThreadCount", 0);
+    if (!threadPool->initialize(std::max(threadCount, 0)))
+    {
+        printError("Failed to create the worker threads.\n");
+        return false;
+    }
+
+    return true;
+}
+
 bool Engine::createPipelineStateManager()
 {
     // Create the pipeline state manager.
@@ -156,4 +179,9 @@ const GUI::FontManagerPtr &Engine::getFontManager() const
     return fontManager;
 }
 
+const ThreadPoolPtr &Engine::getThreadPool() const
+{
+    return threadPool;
+}
+
 } // End of namespace Loden
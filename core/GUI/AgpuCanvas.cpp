@@ -3,15 +3,97 @@
 #include "Loden/GUI/FontManager.hpp"
 #include "Loden/Math.hpp"
 #include "Loden/Printing.hpp"
+#include "Loden/Settings.hpp"
+#include "Loden/ThreadPool.hpp"
 #include <glm/gtx/norm.hpp>
+#include <float.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 
 namespace Loden
 {
 namespace GUI
 {
 
-const float CurveFlattnessFactor = 1.01f;
-const float CurvePixelThreshold = 0.2f;
+// The largest distance in pixels between a curve and its chords.
+const float CurveTolerance = 0.2f;
+
+const float Pi = 3.14159265358979323846f;
+const float HalfPi = Pi*0.5f;
+const float TwoPi = Pi*2.0f;
+
+// The largest distance between an arc and its chords.
+const float ArcTolerance = 0.25f;
+const int MaxArcSegmentCount = 64;
+
+// Submeshes are split at this many vertices, so their relative indices
+// usually fit in 16 bits. The margin leaves room for the primitive being
+// added.
+const size_t ShortIndexSubmeshVertexLimit = 0x10000 - 4096;
+
+// The batch merger looks back this many groups for one with the same state.
+const size_t BatchMergeSearchDepth = 64;
+const uint32_t NoTextEffectConstants = ~0u;
+
+// The clip depth is kept in the high stencil bits, and the fill paths wind
+// in the low bits.
+const uint32_t ClipStencilShift = 4;
+const int ClipStencilMask = 0xF0;
+const int FillStencilMask = 0x0F;
+
+static Rectangle inflateRectangle(const Rectangle &rectangle, float amount)
+{
+    return Rectangle(rectangle.min - amount, rectangle.max + amount);
+}
+
+static bool isPixelAligned(const Rectangle &rectangle)
+{
+    return rectangle.min == glm::floor(rectangle.min) && rectangle.max == glm::floor(rectangle.max);
+}
+
+/**
+ * Loads a pipeline state of an experimental drawing path. It is only loaded
+ * when its setting enables it, since core-assets does not provide it yet.
+ */
+static agpu_pipeline_state_ref getExperimentalPipelineState(const PipelineStateManagerPtr &stateManager, bool enabled, const char *name)
+{
+    if (!enabled)
+        return agpu_pipeline_state_ref();
+
+    auto pipeline = stateManager->getPipelineState(name);
+    if (!pipeline)
+        printWarning("The experimental pipeline state %s is missing.\n", name);
+    return pipeline;
+}
+
+/**
+ * Builds a variant of a canvas pipeline state with its own stencil test.
+ * The test is the same for both faces, and only the pass operation differs.
+ */
+static agpu_pipeline_state_ref getStencilVariant(const PipelineStateManagerPtr &stateManager, const char *name, const char *variantName,
+    int writeMask, int readMask, agpu_compare_function function, agpu_stencil_operation frontPassOperation, agpu_stencil_operation backPassOperation,
+    bool writingColor = true)
+{
+    return stateManager->getPipelineStateVariant(name, variantName, [=](const agpu_pipeline_builder_ref &builder) {
+        builder->setStencilState(true, writeMask, readMask);
+        builder->setStencilFrontFace(AGPU_KEEP, AGPU_KEEP, frontPassOperation, function);
+        builder->setStencilBackFace(AGPU_KEEP, AGPU_KEEP, backPassOperation, function);
+        if (!writingColor)
+            builder->setColorMask(-1, false, false, false, false);
+        return true;
+    });
+}
+
+static int computeArcSegmentCount(float radius, float angle)
+{
+    if (radius <= ArcTolerance)
+        return 1;
+
+    auto step = 2.0f*acos(1.0f - ArcTolerance / radius);
+    return std::min(std::max(int(ceil(fabs(angle) / step)), 1), MaxArcSegmentCount);
+}
 
 /**
  * Path processing strategy.
@@ -122,14 +204,30 @@ public:
 
     virtual agpu_pipeline_state *getPipelineState() const = 0;
 
+    // The pipeline that stencils the curve triangles, or null for
+    // flattening the curves.
+    virtual agpu_pipeline_state *getCurvePipelineState() const
+    {
+        return nullptr;
+    }
+
     virtual void begin();
     virtual void end();
     virtual void moveTo(const glm::vec2 &point);
     virtual void lineTo(const glm::vec2 &point);
+    virtual void quadTo(const glm::vec2 &control, const glm::vec2 &point);
+    virtual void cubicTo(const glm::vec2 &control, const glm::vec2 &control2, const glm::vec2 &point);
+
+    void addCurveTriangle(const glm::vec2 &control, const glm::vec2 &point);
+    void addCurveTriangles();
 
     int totalVertexCount;
     int vertexCount;
     Rectangle boundingBox;
+
+    // The curve triangles are stenciled after the polygon, with a single
+    // pipeline change.
+    std::vector<AgpuCanvasVertex> curveVertices;
 };
 
 /**
@@ -149,6 +247,11 @@ public:
     {
         return canvas->stencilEvenOddPipeline.get();
     }
+
+    agpu_pipeline_state *getCurvePipelineState() const
+    {
+        return canvas->stencilEvenOddCurvePipeline.get();
+    }
 };
 
 /**
@@ -168,6 +271,52 @@ public:
     {
         return canvas->stencilNonZeroPipeline.get();
     }
+
+    agpu_pipeline_state *getCurvePipelineState() const
+    {
+        return canvas->stencilNonZeroCurvePipeline.get();
+    }
+};
+
+/**
+* Clip path processor. The path winds in the low stencil bits of the pixels
+* at the current clip depth. Only the bounds of the path are kept when the
+* stencil clip cannot be used.
+*/
+class AgpuClipPathProcessor : public AgpuStencilPathProcessor
+{
+public:
+    typedef AgpuStencilPathProcessor BaseClass;
+
+    AgpuClipPathProcessor(AgpuCanvas *canvas)
+        : BaseClass(canvas)
+    {
+        fillRule = PathFillRule::EvenOdd;
+        usingStencil = false;
+    }
+
+    agpu_pipeline_state *getPipelineState() const
+    {
+        if (fillRule == PathFillRule::NonZero)
+            return canvas->clipStencilNonZeroPipeline.get();
+        return canvas->clipStencilEvenOddPipeline.get();
+    }
+
+    agpu_pipeline_state *getCurvePipelineState() const
+    {
+        if (!usingStencil)
+            return nullptr;
+        if (fillRule == PathFillRule::NonZero)
+            return canvas->clipStencilNonZeroCurvePipeline.get();
+        return canvas->clipStencilEvenOddCurvePipeline.get();
+    }
+
+    virtual void begin();
+    virtual void end();
+    virtual void lineTo(const glm::vec2 &point);
+
+    PathFillRule fillRule;
+    bool usingStencil;
 };
 
 /**
@@ -192,39 +341,190 @@ public:
     int vertexCount;
 };
 
+/**
+* Stroke path processor. The points of each contour are collected, and the
+* contour is emitted as a single strip of left and right offset points, so
+* translucent strokes are blended once. The inner side of each join is the
+* intersection of the offset lines, and the join wedge and the round caps
+* are added on the outer side only.
+*/
+class AgpuStrokePathProcessor : public AgpuSoftwareTessellationPathProcessor
+{
+public:
+    typedef AgpuSoftwareTessellationPathProcessor BaseClass;
+
+    AgpuStrokePathProcessor(AgpuCanvas *canvas)
+        : BaseClass(canvas)
+    {
+    }
+
+    virtual void begin();
+    virtual void end();
+    virtual void closePath();
+    virtual void moveTo(const glm::vec2 &point);
+    virtual void lineTo(const glm::vec2 &point);
+
+private:
+    void finishContour(bool closed);
+    void addEndRow(const glm::vec2 &point, const glm::vec2 &direction, float capSign);
+    void addJoin(const glm::vec2 &previous, const glm::vec2 &point, const glm::vec2 &next);
+    void addRoundJoinWedge(const glm::vec2 &point, float startAngle, float sweepAngle);
+    void addCap(const glm::vec2 &point, const glm::vec2 &direction);
+
+    std::vector<glm::vec2> points;
+    std::vector<glm::vec2> leftPoints;
+    std::vector<glm::vec2> rightPoints;
+    bool hasSegment;
+    float halfWidth;
+};
+
+/// Canvas ring buffers.
+AgpuCanvasRingBuffersPtr AgpuCanvasRingBuffers::create(const agpu_device_ref &device)
+{
+    auto result = std::make_shared<AgpuCanvasRingBuffers> ();
+    result->vertices = GpuRingBuffer::create(device, AGPU_ARRAY_BUFFER, sizeof(AgpuCanvasVertex), 64*1024);
+    result->shortIndices = GpuRingBuffer::create(device, AGPU_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t), 96*1024);
+    result->indices = GpuRingBuffer::create(device, AGPU_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t), 1024);
+    result->glyphInstances = GpuRingBuffer::create(device, AGPU_ARRAY_BUFFER, sizeof(AgpuCanvasGlyphInstance), 16*1024);
+    result->shapeInstances = GpuRingBuffer::create(device, AGPU_ARRAY_BUFFER, sizeof(AgpuCanvasShapeInstance), 4*1024);
+    if (!result->vertices || !result->shortIndices || !result->indices || !result->glyphInstances || !result->shapeInstances)
+        return nullptr;
+    return result;
+}
+
+void AgpuCanvasRingBuffers::endFrame(const agpu_fence_ref &fence)
+{
+    vertices->endFrame(fence);
+    shortIndices->endFrame(fence);
+    indices->endFrame(fence);
+    glyphInstances->endFrame(fence);
+    shapeInstances->endFrame(fence);
+}
+
+// Shape tessellation cache
+AgpuShapeTessellationCache::AgpuShapeTessellationCache(size_t budget)
+    : cache(budget)
+{
+}
+
+AgpuShapeTessellationCache::~AgpuShapeTessellationCache()
+{
+}
+
+AgpuTessellatedShapePtr AgpuShapeTessellationCache::find(const Key &key)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    auto cached = cache.find(key);
+    return cached ? *cached : nullptr;
+}
+
+void AgpuShapeTessellationCache::insert(const Key &key, const AgpuTessellatedShapePtr &shape)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    cache.insert(key, shape, shape->getMemoryCost() + key.getMemoryCost());
+}
+
+void AgpuShapeTessellationCache::clear()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    cache.clear();
+}
+
+void AgpuShapeTessellationCache::setBudget(size_t budget)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    cache.setBudget(budget);
+}
+
+size_t AgpuShapeTessellationCache::getHitCount() const
+{
+    std::unique_lock<std::mutex> l(mutex);
+    return cache.getHitCount();
+}
+
+size_t AgpuShapeTessellationCache::getMissCount() const
+{
+    std::unique_lock<std::mutex> l(mutex);
+    return cache.getMissCount();
+}
+
+size_t AgpuShapeTessellationCache::getUsedMemory() const
+{
+    std::unique_lock<std::mutex> l(mutex);
+    return cache.getUsedMemory();
+}
+
+void AgpuShapeTessellationCache::resetStatistics()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    cache.resetStatistics();
+}
+
 /// AGPU Canvas.
 AgpuCanvas::AgpuCanvas()
 {
-	vertexCapacity = 0;
-	indexCapacity = 0;
+    boundVertexBuffer = nullptr;
+    recordingDisplayList = false;
+    parallelRecording = false;
+    mergingBatches = false;
+    boundGlyphInstanceBuffer = nullptr;
+    boundShapeInstanceBuffer = nullptr;
+    frameIndexBuffer = nullptr;
+    frameVertexOffset = 0;
+    frameIndexOffset = 0;
+    frameGlyphInstanceOffset = 0;
+    frameShapeInstanceOffset = 0;
     currentPipeline = nullptr;
     currentTextureBinding = nullptr;
     currentFontBinding = nullptr;
-    coveringType = CT_Draw;
+    textEffectPushed = false;
     usingBundle = false;
+    culling = false;
+    recordingFillPath = false;
+    recordedFillRule = PathFillRule::EvenOdd;
+    capturedShape = nullptr;
 
     nullPathProcessor.reset(new AgpuCanvasPathProcessor(this));
     currentPathProcessor = nullPathProcessor.get();
 
     noWithStrokePathProcessor.reset(new AgpuNoWidthStrokePathProcessor(this));
-    strokePathProcessor.reset(new AgpuNoWidthStrokePathProcessor(this)); // TODO: Implement this properly
+    strokePathProcessor.reset(new AgpuStrokePathProcessor(this));
     convexPathProcessor.reset(new AgpuConvexPathProcessor(this));
     evenOddRulePathProcessor.reset(new AgpuStencilEvenOddPathProcessor(this));
     nonZeroRulePathProcessor.reset(new AgpuStencilNonZeroPathProcessor(this));
+    clipPathProcessor.reset(new AgpuClipPathProcessor(this));
+
+    clipStencilDepth = 0;
+    recordingClipStencilDepth = 0;
+    viewportScissor.x = viewportScissor.y = 0;
+    viewportScissor.width = viewportScissor.height = 1 << 14;
+    currentScissor = viewportScissor;
 }
 
 AgpuCanvas::~AgpuCanvas()
 {
 }
 
-AgpuCanvasPtr AgpuCanvas::create(const PipelineStateManagerPtr &stateManager, bool usingBundle)
+AgpuCanvasPtr AgpuCanvas::create(const PipelineStateManagerPtr &stateManager, const AgpuCanvasRingBuffersPtr &ringBuffers, bool usingBundle)
 {
+	if(!ringBuffers)
+		return nullptr;
+
 	auto &device = stateManager->getDevice();
+    auto &settings = stateManager->getEngine()->getSettings();
 
 	auto layout = stateManager->getVertexLayout("CanvasVertex2D");
 	if(!layout)
 		return nullptr;
 
+    // The vertices are copied as they are, so they must match the layout.
+    auto vertexStructure = stateManager->getStructure("CanvasVertex2D");
+    if (vertexStructure && vertexStructure->size != sizeof(AgpuCanvasVertex))
+    {
+        printError("The CanvasVertex2D structure does not match a canvas vertex.\n");
+        return nullptr;
+    }
+
 	// Create the command list allocator.
 	auto allocator = device->createCommandAllocator(AGPU_COMMAND_LIST_TYPE_BUNDLE, stateManager->getEngine()->getGraphicsCommandQueue().get());
 	if(!allocator)
@@ -243,6 +543,7 @@ AgpuCanvasPtr AgpuCanvas::create(const PipelineStateManagerPtr &stateManager, bo
 	// Create the canvas object.
 	auto canvas = AgpuCanvasPtr(new AgpuCanvas());
     canvas->usingBundle = usingBundle;
+    canvas->ringBuffers = ringBuffers;
 	canvas->stateManager = stateManager;
 	canvas->device = device;
 	canvas->allocator = allocator;
@@ -261,6 +562,13 @@ AgpuCanvasPtr AgpuCanvas::create(const PipelineStateManagerPtr &stateManager, bo
     canvas->stencilEvenOddPipeline = stateManager->getPipelineState("canvas2d.polygon.stencil.even-odd");
     assert(canvas->stencilEvenOddPipeline);
 
+    // Experimental: the curve stencil pipelines are enabled by the
+    // ExperimentalCurveTriangles setting, and the curves are flattened
+    // without them.
+    auto curveTriangles = settings->getBoolValue("Rendering", "ExperimentalCurveTriangles", false);
+    canvas->stencilNonZeroCurvePipeline = getExperimentalPipelineState(stateManager, curveTriangles, "canvas2d.polygon.stencil.curve.non-zero");
+    canvas->stencilEvenOddCurvePipeline = getExperimentalPipelineState(stateManager, curveTriangles, "canvas2d.polygon.stencil.curve.even-odd");
+
     canvas->coverColorPipeline = stateManager->getPipelineState("canvas2d.polygon.cover.color");
     assert(canvas->coverColorPipeline);
 
@@ -270,6 +578,44 @@ AgpuCanvasPtr AgpuCanvas::create(const PipelineStateManagerPtr &stateManager, bo
     canvas->textSdfColorPipeline = stateManager->getPipelineState("canvas2d.textsdf.color");
     assert(canvas->textSdfColorPipeline);
 
+    // Experimental: the instanced text pipelines are enabled by the
+    // ExperimentalInstancedText setting, and the glyphs are drawn with quads
+    // without them.
+    auto instancedText = settings->getBoolValue("Rendering", "ExperimentalInstancedText", false);
+    canvas->textInstancedColorPipeline = getExperimentalPipelineState(stateManager, instancedText, "canvas2d.text.instanced.color");
+    canvas->textSdfInstancedColorPipeline = getExperimentalPipelineState(stateManager, instancedText, "canvas2d.textsdf.instanced.color");
+    if ((canvas->textInstancedColorPipeline || canvas->textSdfInstancedColorPipeline) && !canvas->createGlyphQuadBuffers())
+    {
+        printWarning("The experimental CanvasGlyphInstanced2D vertex layout is missing.\n");
+        canvas->textInstancedColorPipeline.reset();
+        canvas->textSdfInstancedColorPipeline.reset();
+    }
+
+    // Experimental: the text effect pipelines are enabled by the
+    // ExperimentalTextEffects setting, and the text is drawn without its
+    // effects without them.
+    auto textEffects = settings->getBoolValue("Rendering", "ExperimentalTextEffects", false);
+    canvas->textSdfEffectsColorPipeline = getExperimentalPipelineState(stateManager, textEffects, "canvas2d.textsdf.effects.color");
+    canvas->textSdfInstancedEffectsColorPipeline = getExperimentalPipelineState(stateManager, textEffects && canvas->textSdfInstancedColorPipeline, "canvas2d.textsdf.instanced.effects.color");
+
+    // Experimental: the analytic shape pipeline is enabled by the
+    // ExperimentalAnalyticShapes setting, and the shapes are drawn as paths
+    // without it.
+    auto analyticShapes = settings->getBoolValue("Rendering", "ExperimentalAnalyticShapes", false);
+    canvas->shapeInstancedColorPipeline = getExperimentalPipelineState(stateManager, analyticShapes, "canvas2d.shape.instanced.color");
+    if (canvas->shapeInstancedColorPipeline && !canvas->createShapeQuadBuffers())
+    {
+        printWarning("The experimental CanvasShapeInstanced2D vertex layout is missing.\n");
+        canvas->shapeInstancedColorPipeline.reset();
+    }
+
+    // The clip paths are stenciled with variants of the loaded pipelines.
+    if (!canvas->createStencilClipPipelines())
+    {
+        printWarning("The canvas stencil clip pipelines cannot be built, so the clip paths are clipped to their bounds.\n");
+        canvas->clippedPipelines.clear();
+    }
+
     agpu_sampler_description samplerDesc;
     memset(&samplerDesc, 0, sizeof(samplerDesc));
     samplerDesc.filter = AGPU_FILTER_MIN_LINEAR_MAG_LINEAR_MIPMAP_NEAREST;
@@ -281,145 +627,757 @@ AgpuCanvasPtr AgpuCanvas::create(const PipelineStateManagerPtr &stateManager, bo
     canvas->sampler->createSampler(0, &samplerDesc);
     canvas->sampler->createSampler(1, &samplerDesc);
 
+    canvas->parallelRecording = settings->getBoolValue("Rendering", "ParallelCanvasRecording", false);
+    canvas->mergingBatches = settings->getBoolValue("Rendering", "CanvasBatchMerging", true);
+    canvas->culling = settings->getBoolValue("Rendering", "CanvasCulling", true);
+    if (settings->getBoolValue("Rendering", "ShapeTessellationCache", true))
+    {
+        auto budget = settings->getIntValue("Rendering", "ShapeTessellationCacheBudget", int(AgpuShapeTessellationCache::DefaultBudget));
+        canvas->shapeCache = std::make_shared<AgpuShapeTessellationCache> (size_t(std::max(budget, 0)));
+    }
 	return canvas;
 }
 
-void AgpuCanvas::createVertexBuffer()
+bool AgpuCanvas::createQuadBuffers()
 {
-	vertexCapacity = vertices.size();
+    if (quadCornerBuffer && quadIndexBuffer)
+        return true;
+
+    static const glm::vec2 corners[] = {
+        glm::vec2(0, 0), glm::vec2(1, 0), glm::vec2(1, 1), glm::vec2(0, 1),
+    };
+    static const int quadIndices[] = {
+        0, 1, 2, 2, 3, 0,
+    };
 
     agpu_buffer_description desc;
-    desc.size = agpu_uint(vertexCapacity*sizeof(Vertex));
-    desc.usage = AGPU_STREAM;
+    desc.size = agpu_uint(sizeof(corners));
+    desc.usage = AGPU_STATIC;
     desc.binding = AGPU_ARRAY_BUFFER;
-    desc.mapping_flags = AGPU_MAP_DYNAMIC_STORAGE_BIT | AGPU_MAP_WRITE_BIT;
-    desc.stride = agpu_uint(sizeof(Vertex));
-    vertexBuffer = device->createBuffer(&desc, nullptr);
+    desc.mapping_flags = 0;
+    desc.stride = agpu_uint(sizeof(glm::vec2));
+    quadCornerBuffer = device->createBuffer(&desc, (void*)corners);
+
+    desc.size = agpu_uint(sizeof(quadIndices));
+    desc.binding = AGPU_ELEMENT_ARRAY_BUFFER;
+    desc.stride = agpu_uint(sizeof(int));
+    quadIndexBuffer = device->createBuffer(&desc, (void*)quadIndices);
+    return quadCornerBuffer && quadIndexBuffer;
+}
+
+bool AgpuCanvas::createGlyphQuadBuffers()
+{
+    auto layout = stateManager->getVertexLayout("CanvasGlyphInstanced2D");
+    if (!layout || !createQuadBuffers())
+        return false;
 
-	// Update the vertex buffer binding
-	vertexBufferBinding->bindVertexBuffers(1, (agpu_buffer**)&vertexBuffer);
+    glyphInstanceBinding = device->createVertexBinding(layout.get());
+    return bool(glyphInstanceBinding);
 }
 
-void AgpuCanvas::createIndexBuffer()
+bool AgpuCanvas::createShapeQuadBuffers()
 {
-	indexCapacity = indices.size();
+    auto layout = stateManager->getVertexLayout("CanvasShapeInstanced2D");
+    if (!layout || !createQuadBuffers())
+        return false;
 
-    agpu_buffer_description desc;
-    desc.size = agpu_uint(indexCapacity*sizeof(int));
-    desc.usage = AGPU_STREAM;
-    desc.binding = AGPU_ELEMENT_ARRAY_BUFFER;
-    desc.mapping_flags = AGPU_MAP_DYNAMIC_STORAGE_BIT | AGPU_MAP_WRITE_BIT;
-    desc.stride = agpu_uint(sizeof(int));
-    indexBuffer = device->createBuffer(&desc, nullptr);
+    shapeInstanceBinding = device->createVertexBinding(layout.get());
+    return bool(shapeInstanceBinding);
+}
+
+bool AgpuCanvas::createStencilClipPipelines()
+{
+    // The fills wind in the low bits of the pixels at the clip depth.
+    clipStencilNonZeroPipeline = getStencilVariant(stateManager, "canvas2d.polygon.stencil.non-zero", "clipped",
+        FillStencilMask, ClipStencilMask, AGPU_EQUAL, AGPU_INCREASE_WRAP, AGPU_DECREASE_WRAP);
+    clipStencilEvenOddPipeline = getStencilVariant(stateManager, "canvas2d.polygon.stencil.even-odd", "clipped",
+        FillStencilMask, ClipStencilMask, AGPU_EQUAL, AGPU_INVERT, AGPU_INVERT);
+    if (stencilNonZeroCurvePipeline)
+        clipStencilNonZeroCurvePipeline = getStencilVariant(stateManager, "canvas2d.polygon.stencil.curve.non-zero", "clipped",
+            FillStencilMask, ClipStencilMask, AGPU_EQUAL, AGPU_INCREASE_WRAP, AGPU_DECREASE_WRAP);
+    if (stencilEvenOddCurvePipeline)
+        clipStencilEvenOddCurvePipeline = getStencilVariant(stateManager, "canvas2d.polygon.stencil.curve.even-odd", "clipped",
+            FillStencilMask, ClipStencilMask, AGPU_EQUAL, AGPU_INVERT, AGPU_INVERT);
+
+    // The cover passes where the clip depth is the reference and the
+    // winding is not zero, and it clears the winding.
+    auto clippedCoverPipeline = getStencilVariant(stateManager, "canvas2d.polygon.cover.color", "clipped",
+        FillStencilMask, 0xFF, AGPU_LESS, AGPU_ZERO, AGPU_ZERO);
+
+    // Pushing a clip moves the pixels with a winding to the next depth, and
+    // popping it moves the deeper pixels back. Neither writes colors.
+    clipPushCoverPipeline = getStencilVariant(stateManager, "canvas2d.polygon.stencil.even-odd", "clip.push",
+        0xFF, FillStencilMask, AGPU_NOT_EQUAL, AGPU_REPLACE, AGPU_REPLACE, false);
+    clipPopCoverPipeline = getStencilVariant(stateManager, "canvas2d.polygon.stencil.even-odd", "clip.pop",
+        0xFF, ClipStencilMask, AGPU_LESS, AGPU_REPLACE, AGPU_REPLACE, false);
+
+    if (!clipStencilNonZeroPipeline || !clipStencilEvenOddPipeline || !clippedCoverPipeline ||
+        !clipPushCoverPipeline || !clipPopCoverPipeline ||
+        (stencilNonZeroCurvePipeline && !clipStencilNonZeroCurvePipeline) ||
+        (stencilEvenOddCurvePipeline && !clipStencilEvenOddCurvePipeline))
+        return false;
+
+    addClippedPipeline(stencilNonZeroPipeline, clipStencilNonZeroPipeline);
+    addClippedPipeline(stencilEvenOddPipeline, clipStencilEvenOddPipeline);
+    addClippedPipeline(stencilNonZeroCurvePipeline, clipStencilNonZeroCurvePipeline);
+    addClippedPipeline(stencilEvenOddCurvePipeline, clipStencilEvenOddCurvePipeline);
+    addClippedPipeline(coverColorPipeline, clippedCoverPipeline);
+
+    // The other draws only pass at the clip depth.
+    return addClippedColorPipeline(convexColorLinePipeline, "canvas2d.polygon.convex.color.lines.blend.over") &&
+        addClippedColorPipeline(convexColorTrianglePipeline, "canvas2d.polygon.convex.color.triangles.blend.over") &&
+        addClippedColorPipeline(textColorPipeline, "canvas2d.text.color") &&
+        addClippedColorPipeline(textSdfColorPipeline, "canvas2d.textsdf.color") &&
+        addClippedColorPipeline(textInstancedColorPipeline, "canvas2d.text.instanced.color") &&
+        addClippedColorPipeline(textSdfInstancedColorPipeline, "canvas2d.textsdf.instanced.color") &&
+        addClippedColorPipeline(textSdfEffectsColorPipeline, "canvas2d.textsdf.effects.color") &&
+        addClippedColorPipeline(textSdfInstancedEffectsColorPipeline, "canvas2d.textsdf.instanced.effects.color") &&
+        addClippedColorPipeline(shapeInstancedColorPipeline, "canvas2d.shape.instanced.color");
+}
+
+void AgpuCanvas::addClippedPipeline(const agpu_pipeline_state_ref &pipeline, const agpu_pipeline_state_ref &clipped)
+{
+    if (!pipeline)
+        return;
+
+    ClippedPipelineState entry;
+    entry.pipeline = pipeline.get();
+    entry.clipped = clipped;
+    clippedPipelines.push_back(entry);
+}
+
+bool AgpuCanvas::addClippedColorPipeline(const agpu_pipeline_state_ref &pipeline, const char *name)
+{
+    if (!pipeline)
+        return true;
+
+    auto clipped = getStencilVariant(stateManager, name, "clipped", 0, ClipStencilMask, AGPU_EQUAL, AGPU_KEEP, AGPU_KEEP);
+    if (!clipped)
+        return false;
+
+    addClippedPipeline(pipeline, clipped);
+    return true;
+}
+
+agpu_pipeline_state *AgpuCanvas::getClippedPipeline(agpu_pipeline_state *pipeline) const
+{
+    for (auto &entry : clippedPipelines)
+    {
+        if (entry.pipeline == pipeline)
+            return entry.clipped.get();
+    }
+
+    return pipeline;
+}
+
+agpu_pipeline_state *AgpuCanvas::getUnclippedPipeline(agpu_pipeline_state *pipeline) const
+{
+    for (auto &entry : clippedPipelines)
+    {
+        if (entry.clipped.get() == pipeline)
+            return entry.pipeline;
+    }
+
+    return pipeline;
 }
 
 void AgpuCanvas::reset()
+{
+    resetRecordingState();
+    addSetStencilReferenceCommand(0);
+    textEffect = TextEffect();
+    strokeStyle = StrokeStyle();
+    currentScissor = viewportScissor;
+    clipStencilDepth = 0;
+	allocator->reset();
+
+    // Use the default font face.
+    {
+        auto &fontManager = stateManager->getEngine()->getFontManager();
+        auto defaultFont = fontManager->getDefaultFont();
+        if (defaultFont)
+            fontFace = defaultFont->getDefaultFace();
+    }
+
+}
+
+void AgpuCanvas::setViewportSize(int width, int height)
+{
+    viewportScissor.x = 0;
+    viewportScissor.y = 0;
+    viewportScissor.width = width;
+    viewportScissor.height = height;
+}
+
+void AgpuCanvas::resetRecordingState()
 {
 	baseVertex = 0;
 	startIndex = 0;
+    submeshBaseVertex = 0;
+    maxSubmeshVertexCount = 0;
+    startGlyphInstance = 0;
+    startShapeInstance = 0;
 	shapeType = ST_Unknown;
     currentPipeline = nullptr;
     currentTextureBinding = nullptr;
     currentFontBinding = nullptr;
-	drawCommandsToAdd.clear();
-    coveringType = CT_Draw;
+	drawCommands.clear();
+    textEffectConstants.clear();
+    textEffectPushed = false;
+    recordingDisplayList = false;
+    clipStack.clear();
 
-	shapeType = ST_Unknown;
 	vertices.clear();
 	indices.clear();
-	allocator->reset();
+    glyphInstances.clear();
+    shapeInstances.clear();
     currentPathProcessor = nullPathProcessor.get();
-
-    // Use the default font face.
-    {
-        auto defaultFont = stateManager->getEngine()->getFontManager()->getDefaultFont();
-        if (defaultFont)
-            fontFace = defaultFont->getDefaultFace();
-    }
-
 }
 
 void AgpuCanvas::close()
 {
-	if(vertices.empty() || indices.empty())
+	if((vertices.empty() || indices.empty()) && glyphInstances.empty() && shapeInstances.empty())
 	   return;
 	endSubmesh();
+    if (mergingBatches)
+        mergeBatches();
 
-	if(vertexCapacity < vertices.size())
-		createVertexBuffer();
-	if(indexCapacity < indices.size())
-		createIndexBuffer();
-	vertexBuffer->uploadBufferData(0, vertices.size()*sizeof(Vertex), &vertices[0]);
-	indexBuffer->uploadBufferData(0, indices.size()*sizeof(int), &indices[0]);
+    if (!uploadGeometry())
+    {
+        // Drop the frame instead of drawing with stale geometry.
+        drawCommands.clear();
+        return;
+    }
 
     // Set the shader signature.
     if(usingBundle)
     {
         bundleCommandList->reset(allocator.get(), nullptr);
-        bundleCommandList->setStencilReference(0);
 
         emitCommandsInto(bundleCommandList);
         bundleCommandList->close();
     }
 }
 
-void AgpuCanvas::emitCommandsInto(agpu_command_list_ref &commandList)
+bool AgpuCanvas::uploadGeometry()
 {
-    commandList->setShaderSignature(shaderSignature.get());
-    commandList->useShaderResources(sampler.get());
+    GpuRingBuffer::Allocation allocation;
+    frameIndexBuffer = nullptr;
+    if (!vertices.empty() && !indices.empty())
+    {
+        if (!ringBuffers->vertices->allocate(vertices.size(), allocation))
+            return false;
+        memcpy(allocation.data, &vertices[0], vertices.size()*sizeof(Vertex));
+        frameVertexOffset = allocation.offset;
+        if (boundVertexBuffer != allocation.buffer)
+        {
+            vertexBufferBinding->bindVertexBuffers(1, &allocation.buffer);
+            boundVertexBuffer = allocation.buffer;
+        }
+
+        // The indices are relative to their submesh, so they fit in 16 bits
+        // unless a single submesh has more vertices. The short indices are
+        // narrowed straight into the mapped buffer.
+        if (maxSubmeshVertexCount <= 0x10000)
+        {
+            if (!ringBuffers->shortIndices->allocate(indices.size(), allocation))
+                return false;
+
+            auto source = &indices[0];
+            auto dest = reinterpret_cast<uint16_t*> (allocation.data);
+            for (size_t i = 0; i < indices.size(); ++i)
+                dest[i] = uint16_t(source[i]);
+        }
+        else
+        {
+            if (!ringBuffers->indices->allocate(indices.size(), allocation))
+                return false;
+            memcpy(allocation.data, &indices[0], indices.size()*sizeof(uint32_t));
+        }
+
+        frameIndexBuffer = allocation.buffer;
+        frameIndexOffset = allocation.offset;
+    }
 
-	// Store the commands in the command list.
-	commandList->useVertexBinding(vertexBufferBinding.get());
-	commandList->useIndexBuffer(indexBuffer.get());
-	for(auto &command : drawCommandsToAdd)
-		command(commandList);
+    if (!glyphInstances.empty())
+    {
+        if (!ringBuffers->glyphInstances->allocate(glyphInstances.size(), allocation))
+            return false;
+        memcpy(allocation.data, &glyphInstances[0], glyphInstances.size()*sizeof(AgpuCanvasGlyphInstance));
+        frameGlyphInstanceOffset = allocation.offset;
+
+        // The first buffer holds the corners of the quad.
+        if (boundGlyphInstanceBuffer != allocation.buffer)
+        {
+            agpu_buffer *buffers[] = {quadCornerBuffer.get(), allocation.buffer};
+            glyphInstanceBinding->bindVertexBuffers(2, buffers);
+            boundGlyphInstanceBuffer = allocation.buffer;
+        }
+    }
+
+    if (!shapeInstances.empty())
+    {
+        if (!ringBuffers->shapeInstances->allocate(shapeInstances.size(), allocation))
+            return false;
+        memcpy(allocation.data, &shapeInstances[0], shapeInstances.size()*sizeof(AgpuCanvasShapeInstance));
+        frameShapeInstanceOffset = allocation.offset;
+
+        if (boundShapeInstanceBuffer != allocation.buffer)
+        {
+            agpu_buffer *buffers[] = {quadCornerBuffer.get(), allocation.buffer};
+            shapeInstanceBinding->bindVertexBuffers(2, buffers);
+            boundShapeInstanceBuffer = allocation.buffer;
+        }
+    }
+
+    return true;
 }
 
-const agpu_ref<agpu_command_list> &AgpuCanvas::getCommandBundle()
+bool AgpuCanvas::usesFontBinding(agpu_pipeline_state *pipeline) const
 {
-	return bundleCommandList;
+    pipeline = getUnclippedPipeline(pipeline);
+    return pipeline == textColorPipeline.get() || pipeline == textSdfColorPipeline.get() ||
+        (textInstancedColorPipeline && pipeline == textInstancedColorPipeline.get()) ||
+        (textSdfInstancedColorPipeline && pipeline == textSdfInstancedColorPipeline.get()) ||
+        usesTextEffectConstants(pipeline);
 }
 
-void AgpuCanvas::setColor(const glm::vec4 &color)
+bool AgpuCanvas::usesTextEffectConstants(agpu_pipeline_state *pipeline) const
 {
-	currentColor = color;
+    pipeline = getUnclippedPipeline(pipeline);
+    return (textSdfEffectsColorPipeline && pipeline == textSdfEffectsColorPipeline.get()) ||
+        (textSdfInstancedEffectsColorPipeline && pipeline == textSdfInstancedEffectsColorPipeline.get());
 }
 
-void AgpuCanvas::drawLine(const glm::vec2 &p1, const glm::vec2 &p2)
+bool AgpuCanvas::isReorderablePipeline(agpu_pipeline_state *pipeline) const
 {
-    beginConvexLines();
-	addVertex(Vertex(transformPosition(p1), currentColor));
-	addVertex(Vertex(transformPosition(p2), currentColor));
-	addIndex(0);
-	addIndex(1);
+    // The stencil and cover pipelines depend on the stencil contents, so
+    // their draws are barriers. The clipped variants only test the clip
+    // depth, which is changed by barriers.
+    pipeline = getUnclippedPipeline(pipeline);
+    return pipeline == convexColorLinePipeline.get() || pipeline == convexColorTrianglePipeline.get() ||
+        (shapeInstancedColorPipeline && pipeline == shapeInstancedColorPipeline.get()) ||
+        usesFontBinding(pipeline);
 }
 
-void AgpuCanvas::drawTriangle(const glm::vec2 &p1, const glm::vec2 &p2, const glm::vec2 &p3)
+void AgpuCanvas::computeBatchBounds(DrawBatch &batch) const
 {
-    beginConvexTriangles();
-	addVertex(Vertex(transformPosition(p1), currentColor));
-	addVertex(Vertex(transformPosition(p2), currentColor));
-	addVertex(Vertex(transformPosition(p3), currentColor));
-	addIndex(0);
-	addIndex(1);
-	addIndex(1);
-	addIndex(2);
-	addIndex(2);
-	addIndex(0);
+    auto &draw = batch.command.draw;
+    Rectangle bounds(glm::vec2(FLT_MAX, FLT_MAX), glm::vec2(-FLT_MAX, -FLT_MAX));
+    if (batch.command.type == AgpuCanvasCommand::DrawGlyphInstances)
+    {
+        for (uint32_t i = 0; i < draw.instanceCount; ++i)
+        {
+            auto &rectangle = glyphInstances[draw.firstInstance + i].destRectangle;
+            bounds.insertRectangle(Rectangle(glm::vec2(rectangle.x, rectangle.y), glm::vec2(rectangle.z, rectangle.w)));
+        }
+        batch.vertexCount = 0;
+    }
+    else if (batch.command.type == AgpuCanvasCommand::DrawShapeInstances)
+    {
+        for (uint32_t i = 0; i < draw.instanceCount; ++i)
+        {
+            auto &instance = shapeInstances[draw.firstInstance + i];
+            auto halfStrokeWidth = instance.strokeWidth*0.5f;
+            bounds.insertRectangle(Rectangle(glm::vec2(instance.rectangle.x, instance.rectangle.y) - halfStrokeWidth,
+                glm::vec2(instance.rectangle.z, instance.rectangle.w) + halfStrokeWidth));
+        }
+        batch.vertexCount = 0;
+    }
+    else
+    {
+        uint32_t maxIndex = 0;
+        for (uint32_t i = 0; i < draw.indexCount; ++i)
+        {
+            auto index = indices[draw.firstIndex + i];
+            maxIndex = std::max(maxIndex, index);
+            bounds.insertPoint(vertices[draw.baseVertex + index].position);
+        }
+        batch.vertexCount = maxIndex + 1;
+    }
+
+    // Leave room for the width of the lines and the antialiasing.
+    bounds.min -= 1.0f;
+    bounds.max += 1.0f;
+    batch.bounds = bounds;
+}
+
+void AgpuCanvas::mergeBatches()
+{
+    drawBatches.clear();
+    drawBatchGroups.clear();
+    mergedIndices.clear();
+    mergedGlyphInstances.clear();
+    mergedShapeInstances.clear();
+    mergedCommands.clear();
+    mergedPipeline = nullptr;
+    mergedBinding = nullptr;
+    mergedTextEffectConstantsIndex = NoTextEffectConstants;
+    mergedMaxSubmeshVertexCount = 0;
+
+    agpu_pipeline_state *pipeline = nullptr;
+    agpu_shader_resource_binding *binding = nullptr;
+    auto textEffectConstantsIndex = NoTextEffectConstants;
+    for (auto &command : drawCommands)
+    {
+        switch (command.type)
+        {
+        case AgpuCanvasCommand::UsePipelineState:
+            pipeline = command.pipeline;
+            break;
+        case AgpuCanvasCommand::UseShaderResources:
+            binding = command.binding;
+            break;
+        case AgpuCanvasCommand::PushTextEffectConstants:
+            textEffectConstantsIndex = command.textEffectConstantsIndex;
+            break;
+        case AgpuCanvasCommand::SetStencilReference:
+        case AgpuCanvasCommand::SetScissor:
+            flushBatchGroups();
+            mergedCommands.push_back(command);
+            break;
+        case AgpuCanvasCommand::DrawElements:
+        case AgpuCanvasCommand::DrawGlyphInstances:
+        case AgpuCanvasCommand::DrawShapeInstances:
+            {
+                DrawBatch batch;
+                batch.command = command;
+                batch.pipeline = pipeline;
+                batch.binding = usesFontBinding(pipeline) ? binding : nullptr;
+                batch.textEffectConstantsIndex = usesTextEffectConstants(pipeline) ? textEffectConstantsIndex : NoTextEffectConstants;
+                batch.next = -1;
+                computeBatchBounds(batch);
+
+                if (isReorderablePipeline(pipeline))
+                {
+                    addBatch(batch);
+                }
+                else
+                {
+                    flushBatchGroups();
+                    addBatch(batch);
+                    flushBatchGroups();
+                }
+            }
+            break;
+        }
+    }
+    flushBatchGroups();
+
+    indices.swap(mergedIndices);
+    glyphInstances.swap(mergedGlyphInstances);
+    shapeInstances.swap(mergedShapeInstances);
+    drawCommands.swap(mergedCommands);
+    maxSubmeshVertexCount = mergedMaxSubmeshVertexCount;
 }
 
-void AgpuCanvas::drawRectangle(const Rectangle &rectangle)
+void AgpuCanvas::addBatch(const DrawBatch &batch)
 {
-    beginConvexLines();
-	addVertex(Vertex(transformPosition(rectangle.getBottomLeft()), currentColor));
-	addVertex(Vertex(transformPosition(rectangle.getBottomRight()), currentColor));
-	addVertex(Vertex(transformPosition(rectangle.getTopRight()), currentColor));
-	addVertex(Vertex(transformPosition(rectangle.getTopLeft()), currentColor));
-	addIndex(0);
-	addIndex(1);
-	addIndex(1);
-	addIndex(2);
-	addIndex(2);
+    auto batchIndex = int(drawBatches.size());
+    drawBatches.push_back(batch);
+
+    // Move the batch back into the latest group with the same state, unless
+    // it overlaps a group that is drawn after that one.
+    size_t searchedCount = 0;
+    for (auto i = drawBatchGroups.size(); i > 0 && searchedCount < BatchMergeSearchDepth; --i, ++searchedCount)
+    {
+        auto &group = drawBatchGroups[i - 1];
+        auto &last = drawBatches[group.lastBatch];
+        if (last.command.type == batch.command.type && last.pipeline == batch.pipeline &&
+            last.binding == batch.binding && last.textEffectConstantsIndex == batch.textEffectConstantsIndex)
+        {
+            last.next = batchIndex;
+            group.lastBatch = batchIndex;
+            group.bounds.insertRectangle(batch.bounds);
+            return;
+        }
+
+        if (group.bounds.intersectsOrContains(batch.bounds))
+            break;
+    }
+
+    DrawBatchGroup group;
+    group.firstBatch = batchIndex;
+    group.lastBatch = batchIndex;
+    group.bounds = batch.bounds;
+    drawBatchGroups.push_back(group);
+}
+
+void AgpuCanvas::flushBatchGroups()
+{
+    for (auto &group : drawBatchGroups)
+    {
+        auto &first = drawBatches[group.firstBatch];
+        emitBatchState(first);
+
+        // The glyph instances of the group are copied together.
+        if (first.command.type == AgpuCanvasCommand::DrawGlyphInstances)
+        {
+            auto firstInstance = mergedGlyphInstances.size();
+            for (auto i = group.firstBatch; i >= 0; i = drawBatches[i].next)
+            {
+                auto &draw = drawBatches[i].command.draw;
+                auto source = glyphInstances.begin() + draw.firstInstance;
+                mergedGlyphInstances.insert(mergedGlyphInstances.end(), source, source + draw.instanceCount);
+            }
+
+            auto command = first.command;
+            command.draw.instanceCount = uint32_t(mergedGlyphInstances.size() - firstInstance);
+            command.draw.firstInstance = uint32_t(firstInstance);
+            mergedCommands.push_back(command);
+            continue;
+        }
+
+        if (first.command.type == AgpuCanvasCommand::DrawShapeInstances)
+        {
+            auto firstInstance = mergedShapeInstances.size();
+            for (auto i = group.firstBatch; i >= 0; i = drawBatches[i].next)
+            {
+                auto &draw = drawBatches[i].command.draw;
+                auto source = shapeInstances.begin() + draw.firstInstance;
+                mergedShapeInstances.insert(mergedShapeInstances.end(), source, source + draw.instanceCount);
+            }
+
+            auto command = first.command;
+            command.draw.instanceCount = uint32_t(mergedShapeInstances.size() - firstInstance);
+            command.draw.firstInstance = uint32_t(firstInstance);
+            mergedCommands.push_back(command);
+            continue;
+        }
+
+        // The indices are rebased to the first submesh of each merged draw,
+        // which is split when they would not fit in 16 bits.
+        AgpuCanvasCommand mergedDraw;
+        bool hasMergedDraw = false;
+        for (auto i = group.firstBatch; i >= 0; i = drawBatches[i].next)
+        {
+            auto &batch = drawBatches[i];
+            auto &draw = batch.command.draw;
+            if (hasMergedDraw && (draw.baseVertex < mergedDraw.draw.baseVertex ||
+                size_t(draw.baseVertex - mergedDraw.draw.baseVertex) + batch.vertexCount > 0x10000))
+            {
+                mergedCommands.push_back(mergedDraw);
+                hasMergedDraw = false;
+            }
+
+            if (!hasMergedDraw)
+            {
+                mergedDraw = batch.command;
+                mergedDraw.draw.firstIndex = uint32_t(mergedIndices.size());
+                mergedDraw.draw.indexCount = 0;
+                hasMergedDraw = true;
+            }
+
+            auto offset = uint32_t(draw.baseVertex - mergedDraw.draw.baseVertex);
+            auto source = &indices[draw.firstIndex];
+            for (uint32_t j = 0; j < draw.indexCount; ++j)
+                mergedIndices.push_back(source[j] + offset);
+            mergedDraw.draw.indexCount += draw.indexCount;
+            mergedMaxSubmeshVertexCount = std::max(mergedMaxSubmeshVertexCount, size_t(offset + batch.vertexCount));
+        }
+
+        if (hasMergedDraw)
+            mergedCommands.push_back(mergedDraw);
+    }
+
+    drawBatches.clear();
+    drawBatchGroups.clear();
+}
+
+void AgpuCanvas::emitBatchState(const DrawBatch &batch)
+{
+    if (batch.pipeline != mergedPipeline)
+    {
+        AgpuCanvasCommand command;
+        command.type = AgpuCanvasCommand::UsePipelineState;
+        command.pipeline = batch.pipeline;
+        mergedCommands.push_back(command);
+        mergedPipeline = batch.pipeline;
+    }
+
+    if (batch.binding && batch.binding != mergedBinding)
+    {
+        AgpuCanvasCommand command;
+        command.type = AgpuCanvasCommand::UseShaderResources;
+        command.binding = batch.binding;
+        mergedCommands.push_back(command);
+        mergedBinding = batch.binding;
+    }
+
+    if (batch.textEffectConstantsIndex != NoTextEffectConstants && batch.textEffectConstantsIndex != mergedTextEffectConstantsIndex)
+    {
+        AgpuCanvasCommand command;
+        command.type = AgpuCanvasCommand::PushTextEffectConstants;
+        command.textEffectConstantsIndex = batch.textEffectConstantsIndex;
+        mergedCommands.push_back(command);
+        mergedTextEffectConstantsIndex = batch.textEffectConstantsIndex;
+    }
+}
+
+void AgpuCanvas::emitCommandsInto(agpu_command_list_ref &commandList)
+{
+    commandList->setShaderSignature(shaderSignature.get());
+    commandList->useShaderResources(sampler.get());
+
+	// Store the commands in the command list.
+	commandList->useVertexBinding(vertexBufferBinding.get());
+	if(frameIndexBuffer)
+		commandList->useIndexBuffer(frameIndexBuffer);
+	for(auto &command : drawCommands)
+    {
+        switch (command.type)
+        {
+        case AgpuCanvasCommand::UsePipelineState:
+            commandList->usePipelineState(command.pipeline);
+            break;
+        case AgpuCanvasCommand::UseShaderResources:
+            commandList->useShaderResources(command.binding);
+            break;
+        case AgpuCanvasCommand::DrawElements:
+            commandList->drawElements(command.draw.indexCount, command.draw.instanceCount,
+                agpu_uint(command.draw.firstIndex + frameIndexOffset), agpu_int(command.draw.baseVertex + frameVertexOffset),
+                command.draw.firstInstance);
+            break;
+        case AgpuCanvasCommand::DrawGlyphInstances:
+            // Draw the shared quad once per glyph, and restore the canvas buffers.
+            commandList->useVertexBinding(glyphInstanceBinding.get());
+            commandList->useIndexBuffer(quadIndexBuffer.get());
+            commandList->drawElements(command.draw.indexCount, command.draw.instanceCount, command.draw.firstIndex, command.draw.baseVertex,
+                agpu_uint(command.draw.firstInstance + frameGlyphInstanceOffset));
+            commandList->useVertexBinding(vertexBufferBinding.get());
+            if (frameIndexBuffer)
+                commandList->useIndexBuffer(frameIndexBuffer);
+            break;
+        case AgpuCanvasCommand::DrawShapeInstances:
+            commandList->useVertexBinding(shapeInstanceBinding.get());
+            commandList->useIndexBuffer(quadIndexBuffer.get());
+            commandList->drawElements(command.draw.indexCount, command.draw.instanceCount, command.draw.firstIndex, command.draw.baseVertex,
+                agpu_uint(command.draw.firstInstance + frameShapeInstanceOffset));
+            commandList->useVertexBinding(vertexBufferBinding.get());
+            if (frameIndexBuffer)
+                commandList->useIndexBuffer(frameIndexBuffer);
+            break;
+        case AgpuCanvasCommand::SetStencilReference:
+            commandList->setStencilReference(command.stencilReference);
+            break;
+        case AgpuCanvasCommand::PushTextEffectConstants:
+            commandList->pushConstants(0, sizeof(AgpuCanvasTextEffectConstants), &textEffectConstants[command.textEffectConstantsIndex]);
+            break;
+        case AgpuCanvasCommand::SetScissor:
+            commandList->setScissor(command.scissor.x, command.scissor.y, command.scissor.width, command.scissor.height);
+            break;
+        }
+    }
+}
+
+const agpu_ref<agpu_command_list> &AgpuCanvas::getCommandBundle()
+{
+	return bundleCommandList;
+}
+
+void AgpuCanvas::setColor(const glm::vec4 &color)
+{
+	currentColor = color;
+}
+
+void AgpuCanvas::drawLine(const glm::vec2 &p1, const glm::vec2 &p2)
+{
+    if (!strokeStyle.isHairline())
+    {
+        beginStrokePath();
+        moveTo(p1);
+        lineTo(p2);
+        endStrokePath();
+        return;
+    }
+
+    beginConvexLines();
+	addVertex(Vertex(transformPosition(p1), currentColor));
+	addVertex(Vertex(transformPosition(p2), currentColor));
+	addIndex(0);
+	addIndex(1);
+}
+
+void AgpuCanvas::drawTriangle(const glm::vec2 &p1, const glm::vec2 &p2, const glm::vec2 &p3)
+{
+    if (!strokeStyle.isHairline())
+    {
+        beginStrokePath();
+        moveTo(p1);
+        lineTo(p2);
+        lineTo(p3);
+        closePath();
+        endStrokePath();
+        return;
+    }
+
+    beginConvexTriangles();
+	addVertex(Vertex(transformPosition(p1), currentColor));
+	addVertex(Vertex(transformPosition(p2), currentColor));
+	addVertex(Vertex(transformPosition(p3), currentColor));
+	addIndex(0);
+	addIndex(1);
+	addIndex(1);
+	addIndex(2);
+	addIndex(2);
+	addIndex(0);
+}
+
+void AgpuCanvas::drawRectangle(const Rectangle &rectangle)
+{
+    if (!isVisible(inflateRectangle(rectangle, strokeStyle.width*0.5f)))
+        return;
+
+    if (!strokeStyle.isHairline())
+    {
+        // The analytic rectangle has mitered corners.
+        if (strokeStyle.join == StrokeJoin::Miter &&
+            drawShapeInstance(rectangle, glm::vec2(), true, AgpuCanvasShapeInstance::RoundedRectangleKind))
+            return;
+
+        if (strokeStyle.join != StrokeJoin::Miter)
+        {
+            beginStrokePath();
+            moveTo(rectangle.getBottomLeft());
+            lineTo(rectangle.getBottomRight());
+            lineTo(rectangle.getTopRight());
+            lineTo(rectangle.getTopLeft());
+            closePath();
+            endStrokePath();
+            return;
+        }
+
+        // A mitered rectangle is the ring between two rectangles.
+        auto halfWidth = strokeStyle.width*0.5f;
+        glm::vec2 corners[] = {
+            rectangle.getBottomLeft(), rectangle.getBottomRight(), rectangle.getTopRight(), rectangle.getTopLeft()
+        };
+        glm::vec2 directions[] = {
+            glm::vec2(-1, -1), glm::vec2(1, -1), glm::vec2(1, 1), glm::vec2(-1, 1)
+        };
+
+        glm::vec2 outerPoints[4];
+        glm::vec2 innerPoints[4];
+        auto innerHalfWidth = std::min(halfWidth, std::min(rectangle.getSize().x, rectangle.getSize().y)*0.5f);
+        for (int i = 0; i < 4; ++i)
+        {
+            outerPoints[i] = corners[i] + directions[i]*halfWidth;
+            innerPoints[i] = corners[i] - directions[i]*innerHalfWidth;
+        }
+        addStrokeRing(outerPoints, innerPoints, 4);
+        return;
+    }
+
+    beginConvexLines();
+	addVertex(Vertex(transformPosition(rectangle.getBottomLeft()), currentColor));
+	addVertex(Vertex(transformPosition(rectangle.getBottomRight()), currentColor));
+	addVertex(Vertex(transformPosition(rectangle.getTopRight()), currentColor));
+	addVertex(Vertex(transformPosition(rectangle.getTopLeft()), currentColor));
+	addIndex(0);
+	addIndex(1);
+	addIndex(1);
+	addIndex(2);
+	addIndex(2);
 	addIndex(3);
 	addIndex(3);
 	addIndex(0);
@@ -427,6 +1385,51 @@ void AgpuCanvas::drawRectangle(const Rectangle &rectangle)
 
 void AgpuCanvas::drawRoundedRectangle(const Rectangle &rectangle, float cornerRadius)
 {
+    if (!isVisible(inflateRectangle(rectangle, strokeStyle.width*0.5f)))
+        return;
+
+    if (drawShapeInstance(rectangle, glm::vec2(cornerRadius, cornerRadius), true, AgpuCanvasShapeInstance::RoundedRectangleKind))
+        return;
+
+    if (!strokeStyle.isHairline())
+    {
+        // Sample the corner arcs directly, with the inner and the outer
+        // radius of the stroke.
+        auto size = rectangle.getSize();
+        auto radius = std::max(std::min(cornerRadius, std::min(size.x, size.y)*0.5f), 0.0f);
+        auto halfWidth = strokeStyle.width*0.5f;
+        auto outerRadius = radius + halfWidth;
+        auto innerRadius = std::max(radius - halfWidth, 0.0f);
+        auto segmentCount = computeArcSegmentCount(outerRadius, HalfPi);
+
+        glm::vec2 centers[] = {
+            glm::vec2(rectangle.min.x + radius, rectangle.min.y + radius),
+            glm::vec2(rectangle.max.x - radius, rectangle.min.y + radius),
+            glm::vec2(rectangle.max.x - radius, rectangle.max.y - radius),
+            glm::vec2(rectangle.min.x + radius, rectangle.max.y - radius),
+        };
+
+        auto pointCount = 4*(segmentCount + 1);
+        strokeRingPoints.resize(pointCount*2);
+        auto outerPoints = &strokeRingPoints[0];
+        auto innerPoints = &strokeRingPoints[pointCount];
+        size_t destIndex = 0;
+        for (int corner = 0; corner < 4; ++corner)
+        {
+            auto startAngle = Pi + HalfPi*corner;
+            for (int i = 0; i <= segmentCount; ++i, ++destIndex)
+            {
+                auto angle = startAngle + HalfPi*i / segmentCount;
+                auto direction = glm::vec2(cos(angle), sin(angle));
+                outerPoints[destIndex] = centers[corner] + direction*outerRadius;
+                innerPoints[destIndex] = centers[corner] + direction*innerRadius;
+            }
+        }
+
+        addStrokeRing(outerPoints, innerPoints, pointCount);
+        return;
+    }
+
     glm::vec2 dx(cornerRadius, 0);
     glm::vec2 dy(0, cornerRadius);
 
@@ -456,21 +1459,27 @@ void AgpuCanvas::drawFillTriangle(const glm::vec2 &p1, const glm::vec2 &p2, cons
 
 void AgpuCanvas::drawFillRectangle(const Rectangle &rectangle)
 {
+    if (!isVisible(rectangle))
+        return;
+
+    // A rectangle on the pixel grid has no partially covered pixels, so it
+    // only needs the analytic antialiasing elsewhere.
+    if (canDrawShapeInstance() && !isPixelAligned(transformRectangleBounds(rectangle)) &&
+        drawShapeInstance(rectangle, glm::vec2(), false, AgpuCanvasShapeInstance::RoundedRectangleKind))
+        return;
+
     beginConvexTriangles();
-	addVertex(Vertex(transformPosition(rectangle.getBottomLeft()), currentColor));
-	addVertex(Vertex(transformPosition(rectangle.getBottomRight()), currentColor));
-	addVertex(Vertex(transformPosition(rectangle.getTopRight()), currentColor));
-	addVertex(Vertex(transformPosition(rectangle.getTopLeft()), currentColor));
-	addIndex(0);
-	addIndex(1);
-	addIndex(2);
-	addIndex(2);
-	addIndex(3);
-	addIndex(0);
+    addQuadVertices(addQuads(1), rectangle, Rectangle(glm::vec2(0, 0), glm::vec2(0, 0)), currentColor);
 }
 
 void AgpuCanvas::drawFillRoundedRectangle(const Rectangle &rectangle, float cornerRadius)
 {
+    if (!isVisible(rectangle))
+        return;
+
+    if (drawShapeInstance(rectangle, glm::vec2(cornerRadius, cornerRadius), false, AgpuCanvasShapeInstance::RoundedRectangleKind))
+        return;
+
     glm::vec2 dx(cornerRadius, 0);
     glm::vec2 dy(0, cornerRadius);
 
@@ -487,24 +1496,129 @@ void AgpuCanvas::drawFillRoundedRectangle(const Rectangle &rectangle, float corn
     endFillPath();
 }
 
+void AgpuCanvas::drawEllipse(const Rectangle &rectangle)
+{
+    if (!isVisible(inflateRectangle(rectangle, strokeStyle.width*0.5f)))
+        return;
+
+    if (!drawShapeInstance(rectangle, rectangle.getSize()*0.5f, true, AgpuCanvasShapeInstance::EllipseKind))
+        Canvas::drawEllipse(rectangle);
+}
+
+void AgpuCanvas::drawFillEllipse(const Rectangle &rectangle)
+{
+    if (!isVisible(rectangle))
+        return;
+
+    if (!drawShapeInstance(rectangle, rectangle.getSize()*0.5f, false, AgpuCanvasShapeInstance::EllipseKind))
+        Canvas::drawFillEllipse(rectangle);
+}
+
+bool AgpuCanvas::canDrawShapeInstance() const
+{
+    // The instances are axis aligned in device space.
+    return shapeInstancedColorPipeline && transform[0][1] == 0.0f && transform[1][0] == 0.0f;
+}
+
+bool AgpuCanvas::drawShapeInstance(const Rectangle &rectangle, const glm::vec2 &radii, bool stroked, float kind)
+{
+    if (!canDrawShapeInstance())
+        return false;
+
+    auto scale = glm::vec2(fabs(transform[0][0]), fabs(transform[1][1]));
+    auto deviceRectangle = transformRectangleBounds(rectangle);
+    auto halfSize = deviceRectangle.getSize()*0.5f;
+
+    AgpuCanvasShapeInstance instance;
+    instance.rectangle = glm::vec4(deviceRectangle.min, deviceRectangle.max);
+    instance.radii = glm::clamp(radii*scale, glm::vec2(0.0f, 0.0f), halfSize);
+    instance.kind = kind;
+    instance.color = packColorRGBA8(currentColor);
+
+    // The hairlines stay one pixel wide, like the line primitives.
+    instance.strokeWidth = 0.0f;
+    if (stroked)
+        instance.strokeWidth = strokeStyle.isHairline() ? 1.0f : strokeStyle.width*std::min(scale.x, scale.y);
+
+    beginShapeWithPipeline(ST_ShapeInstance, shapeInstancedColorPipeline.get());
+    shapeInstances.push_back(instance);
+    return true;
+}
+
 // Text drawing
 glm::vec2 AgpuCanvas::drawText(const std::string &text, int pointSize, glm::vec2 position)
 {
     if (!fontFace)
         return position;
-    return fontFace->drawUtf8(this, text, pointSize, position);
+
+    auto &layoutCache = stateManager->getEngine()->getFontManager()->getTextLayoutCache();
+    return drawTextLayout(layoutCache.getUtf8(fontFace.get(), text, pointSize), position);
 }
 
 glm::vec2 AgpuCanvas::drawTextUtf16(const std::wstring &text, int pointSize, glm::vec2 position)
 {
     if (!fontFace)
         return position;
-    return fontFace->drawUtf16(this, text, pointSize, position);
+
+    auto &layoutCache = stateManager->getEngine()->getFontManager()->getTextLayoutCache();
+    return drawTextLayout(layoutCache.getUtf16(fontFace.get(), text, pointSize), position);
+}
+
+glm::vec2 AgpuCanvas::drawTextLayout(const TextLayoutPtr &layout, glm::vec2 position)
+{
+    if (!layout)
+        return position;
+
+    // The effects draw outside of the glyphs.
+    auto &bounds = layout->getBounds();
+    auto margin = textEffect.outlineWidth + textEffect.shadowSoftness +
+        std::max(fabs(textEffect.shadowOffset.x), fabs(textEffect.shadowOffset.y));
+    if (!isVisible(Rectangle(position + bounds.min - margin, position + bounds.max + margin)))
+        return position + layout->getAdvance();
+
+    return layout->draw(this, position);
+}
+
+const TextEffect &AgpuCanvas::getTextEffect() const
+{
+    return textEffect;
+}
+
+void AgpuCanvas::setTextEffect(const TextEffect &effect)
+{
+    textEffect = effect;
+}
+
+void AgpuCanvas::useTextEffectConstants()
+{
+    if (textEffectPushed && pushedTextEffect == textEffect)
+        return;
+
+    // The draws already recorded use the old constants.
+    endSubmesh();
+
+    AgpuCanvasTextEffectConstants constants;
+    constants.outlineColor = textEffect.outlineColor;
+    constants.shadowColor = textEffect.shadowColor;
+    constants.shadowOffset = textEffect.shadowOffset;
+    constants.outlineWidth = textEffect.outlineWidth;
+    constants.shadowSoftness = textEffect.shadowSoftness;
+    addCommand(AgpuCanvasCommand::PushTextEffectConstants);
+    drawCommands.back().textEffectConstantsIndex = uint32_t(textEffectConstants.size());
+    textEffectConstants.push_back(constants);
+
+    pushedTextEffect = textEffect;
+    textEffectPushed = true;
 }
 
 void AgpuCanvas::beginBitmapTextDrawing(void *binding, bool distanceField)
 {
-    if(distanceField)
+    if (isUsingTextEffect(distanceField) && textSdfEffectsColorPipeline)
+    {
+        beginShapeWithPipeline(ST_Triangle, textSdfEffectsColorPipeline.get(), nullptr, (agpu_shader_resource_binding*)binding);
+        useTextEffectConstants();
+    }
+    else if(distanceField)
         beginShapeWithPipeline(ST_Triangle, textSdfColorPipeline.get(), nullptr, (agpu_shader_resource_binding*)binding);
     else
         beginShapeWithPipeline(ST_Triangle, textColorPipeline.get(), nullptr, (agpu_shader_resource_binding*) binding);
@@ -512,44 +1626,80 @@ void AgpuCanvas::beginBitmapTextDrawing(void *binding, bool distanceField)
 
 void AgpuCanvas::withNewBaseVertex()
 {
+    // A primitive boundary is the only place where a submesh can be split.
+    if (startIndex == (int)indices.size())
+        submeshBaseVertex = vertices.size();
+    else if (vertices.size() - submeshBaseVertex >= ShortIndexSubmeshVertexLimit)
+        endSubmesh();
+
     baseVertex = (agpu_uint)vertices.size();
 }
 
 void AgpuCanvas::drawBitmapCharacter(const Rectangle &destRectangle, Rectangle &sourceRectangle)
 {
-    withNewBaseVertex();
-    addVertex(Vertex(transformPosition(destRectangle.getBottomLeft()), sourceRectangle.getBottomLeft(), currentColor));
-    addVertex(Vertex(transformPosition(destRectangle.getBottomRight()), sourceRectangle.getBottomRight(), currentColor));
-    addVertex(Vertex(transformPosition(destRectangle.getTopRight()), sourceRectangle.getTopRight(), currentColor));
-    addVertex(Vertex(transformPosition(destRectangle.getTopLeft()), sourceRectangle.getTopLeft(), currentColor));
-    addIndex(0);
-    addIndex(1);
-    addIndex(2);
-    addIndex(2);
-    addIndex(3);
-    addIndex(0);
+    addQuadVertices(addQuads(1), destRectangle, sourceRectangle, currentColor);
 }
 
 void AgpuCanvas::endBitmapTextDrawing()
 {
 }
 
-// Covering
-void AgpuCanvas::coverBox(const Rectangle &rectangle)
+void AgpuCanvas::drawGlyphRun(void *binding, bool distanceField, const CanvasGlyph *glyphs, size_t count)
 {
-    switch (coveringType)
+    if (!count)
+        return;
+
+    auto usingEffect = isUsingTextEffect(distanceField);
+
+    // The instanced glyphs are axis aligned, so fallback to quads with a
+    // rotated or scaled transform.
+    agpu_pipeline_state *pipeline;
+    if (usingEffect)
+        pipeline = textSdfInstancedEffectsColorPipeline.get();
+    else
+        pipeline = distanceField ? textSdfInstancedColorPipeline.get() : textInstancedColorPipeline.get();
+    if (!pipeline || !isTranslationTransform())
     {
-    case CT_Draw:
-        beginShapeWithPipeline(ST_Triangle, coverColorPipeline.get());
-        break;
-    case CT_ClipPath:
-        beginShapeWithPipeline(ST_Triangle, coverColorPipeline.get());
-        break;
-    case CT_ClipPathPop:
-        beginShapeWithPipeline(ST_Triangle, coverColorPipeline.get());
-        break;
+        // Write the quads in bulk, in chunks that keep the indices short.
+        auto color = currentColor;
+        beginBitmapTextDrawing(binding, distanceField);
+        for (size_t i = 0; i < count; )
+        {
+            auto chunkSize = std::min(count - i, size_t(1024));
+            auto destVertices = addQuads(chunkSize);
+            for (size_t j = 0; j < chunkSize; ++j, ++i, destVertices += 4)
+                addQuadVertices(destVertices, glyphs[i].destRectangle, glyphs[i].sourceRectangle, color);
+        }
+        endBitmapTextDrawing();
+        return;
+    }
+
+    beginShapeWithPipeline(ST_GlyphInstance, pipeline, nullptr, (agpu_shader_resource_binding*)binding);
+    if (usingEffect)
+        useTextEffectConstants();
+
+    auto translation = glm::vec2(transform[2][0], transform[2][1]);
+    auto color = packColorRGBA8(currentColor);
+    auto firstInstance = glyphInstances.size();
+    glyphInstances.resize(firstInstance + count);
+    auto instances = &glyphInstances[firstInstance];
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto &glyph = glyphs[i];
+        auto &instance = instances[i];
+        instance.destRectangle = glm::vec4(glyph.destRectangle.min + translation, glyph.destRectangle.max + translation);
+        instance.sourceRectangle[0] = packUnorm16(glyph.sourceRectangle.min.x);
+        instance.sourceRectangle[1] = packUnorm16(glyph.sourceRectangle.min.y);
+        instance.sourceRectangle[2] = packUnorm16(glyph.sourceRectangle.max.x);
+        instance.sourceRectangle[3] = packUnorm16(glyph.sourceRectangle.max.y);
+        instance.color = color;
     }
+}
 
+// Covering
+void AgpuCanvas::coverBox(const Rectangle &rectangle)
+{
+    beginShapeWithPipeline(ST_Triangle, coverColorPipeline.get());
     addVertex(Vertex(transformPosition(rectangle.getBottomLeft()), currentColor));
     addVertex(Vertex(transformPosition(rectangle.getBottomRight()), currentColor));
     addVertex(Vertex(transformPosition(rectangle.getTopRight()), currentColor));
@@ -562,6 +1712,21 @@ void AgpuCanvas::coverBox(const Rectangle &rectangle)
     addIndex(0);
 }
 
+void AgpuCanvas::coverDeviceRectangle(const Rectangle &rectangle, agpu_pipeline_state *pipeline)
+{
+    beginShapeWithPipeline(ST_Triangle, pipeline);
+    addVertex(Vertex(rectangle.getBottomLeft(), currentColor));
+    addVertex(Vertex(rectangle.getBottomRight(), currentColor));
+    addVertex(Vertex(rectangle.getTopRight(), currentColor));
+    addVertex(Vertex(rectangle.getTopLeft(), currentColor));
+    addIndex(0);
+    addIndex(1);
+    addIndex(2);
+    addIndex(2);
+    addIndex(3);
+    addIndex(0);
+}
+
 // Fill paths.
 void AgpuCanvas::beginFillPath(PathFillRule fillRule)
 {
@@ -577,63 +1742,404 @@ void AgpuCanvas::beginFillPath(PathFillRule fillRule)
         currentPathProcessor = convexPathProcessor.get();
         break;
     }
-    coveringType = CT_Draw;
+
+    // The path is processed at its end, unless its tessellation is cached.
+    if (shapeCache)
+    {
+        recordingFillPath = true;
+        recordedFillRule = fillRule;
+        recordedPath.clear();
+        return;
+    }
+
     currentPathProcessor->begin();
 }
 
 void AgpuCanvas::endFillPath()
 {
+    if (recordingFillPath)
+    {
+        recordingFillPath = false;
+        endCachedFillPath();
+        currentPathProcessor = nullPathProcessor.get();
+        return;
+    }
+
     currentPathProcessor->end();
     currentPathProcessor = nullPathProcessor.get();
 }
 
+void AgpuCanvas::recordPathCommand(AgpuPathCommand::Type type, const glm::vec2 &p1, const glm::vec2 &p2, const glm::vec2 &p3)
+{
+    AgpuPathCommand command;
+    command.type = type;
+    command.points[0] = p1;
+    command.points[1] = p2;
+    command.points[2] = p3;
+    recordedPath.push_back(command);
+}
+
+void AgpuCanvas::endCachedFillPath()
+{
+    // The path is made relative to its start point, so the same shape at
+    // another position is a hit.
+    glm::vec2 origin;
+    if (!recordedPath.empty() && recordedPath.front().type == AgpuPathCommand::MoveTo)
+        origin = recordedPath.front().points[0];
+
+    static const int CommandPointCount[] = {1, 1, 2, 3, 0};
+
+    // The key is kept between the paths, to reuse its path array.
+    auto &key = recordedPathKey;
+    key.hash = 0;
+    key.path.resize(recordedPath.size());
+    for (size_t i = 0; i < recordedPath.size(); ++i)
+    {
+        auto &command = key.path[i];
+        command = recordedPath[i];
+        key.hash = key.hash*31 + command.type;
+        for (int j = 0; j < CommandPointCount[command.type]; ++j)
+        {
+            command.points[j] -= origin;
+
+            uint32_t bits[2];
+            memcpy(bits, &command.points[j], sizeof(bits));
+            key.hash = key.hash*31 + bits[0];
+            key.hash = key.hash*31 + bits[1];
+        }
+    }
+
+    key.fillRule = int(recordedFillRule);
+    key.linear[0] = transform[0][0];
+    key.linear[1] = transform[0][1];
+    key.linear[2] = transform[1][0];
+    key.linear[3] = transform[1][1];
+
+    auto deviceOrigin = transformPosition(origin);
+    auto cached = shapeCache->find(key);
+    if (cached)
+    {
+        drawTessellatedShape(*cached, deviceOrigin);
+        return;
+    }
+
+    // Process the path while capturing the geometry that it emits.
+    auto shape = std::make_shared<AgpuTessellatedShape> ();
+    capturedShape = shape.get();
+    capturedOrigin = deviceOrigin;
+    processRecordedPath();
+    capturedShape = nullptr;
+
+    shapeCache->insert(key, shape);
+}
+
+void AgpuCanvas::processRecordedPath()
+{
+    switch (recordedFillRule)
+    {
+    case PathFillRule::EvenOdd:
+        currentPathProcessor = evenOddRulePathProcessor.get();
+        break;
+    case PathFillRule::NonZero:
+        currentPathProcessor = nonZeroRulePathProcessor.get();
+        break;
+    case PathFillRule::Convex:
+        currentPathProcessor = convexPathProcessor.get();
+        break;
+    }
+
+    currentPathProcessor->begin();
+    for (auto &command : recordedPath)
+    {
+        switch (command.type)
+        {
+        case AgpuPathCommand::MoveTo:
+            currentPathProcessor->moveTo(command.points[0]);
+            break;
+        case AgpuPathCommand::LineTo:
+            currentPathProcessor->lineTo(command.points[0]);
+            break;
+        case AgpuPathCommand::QuadTo:
+            currentPathProcessor->quadTo(command.points[0], command.points[1]);
+            break;
+        case AgpuPathCommand::CubicTo:
+            currentPathProcessor->cubicTo(command.points[0], command.points[1], command.points[2]);
+            break;
+        case AgpuPathCommand::Close:
+            currentPathProcessor->closePath();
+            break;
+        }
+    }
+    currentPathProcessor->end();
+}
+
+void AgpuCanvas::drawTessellatedShape(const AgpuTessellatedShape &shape, const glm::vec2 &offset)
+{
+    auto color = currentColor;
+    for (size_t i = 0; i < shape.parts.size(); ++i)
+    {
+        auto &part = shape.parts[i];
+        auto vertexEnd = i + 1 < shape.parts.size() ? shape.parts[i + 1].firstVertex : shape.vertices.size();
+        auto indexEnd = i + 1 < shape.parts.size() ? shape.parts[i + 1].firstIndex : shape.indices.size();
+
+        beginShapeWithPipeline(ShapeType(part.shapeType), part.pipeline);
+        for (auto v = part.firstVertex; v < vertexEnd; ++v)
+        {
+            auto vertex = shape.vertices[v];
+            vertex.position += offset;
+            vertex.color = color;
+            addVertex(vertex);
+        }
+
+        for (auto index = part.firstIndex; index < indexEnd; ++index)
+            addIndex(int(shape.indices[index]));
+    }
+}
+
 void AgpuCanvas::beginClipPath(PathFillRule fillRule)
 {
-    beginFillPath();
-    coveringType = CT_ClipPath;
+    // A convex path has the same coverage with the even-odd rule.
+    auto processor = static_cast<AgpuClipPathProcessor*> (clipPathProcessor.get());
+    processor->fillRule = fillRule;
+    currentPathProcessor = processor;
+    currentPathProcessor->begin();
 }
 
 void AgpuCanvas::endClipPath()
 {
     currentPathProcessor->end();
     currentPathProcessor = nullPathProcessor.get();
-    coveringType = CT_Draw;
 }
 
 void AgpuCanvas::popClipPath()
 {
+    if (clipStack.empty())
+        return;
+
+    auto state = clipStack.back();
+    clipStack.pop_back();
+
+    // Move the pixels inside of the clip back to the outer depth.
+    if (state.usesStencil)
+    {
+        setStencilReference(state.stencilDepth);
+        coverDeviceRectangle(state.coverRectangle, clipPopCoverPipeline.get());
+        clipStencilDepth = state.stencilDepth;
+    }
+
+    if (state.scissor != currentScissor)
+        setScissor(state.scissor);
+}
+
+void AgpuCanvas::pushClipRectangle(const Rectangle &rectangle)
+{
+    // Only the rectangles that stay axis aligned can be scissored.
+    if (!isTranslationTransform())
+    {
+        Canvas::pushClipRectangle(rectangle);
+        return;
+    }
+
+    ClipState state;
+    state.scissor = currentScissor;
+    state.stencilDepth = clipStencilDepth;
+    state.usesStencil = false;
+    clipStack.push_back(state);
+    pushScissor(transformRectangleBounds(rectangle));
+}
+
+void AgpuCanvas::pushClipPath(const Rectangle &bounds, bool hasGeometry, bool stenciled)
+{
+    ClipState state;
+    state.scissor = currentScissor;
+    state.stencilDepth = clipStencilDepth;
+    state.usesStencil = false;
+
+    // An empty path clips everything.
+    auto deviceBounds = hasGeometry ? transformRectangleBounds(bounds) : Rectangle(glm::vec2(0, 0), glm::vec2(0, 0));
+    if (hasGeometry && stenciled)
+    {
+        // Move the pixels inside of the path to the next depth, and clear
+        // their winding.
+        setStencilReference(clipStencilDepth + 1);
+        coverDeviceRectangle(deviceBounds, clipPushCoverPipeline.get());
+        ++clipStencilDepth;
+
+        state.usesStencil = true;
+        state.coverRectangle = deviceBounds;
+    }
+
+    // The scissor also bounds the stencil clips, and it is the whole clip
+    // when the stencil clip is not available.
+    clipStack.push_back(state);
+    pushScissor(deviceBounds);
+}
+
+void AgpuCanvas::pushScissor(const Rectangle &deviceRectangle)
+{
+    auto minX = std::max(int32_t(floor(deviceRectangle.min.x)), currentScissor.x);
+    auto minY = std::max(int32_t(floor(deviceRectangle.min.y)), currentScissor.y);
+    auto maxX = std::min(int32_t(ceil(deviceRectangle.max.x)), currentScissor.x + currentScissor.width);
+    auto maxY = std::min(int32_t(ceil(deviceRectangle.max.y)), currentScissor.y + currentScissor.height);
 
+    AgpuCanvasCommand::ScissorRectangle scissor;
+    scissor.x = minX;
+    scissor.y = minY;
+    scissor.width = std::max(maxX - minX, 0);
+    scissor.height = std::max(maxY - minY, 0);
+    if (scissor != currentScissor)
+        setScissor(scissor);
+}
+
+void AgpuCanvas::setScissor(const AgpuCanvasCommand::ScissorRectangle &scissor)
+{
+    // The draws already recorded use the old scissor.
+    endSubmesh();
+    addSetScissorCommand(scissor);
+    currentScissor = scissor;
+}
+
+void AgpuCanvas::setStencilReference(uint32_t clipDepth)
+{
+    endSubmesh();
+    addSetStencilReferenceCommand(clipDepth << ClipStencilShift);
+}
+
+Rectangle AgpuCanvas::transformRectangleBounds(const Rectangle &rectangle) const
+{
+    auto bottomLeft = transformPosition(rectangle.getBottomLeft());
+    Rectangle result(bottomLeft, bottomLeft);
+    result.insertPoint(transformPosition(rectangle.getBottomRight()));
+    result.insertPoint(transformPosition(rectangle.getTopRight()));
+    result.insertPoint(transformPosition(rectangle.getTopLeft()));
+    return result;
+}
+
+Rectangle AgpuCanvas::getClipBounds() const
+{
+    return Rectangle(glm::vec2(currentScissor.x, currentScissor.y),
+        glm::vec2(currentScissor.x + currentScissor.width, currentScissor.y + currentScissor.height));
+}
+
+bool AgpuCanvas::isVisible(const Rectangle &rectangle) const
+{
+    if (!culling || recordingDisplayList)
+        return true;
+
+    // Leave a pixel for the antialiasing and the line rasterization.
+    auto bounds = transformRectangleBounds(rectangle);
+    bounds.min -= 1.0f;
+    bounds.max += 1.0f;
+    return getClipBounds().intersectsOrContains(bounds);
 }
 
 void AgpuCanvas::closePath()
 {
-    currentPathProcessor->closePath();
+    if (recordingFillPath)
+        recordPathCommand(AgpuPathCommand::Close);
+    else
+        currentPathProcessor->closePath();
 }
 
 void AgpuCanvas::moveTo(const glm::vec2 &point)
 {
-    currentPathProcessor->moveTo(point);
+    if (recordingFillPath)
+        recordPathCommand(AgpuPathCommand::MoveTo, point);
+    else
+        currentPathProcessor->moveTo(point);
 }
 
 void AgpuCanvas::lineTo(const glm::vec2 &point)
 {
-    currentPathProcessor->lineTo(point);
+    if (recordingFillPath)
+        recordPathCommand(AgpuPathCommand::LineTo, point);
+    else
+        currentPathProcessor->lineTo(point);
+}
+
+void AgpuCanvas::quadTo(const glm::vec2 &control, const glm::vec2 &point)
+{
+    if (recordingFillPath)
+        recordPathCommand(AgpuPathCommand::QuadTo, control, point);
+    else
+        currentPathProcessor->quadTo(control, point);
 }
 
-void AgpuCanvas::quadTo(const glm::vec2 &control, const glm::vec2 &point)
-{
-    currentPathProcessor->quadTo(control, point);
+void AgpuCanvas::cubicTo(const glm::vec2 &control, const glm::vec2 &control2, const glm::vec2 &point)
+{
+    if (recordingFillPath)
+        recordPathCommand(AgpuPathCommand::CubicTo, control, control2, point);
+    else
+        currentPathProcessor->cubicTo(control, control2, point);
+}
+
+// Stroke paths
+const StrokeStyle &AgpuCanvas::getStrokeStyle() const
+{
+    return strokeStyle;
+}
+
+void AgpuCanvas::setStrokeStyle(const StrokeStyle &style)
+{
+    strokeStyle = style;
+}
+
+void AgpuCanvas::addStrokeRing(const glm::vec2 *outerPoints, const glm::vec2 *innerPoints, size_t count)
+{
+    addStrokeStrip(outerPoints, innerPoints, count, true);
+}
+
+void AgpuCanvas::addStrokeStrip(const glm::vec2 *leftPoints, const glm::vec2 *rightPoints, size_t count, bool closed)
+{
+    if (count < 2)
+        return;
+
+    beginConvexTriangles();
+    for (size_t i = 0; i < count; ++i)
+    {
+        addVertexPosition(leftPoints[i]);
+        addVertexPosition(rightPoints[i]);
+    }
+
+    auto quadCount = closed ? count : count - 1;
+    for (size_t i = 0; i < quadCount; ++i)
+    {
+        auto left = int(i*2);
+        auto nextLeft = int(((i + 1) % count)*2);
+        addIndex(left);
+        addIndex(nextLeft);
+        addIndex(nextLeft + 1);
+        addIndex(nextLeft + 1);
+        addIndex(left + 1);
+        addIndex(left);
+    }
 }
 
-void AgpuCanvas::cubicTo(const glm::vec2 &control, const glm::vec2 &control2, const glm::vec2 &point)
+void AgpuCanvas::addStrokeFan(const glm::vec2 &center, float radius, float startAngle, float sweepAngle)
 {
-    currentPathProcessor->cubicTo(control, control2, point);
+    auto segmentCount = computeArcSegmentCount(radius, sweepAngle);
+    beginConvexTriangles();
+    addVertexPosition(center);
+    for (int i = 0; i <= segmentCount; ++i)
+    {
+        auto angle = startAngle + sweepAngle*i / segmentCount;
+        addVertexPosition(center + glm::vec2(cos(angle), sin(angle))*radius);
+        if (i > 0)
+        {
+            addIndex(0);
+            addIndex(i);
+            addIndex(i + 1);
+        }
+    }
 }
 
-// Stroke paths
 void AgpuCanvas::beginStrokePath()
 {
-    currentPathProcessor = strokePathProcessor.get();
+    // The hairlines are drawn with line primitives.
+    if (strokeStyle.isHairline())
+        currentPathProcessor = noWithStrokePathProcessor.get();
+    else
+        currentPathProcessor = strokePathProcessor.get();
     currentPathProcessor->begin();
 }
 
@@ -655,6 +2161,13 @@ void AgpuCanvas::beginConvexTriangles()
 
 void AgpuCanvas::beginShapeWithPipeline(ShapeType newShapeType, agpu_pipeline_state *pipeline, agpu_shader_resource_binding *textureBinding, agpu_shader_resource_binding *fontBinding)
 {
+    // Inside of a stencil clip, the clipped variant of the pipeline is used.
+    // The captured shapes keep the pipeline, since they can be drawn at
+    // another clip depth.
+    auto capturedPipeline = pipeline;
+    if (clipStencilDepth > 0)
+        pipeline = getClippedPipeline(pipeline);
+
     if ((shapeType != newShapeType && shapeType != ST_Unknown) ||
         (pipeline != currentPipeline && currentPipeline != nullptr) ||
         (currentTextureBinding != textureBinding && textureBinding != nullptr) ||
@@ -663,53 +2176,166 @@ void AgpuCanvas::beginShapeWithPipeline(ShapeType newShapeType, agpu_pipeline_st
 
     if (currentPipeline != pipeline)
     {
-        drawCommandsToAdd.push_back([=] (agpu_command_list_ref &commandList) {
-            commandList->usePipelineState(pipeline);
-        });
+        addUsePipelineStateCommand(pipeline);
         currentPipeline = pipeline;
     }
 
     if (currentTextureBinding != textureBinding && textureBinding != nullptr)
     {
-        drawCommandsToAdd.push_back([=] (agpu_command_list_ref &commandList) {
-            commandList->useShaderResources(textureBinding);
-        });
+        addUseShaderResourcesCommand(textureBinding);
         currentTextureBinding = textureBinding;
     }
 
     if (currentFontBinding != fontBinding && fontBinding != nullptr)
     {
-        drawCommandsToAdd.push_back([=] (agpu_command_list_ref &commandList) {
-            commandList->useShaderResources(fontBinding);
-        });
+        addUseShaderResourcesCommand(fontBinding);
         currentFontBinding = fontBinding;
     }
 
     shapeType = newShapeType;
-    baseVertex = (agpu_uint)vertices.size();
+    withNewBaseVertex();
+
+    if (capturedShape)
+    {
+        AgpuTessellatedShape::Part part;
+        part.shapeType = newShapeType;
+        part.pipeline = capturedPipeline;
+        part.firstVertex = capturedShape->vertices.size();
+        part.firstIndex = capturedShape->indices.size();
+        capturedShape->parts.push_back(part);
+    }
 }
 
 void AgpuCanvas::endSubmesh()
 {
+    if (shapeType == ST_GlyphInstance)
+    {
+        endGlyphInstances();
+        return;
+    }
+
+    if (shapeType == ST_ShapeInstance)
+    {
+        endShapeInstances();
+        return;
+    }
+
 	int start = startIndex;
 	int count = (int)indices.size() - startIndex;
 	if(!count)
 		return;
 
-	drawCommandsToAdd.push_back([=] (agpu_command_list_ref &commandList) {
-		commandList->drawElements(count, 1, start, 0, 0);
-	});
+	addDrawElementsCommand(AgpuCanvasCommand::DrawElements, count, 1, start, int32_t(submeshBaseVertex), 0);
 	startIndex = (int)indices.size();
+
+    maxSubmeshVertexCount = std::max(maxSubmeshVertexCount, vertices.size() - submeshBaseVertex);
+    submeshBaseVertex = vertices.size();
+}
+
+void AgpuCanvas::endGlyphInstances()
+{
+    auto first = (agpu_uint)startGlyphInstance;
+    auto count = (agpu_uint)(glyphInstances.size() - startGlyphInstance);
+    if (!count)
+        return;
+
+    addDrawElementsCommand(AgpuCanvasCommand::DrawGlyphInstances, 6, count, 0, 0, first);
+    startGlyphInstance = glyphInstances.size();
+}
+
+void AgpuCanvas::endShapeInstances()
+{
+    auto first = (agpu_uint)startShapeInstance;
+    auto count = (agpu_uint)(shapeInstances.size() - startShapeInstance);
+    if (!count)
+        return;
+
+    addDrawElementsCommand(AgpuCanvasCommand::DrawShapeInstances, 6, count, 0, 0, first);
+    startShapeInstance = shapeInstances.size();
+}
+
+void AgpuCanvas::addUsePipelineStateCommand(agpu_pipeline_state *pipeline)
+{
+    addCommand(AgpuCanvasCommand::UsePipelineState);
+    drawCommands.back().pipeline = pipeline;
+}
+
+void AgpuCanvas::addUseShaderResourcesCommand(agpu_shader_resource_binding *binding)
+{
+    addCommand(AgpuCanvasCommand::UseShaderResources);
+    drawCommands.back().binding = binding;
+}
+
+void AgpuCanvas::addDrawElementsCommand(AgpuCanvasCommand::Type type, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t baseVertex, uint32_t firstInstance)
+{
+    addCommand(type);
+    auto &draw = drawCommands.back().draw;
+    draw.indexCount = indexCount;
+    draw.instanceCount = instanceCount;
+    draw.firstIndex = firstIndex;
+    draw.baseVertex = baseVertex;
+    draw.firstInstance = firstInstance;
+}
+
+void AgpuCanvas::addSetStencilReferenceCommand(uint32_t reference)
+{
+    addCommand(AgpuCanvasCommand::SetStencilReference);
+    drawCommands.back().stencilReference = reference;
+}
+
+void AgpuCanvas::addSetScissorCommand(const AgpuCanvasCommand::ScissorRectangle &scissor)
+{
+    addCommand(AgpuCanvasCommand::SetScissor);
+    drawCommands.back().scissor = scissor;
 }
 
 void AgpuCanvas::addVertex(const AgpuCanvasVertex &vertex)
 {
 	vertices.push_back(vertex);
+	if (capturedShape)
+	{
+		capturedShape->vertices.push_back(vertex);
+		capturedShape->vertices.back().position -= capturedOrigin;
+	}
 }
 
 void AgpuCanvas::addIndex(int index)
 {
-	indices.push_back(index + baseVertex);
+	indices.push_back(uint32_t(index + baseVertex - submeshBaseVertex));
+	if (capturedShape)
+		capturedShape->indices.push_back(uint32_t(index));
+}
+
+AgpuCanvasVertex *AgpuCanvas::addQuads(size_t quadCount)
+{
+    withNewBaseVertex();
+
+    auto firstVertex = vertices.size();
+    vertices.resize(firstVertex + quadCount*4);
+
+    auto firstIndex = indices.size();
+    indices.resize(firstIndex + quadCount*6);
+    auto destIndex = &indices[firstIndex];
+    auto quadBase = uint32_t(baseVertex - submeshBaseVertex);
+    for (size_t i = 0; i < quadCount; ++i, quadBase += 4, destIndex += 6)
+    {
+        destIndex[0] = quadBase;
+        destIndex[1] = quadBase + 1;
+        destIndex[2] = quadBase + 2;
+        destIndex[3] = quadBase + 2;
+        destIndex[4] = quadBase + 3;
+        destIndex[5] = quadBase;
+    }
+
+    return &vertices[firstVertex];
+}
+
+void AgpuCanvas::addQuadVertices(AgpuCanvasVertex *destVertices, const Rectangle &destRectangle, const Rectangle &sourceRectangle, const glm::vec4 &color)
+{
+    destVertices[0] = Vertex(transformPosition(destRectangle.getBottomLeft()), sourceRectangle.getBottomLeft(), color);
+    destVertices[1] = Vertex(transformPosition(destRectangle.getBottomRight()), sourceRectangle.getBottomRight(), color);
+    destVertices[2] = Vertex(transformPosition(destRectangle.getTopRight()), sourceRectangle.getTopRight(), color);
+    destVertices[3] = Vertex(transformPosition(destRectangle.getTopLeft()), sourceRectangle.getTopLeft(), color);
 }
 
 void AgpuCanvas::addVertexPosition(const glm::vec2 &position)
@@ -717,6 +2343,325 @@ void AgpuCanvas::addVertexPosition(const glm::vec2 &position)
     addVertex(Vertex(transformPosition(position), currentColor));
 }
 
+void AgpuCanvas::forgetDrawingState()
+{
+    // The next shape emits its whole state again.
+    shapeType = ST_Unknown;
+    currentPipeline = nullptr;
+    currentTextureBinding = nullptr;
+    currentFontBinding = nullptr;
+    textEffectPushed = false;
+}
+
+bool AgpuCanvas::beginDisplayListRecording()
+{
+    if (recordingDisplayList)
+        return false;
+
+    // The list starts in a new submesh, and it emits its own state.
+    endSubmesh();
+    forgetDrawingState();
+
+    recordingDisplayList = true;
+    recordingTransform = transform;
+    recordingVertexStart = vertices.size();
+    recordingIndexStart = indices.size();
+    recordingGlyphInstanceStart = glyphInstances.size();
+    recordingShapeInstanceStart = shapeInstances.size();
+    recordingCommandStart = drawCommands.size();
+    recordingTextEffectConstantsStart = textEffectConstants.size();
+    recordingOuterMaxSubmeshVertexCount = maxSubmeshVertexCount;
+    recordingScissor = currentScissor;
+    recordingClipStencilDepth = clipStencilDepth;
+    maxSubmeshVertexCount = 0;
+    return true;
+}
+
+CanvasDisplayListPtr AgpuCanvas::endDisplayListRecording()
+{
+    if (!recordingDisplayList)
+        return nullptr;
+
+    endSubmesh();
+    forgetDrawingState();
+    recordingDisplayList = false;
+
+    auto list = std::make_shared<AgpuCanvasDisplayList> ();
+    list->transform = recordingTransform;
+    list->maxSubmeshVertexCount = maxSubmeshVertexCount;
+    list->changesClipState = false;
+    list->scissor = recordingScissor;
+    list->clipStencilDepth = recordingClipStencilDepth;
+    maxSubmeshVertexCount = std::max(maxSubmeshVertexCount, recordingOuterMaxSubmeshVertexCount);
+
+    list->vertices.assign(vertices.begin() + recordingVertexStart, vertices.end());
+    list->indices.assign(indices.begin() + recordingIndexStart, indices.end());
+    list->glyphInstances.assign(glyphInstances.begin() + recordingGlyphInstanceStart, glyphInstances.end());
+    list->shapeInstances.assign(shapeInstances.begin() + recordingShapeInstanceStart, shapeInstances.end());
+    list->textEffectConstants.assign(textEffectConstants.begin() + recordingTextEffectConstantsStart, textEffectConstants.end());
+    list->commands.assign(drawCommands.begin() + recordingCommandStart, drawCommands.end());
+
+    // Make the offsets relative to the list.
+    for (auto &command : list->commands)
+    {
+        switch (command.type)
+        {
+        case AgpuCanvasCommand::DrawElements:
+            command.draw.firstIndex -= uint32_t(recordingIndexStart);
+            command.draw.baseVertex -= int32_t(recordingVertexStart);
+            break;
+        case AgpuCanvasCommand::DrawGlyphInstances:
+            command.draw.firstInstance -= uint32_t(recordingGlyphInstanceStart);
+            break;
+        case AgpuCanvasCommand::DrawShapeInstances:
+            command.draw.firstInstance -= uint32_t(recordingShapeInstanceStart);
+            break;
+        case AgpuCanvasCommand::PushTextEffectConstants:
+            command.textEffectConstantsIndex -= uint32_t(recordingTextEffectConstantsStart);
+            break;
+        case AgpuCanvasCommand::UseShaderResources:
+            if (std::find(list->shaderResources.begin(), list->shaderResources.end(), command.binding) == list->shaderResources.end())
+                list->shaderResources.push_back(command.binding);
+            break;
+        case AgpuCanvasCommand::SetStencilReference:
+        case AgpuCanvasCommand::SetScissor:
+            list->changesClipState = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return list;
+}
+
+bool AgpuCanvas::drawDisplayList(const CanvasDisplayListPtr &displayList)
+{
+    auto list = dynamic_cast<AgpuCanvasDisplayList*> (displayList.get());
+    if (!list || list->isExpired())
+        return false;
+
+    // The geometry is in device space, so it can only be translated.
+    auto &recordedTransform = list->transform;
+    if (transform[0][0] != recordedTransform[0][0] || transform[0][1] != recordedTransform[0][1] ||
+        transform[1][0] != recordedTransform[1][0] || transform[1][1] != recordedTransform[1][1])
+        return false;
+
+    // The draws use the pipelines of the clip depth where they were recorded.
+    if (list->clipStencilDepth != clipStencilDepth)
+        return false;
+
+    auto delta = glm::vec2(transform[2][0] - recordedTransform[2][0], transform[2][1] - recordedTransform[2][1]);
+    if (list->changesClipState)
+    {
+        auto scissor = list->scissor;
+        scissor.x += int32_t(delta.x);
+        scissor.y += int32_t(delta.y);
+        if (delta != glm::floor(delta) || scissor != currentScissor)
+            return false;
+    }
+
+    // The replay does not look up its glyphs, so keep their atlas pages.
+    stateManager->getEngine()->getFontManager()->markShaderResourcesUsed(list->shaderResources.data(), list->shaderResources.size());
+
+    appendDrawing(list->vertices, list->indices, list->glyphInstances, list->shapeInstances, list->commands, list->textEffectConstants, list->maxSubmeshVertexCount, delta);
+    return true;
+}
+
+void AgpuCanvas::appendDrawing(const std::vector<AgpuCanvasVertex> &sourceVertices, const std::vector<uint32_t> &sourceIndices,
+    const std::vector<AgpuCanvasGlyphInstance> &sourceGlyphInstances, const std::vector<AgpuCanvasShapeInstance> &sourceShapeInstances,
+    const std::vector<AgpuCanvasCommand> &sourceCommands,
+    const std::vector<AgpuCanvasTextEffectConstants> &sourceTextEffectConstants, size_t sourceMaxSubmeshVertexCount, const glm::vec2 &delta)
+{
+    endSubmesh();
+    forgetDrawingState();
+
+    auto vertexStart = vertices.size();
+    auto indexStart = indices.size();
+    auto glyphInstanceStart = glyphInstances.size();
+    auto shapeInstanceStart = shapeInstances.size();
+    auto textEffectConstantsStart = textEffectConstants.size();
+
+    vertices.insert(vertices.end(), sourceVertices.begin(), sourceVertices.end());
+    indices.insert(indices.end(), sourceIndices.begin(), sourceIndices.end());
+    glyphInstances.insert(glyphInstances.end(), sourceGlyphInstances.begin(), sourceGlyphInstances.end());
+    shapeInstances.insert(shapeInstances.end(), sourceShapeInstances.begin(), sourceShapeInstances.end());
+    textEffectConstants.insert(textEffectConstants.end(), sourceTextEffectConstants.begin(), sourceTextEffectConstants.end());
+    if (delta != glm::vec2())
+    {
+        for (auto i = vertexStart; i < vertices.size(); ++i)
+            vertices[i].position += delta;
+        auto rectangleDelta = glm::vec4(delta, delta);
+        for (auto i = glyphInstanceStart; i < glyphInstances.size(); ++i)
+            glyphInstances[i].destRectangle += rectangleDelta;
+        for (auto i = shapeInstanceStart; i < shapeInstances.size(); ++i)
+            shapeInstances[i].rectangle += rectangleDelta;
+    }
+
+    // Rebase the offsets of the commands.
+    auto commandStart = drawCommands.size();
+    drawCommands.insert(drawCommands.end(), sourceCommands.begin(), sourceCommands.end());
+    for (auto i = commandStart; i < drawCommands.size(); ++i)
+    {
+        auto &command = drawCommands[i];
+        switch (command.type)
+        {
+        case AgpuCanvasCommand::DrawElements:
+            command.draw.firstIndex += uint32_t(indexStart);
+            command.draw.baseVertex += int32_t(vertexStart);
+            break;
+        case AgpuCanvasCommand::DrawGlyphInstances:
+            command.draw.firstInstance += uint32_t(glyphInstanceStart);
+            break;
+        case AgpuCanvasCommand::DrawShapeInstances:
+            command.draw.firstInstance += uint32_t(shapeInstanceStart);
+            break;
+        case AgpuCanvasCommand::PushTextEffectConstants:
+            command.textEffectConstantsIndex += uint32_t(textEffectConstantsStart);
+            break;
+        case AgpuCanvasCommand::SetScissor:
+            command.scissor.x += int32_t(delta.x);
+            command.scissor.y += int32_t(delta.y);
+            break;
+        default:
+            break;
+        }
+    }
+
+    startIndex = (int)indices.size();
+    submeshBaseVertex = vertices.size();
+    baseVertex = (int)vertices.size();
+    startGlyphInstance = glyphInstances.size();
+    startShapeInstance = shapeInstances.size();
+    maxSubmeshVertexCount = std::max(maxSubmeshVertexCount, sourceMaxSubmeshVertexCount);
+}
+
+AgpuCanvasPtr AgpuCanvas::createSegmentCanvas()
+{
+    // A segment canvas only records, so it shares the device objects and
+    // it has neither a command allocator nor ring buffers.
+    auto segment = AgpuCanvasPtr(new AgpuCanvas());
+    segment->stateManager = stateManager;
+    segment->device = device;
+    segment->shaderSignature = shaderSignature;
+    segment->stencilNonZeroPipeline = stencilNonZeroPipeline;
+    segment->stencilEvenOddPipeline = stencilEvenOddPipeline;
+    segment->stencilNonZeroCurvePipeline = stencilNonZeroCurvePipeline;
+    segment->stencilEvenOddCurvePipeline = stencilEvenOddCurvePipeline;
+    segment->coverColorPipeline = coverColorPipeline;
+    segment->convexColorLinePipeline = convexColorLinePipeline;
+    segment->convexColorTrianglePipeline = convexColorTrianglePipeline;
+    segment->triangleStencilSetPipeline = triangleStencilSetPipeline;
+    segment->triangleStencilClearAndFillPipeline = triangleStencilClearAndFillPipeline;
+    segment->textColorPipeline = textColorPipeline;
+    segment->textSdfColorPipeline = textSdfColorPipeline;
+    segment->textInstancedColorPipeline = textInstancedColorPipeline;
+    segment->textSdfInstancedColorPipeline = textSdfInstancedColorPipeline;
+    segment->textSdfEffectsColorPipeline = textSdfEffectsColorPipeline;
+    segment->textSdfInstancedEffectsColorPipeline = textSdfInstancedEffectsColorPipeline;
+    segment->shapeInstancedColorPipeline = shapeInstancedColorPipeline;
+    segment->clippedPipelines = clippedPipelines;
+    segment->clipStencilNonZeroPipeline = clipStencilNonZeroPipeline;
+    segment->clipStencilEvenOddPipeline = clipStencilEvenOddPipeline;
+    segment->clipStencilNonZeroCurvePipeline = clipStencilNonZeroCurvePipeline;
+    segment->clipStencilEvenOddCurvePipeline = clipStencilEvenOddCurvePipeline;
+    segment->clipPushCoverPipeline = clipPushCoverPipeline;
+    segment->clipPopCoverPipeline = clipPopCoverPipeline;
+    segment->sampler = sampler;
+    segment->shapeCache = shapeCache;
+    segment->culling = culling;
+    return segment;
+}
+
+void AgpuCanvas::beginSegment(const AgpuCanvas &parent)
+{
+    resetRecordingState();
+    transform = parent.transform;
+    currentColor = parent.currentColor;
+    textEffect = parent.textEffect;
+    strokeStyle = parent.strokeStyle;
+    fontFace = parent.fontFace;
+    viewportScissor = parent.viewportScissor;
+    currentScissor = parent.currentScissor;
+    clipStencilDepth = parent.clipStencilDepth;
+}
+
+namespace
+{
+
+/**
+ * The progress of a parallel segment recording. It is shared with the
+ * worker tasks, since a task may start after the recording has finished.
+ */
+struct SegmentRecordingProgress
+{
+    SegmentRecordingProgress()
+        : nextSegment(0), recordedCount(0) {}
+
+    std::atomic<size_t> nextSegment;
+    std::mutex mutex;
+    std::condition_variable finishedCondition;
+    size_t recordedCount;
+};
+
+} // End of anonymous namespace
+
+void AgpuCanvas::drawSegments(const SegmentRecorder *segments, size_t count)
+{
+    auto &threadPool = stateManager->getEngine()->getThreadPool();
+    if (!parallelRecording || !threadPool || threadPool->getThreadCount() == 0 || count < 2)
+    {
+        Canvas::drawSegments(segments, count);
+        return;
+    }
+
+    while (segmentCanvases.size() < count)
+        segmentCanvases.push_back(createSegmentCanvas());
+    for (size_t i = 0; i < count; ++i)
+        segmentCanvases[i]->beginSegment(*this);
+
+    // The worker threads and this thread take the segments in order from a
+    // shared counter, so a slow segment does not hold the others back.
+    auto progress = std::make_shared<SegmentRecordingProgress> ();
+    auto recordSegments = [this, progress, segments, count] {
+        size_t recordedCount = 0;
+        for (auto i = progress->nextSegment++; i < count; i = progress->nextSegment++)
+        {
+            auto segment = segmentCanvases[i].get();
+            segments[i](segment);
+            segment->endSubmesh();
+            ++recordedCount;
+        }
+
+        if (recordedCount > 0)
+        {
+            std::unique_lock<std::mutex> l(progress->mutex);
+            progress->recordedCount += recordedCount;
+            if (progress->recordedCount == count)
+                progress->finishedCondition.notify_all();
+        }
+    };
+
+    auto helperCount = std::min(threadPool->getThreadCount(), count - 1);
+    for (size_t i = 0; i < helperCount; ++i)
+        threadPool->submit(recordSegments);
+    recordSegments();
+
+    {
+        std::unique_lock<std::mutex> l(progress->mutex);
+        while (progress->recordedCount < count)
+            progress->finishedCondition.wait(l);
+    }
+
+    // Merge the segments in paint order.
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto &segment = segmentCanvases[i];
+        appendDrawing(segment->vertices, segment->indices, segment->glyphInstances, segment->shapeInstances, segment->drawCommands,
+            segment->textEffectConstants, segment->maxSubmeshVertexCount, glm::vec2());
+    }
+}
+
 const glm::mat3 &AgpuCanvas::getTransform() const
 {
 	return transform;
@@ -727,6 +2672,16 @@ void AgpuCanvas::setTransform(const glm::mat3 &newTransform)
 	transform = newTransform;
 }
 
+float AgpuCanvas::getCurveTolerance() const
+{
+    // The paths are flattened before the transform, so scale the pixel
+    // tolerance down by the largest stretch of the transform.
+    auto scale2 = std::max(glm::length2(glm::vec2(transform[0])), glm::length2(glm::vec2(transform[1])));
+    if (scale2 <= FLT_MIN)
+        return CurveTolerance;
+    return CurveTolerance / sqrtf(scale2);
+}
+
 // Software tesselation path processor
 void AgpuSoftwareTessellationPathProcessor::begin()
 {
@@ -756,47 +2711,16 @@ void AgpuSoftwareTessellationPathProcessor::lineTo(const glm::vec2 &point)
 
 void AgpuSoftwareTessellationPathProcessor::quadTo(const glm::vec2 &control, const glm::vec2 &point)
 {
-    auto lineLength = glm::length(point - currentPosition);
-    auto arcLength = glm::length(control - currentPosition) + glm::length(point - control);
-
-    auto delta = arcLength - lineLength;
-    if (arcLength > CurveFlattnessFactor * lineLength && delta > CurvePixelThreshold)
-    {
-        auto m1 = midpoint(currentPosition, control);
-        auto m2 = midpoint(control, point);
-        auto m3 = midpoint(m1, m2);
-        quadTo(m1, m3);
-        quadTo(m2, point);
-    }
-    else
-    {
-        lineTo(point);
-    }
+    flattenQuadraticBezier(currentPosition, control, point, canvas->getCurveTolerance(), [&](const glm::vec2 &p) {
+        lineTo(p);
+    });
 }
 
 void AgpuSoftwareTessellationPathProcessor::cubicTo(const glm::vec2 &control, const glm::vec2 &control2, const glm::vec2 &point)
 {
-    auto lineLength = glm::length(point - currentPosition);
-    auto arcLength = glm::length(control - currentPosition) + glm::length(point - control);
-
-    auto delta = arcLength - lineLength;
-    if (arcLength > CurveFlattnessFactor * lineLength && delta > CurvePixelThreshold)
-    {
-        auto m1 = midpoint(currentPosition, control);
-        auto m2 = midpoint(control, control2);
-        auto m3 = midpoint(control2, point);
-
-        auto m4 = midpoint(m1, m2);
-        auto m5 = midpoint(m2, m3);
-        auto m6 = midpoint(m4, m5);
-
-        cubicTo(m1, m4, m6);
-        cubicTo(m2, m5, point);
-    }
-    else
-    {
-        lineTo(point);
-    }
+    flattenCubicBezier(currentPosition, control, control2, point, canvas->getCurveTolerance(), [&](const glm::vec2 &p) {
+        lineTo(p);
+    });
 }
 
 // Triangle fan based path processor
@@ -844,6 +2768,7 @@ void AgpuStencilPathProcessor::begin()
     BaseClass::begin();
     vertexCount = 0;
     totalVertexCount = 0;
+    curveVertices.clear();
 }
 
 void AgpuStencilPathProcessor::end()
@@ -851,9 +2776,24 @@ void AgpuStencilPathProcessor::end()
     BaseClass::end();
     if (!totalVertexCount)
         return;
+
+    addCurveTriangles();
     canvas->coverBox(boundingBox);
 }
 
+void AgpuStencilPathProcessor::addCurveTriangles()
+{
+    if (curveVertices.empty())
+        return;
+
+    canvas->beginShapeWithPipeline(AgpuCanvas::ST_Triangle, getCurvePipelineState());
+    for (size_t i = 0; i < curveVertices.size(); ++i)
+    {
+        canvas->addVertex(curveVertices[i]);
+        canvas->addIndex(int(i));
+    }
+}
+
 void AgpuStencilPathProcessor::moveTo(const glm::vec2 &point)
 {
     BaseClass::moveTo(point);
@@ -887,6 +2827,77 @@ void AgpuStencilPathProcessor::lineTo(const glm::vec2 &point)
     }
 }
 
+void AgpuStencilPathProcessor::quadTo(const glm::vec2 &control, const glm::vec2 &point)
+{
+    if (!getCurvePipelineState())
+    {
+        BaseClass::quadTo(control, point);
+        return;
+    }
+
+    addCurveTriangle(control, point);
+}
+
+void AgpuStencilPathProcessor::cubicTo(const glm::vec2 &control, const glm::vec2 &control2, const glm::vec2 &point)
+{
+    if (!getCurvePipelineState())
+    {
+        BaseClass::cubicTo(control, control2, point);
+        return;
+    }
+
+    auto start = currentPosition;
+    approximateCubicWithQuadratics(start, control, control2, point, canvas->getCurveTolerance(), [&](const glm::vec2 &c, const glm::vec2 &p) {
+        addCurveTriangle(c, p);
+    });
+}
+
+void AgpuStencilPathProcessor::addCurveTriangle(const glm::vec2 &control, const glm::vec2 &point)
+{
+    // The polygon takes the chord, and the curve triangle adds or removes
+    // the region between the chord and the curve. The fragment shader
+    // discards where u*u - v > 0, which is outside of the curve.
+    auto start = currentPosition;
+    lineTo(point);
+    boundingBox.insertPoint(control);
+
+    auto color = canvas->currentColor;
+    curveVertices.push_back(AgpuCanvasVertex(canvas->transformPosition(start), glm::vec2(0.0f, 0.0f), color));
+    curveVertices.push_back(AgpuCanvasVertex(canvas->transformPosition(control), glm::vec2(0.5f, 0.0f), color));
+    curveVertices.push_back(AgpuCanvasVertex(canvas->transformPosition(point), glm::vec2(1.0f, 1.0f), color));
+}
+
+// Clip path processor
+void AgpuClipPathProcessor::begin()
+{
+    BaseClass::begin();
+    usingStencil = canvas->canUseStencilClip();
+}
+
+void AgpuClipPathProcessor::end()
+{
+    // The path is not covered, the clip push moves its coverage instead.
+    AgpuSoftwareTessellationPathProcessor::end();
+    if (usingStencil)
+        addCurveTriangles();
+    canvas->pushClipPath(boundingBox, totalVertexCount != 0, usingStencil);
+}
+
+void AgpuClipPathProcessor::lineTo(const glm::vec2 &point)
+{
+    if (usingStencil)
+    {
+        BaseClass::lineTo(point);
+        return;
+    }
+
+    if (totalVertexCount == 0)
+        boundingBox.min = boundingBox.max = currentPosition;
+    currentPosition = point;
+    boundingBox.insertPoint(point);
+    ++totalVertexCount;
+}
+
 // No width stroke path processor
 void AgpuNoWidthStrokePathProcessor::begin()
 {
@@ -922,5 +2933,236 @@ void AgpuNoWidthStrokePathProcessor::lineTo(const glm::vec2 &point)
     canvas->addIndex(vertexCount - 2);
 }
 
+// Stroke path processor
+void AgpuStrokePathProcessor::begin()
+{
+    BaseClass::begin();
+    points.clear();
+    hasSegment = false;
+    halfWidth = canvas->strokeStyle.width*0.5f;
+}
+
+void AgpuStrokePathProcessor::end()
+{
+    finishContour(false);
+    BaseClass::end();
+}
+
+void AgpuStrokePathProcessor::closePath()
+{
+    lineTo(closePosition);
+    finishContour(true);
+
+    // A following segment starts a new contour at the same point.
+    currentPosition = closePosition;
+}
+
+void AgpuStrokePathProcessor::moveTo(const glm::vec2 &point)
+{
+    finishContour(false);
+    BaseClass::moveTo(point);
+}
+
+void AgpuStrokePathProcessor::lineTo(const glm::vec2 &point)
+{
+    if (points.empty())
+        points.push_back(currentPosition);
+
+    // Drop the repeated points, which have no direction.
+    hasSegment = true;
+    if (glm::distance2(points.back(), point) > 1e-12f)
+        points.push_back(point);
+    currentPosition = point;
+}
+
+void AgpuStrokePathProcessor::finishContour(bool closed)
+{
+    if (!hasSegment)
+    {
+        points.clear();
+        return;
+    }
+    hasSegment = false;
+
+    if (closed && points.size() > 2 && glm::distance2(points.front(), points.back()) <= 1e-12f)
+        points.pop_back();
+
+    // A contour without length is a dot with round or square caps.
+    auto &style = canvas->strokeStyle;
+    leftPoints.clear();
+    rightPoints.clear();
+    if (points.size() < 2)
+    {
+        if (!closed && style.cap == StrokeCap::Round)
+        {
+            canvas->addStrokeFan(points.front(), halfWidth, 0.0f, TwoPi);
+        }
+        else if (!closed && style.cap == StrokeCap::Square)
+        {
+            addEndRow(points.front(), glm::vec2(1.0f, 0.0f), -1.0f);
+            addEndRow(points.front(), glm::vec2(1.0f, 0.0f), 1.0f);
+            canvas->addStrokeStrip(leftPoints.data(), rightPoints.data(), leftPoints.size(), false);
+        }
+        points.clear();
+        return;
+    }
+
+    closed = closed && points.size() > 2;
+    auto pointCount = points.size();
+    if (closed)
+    {
+        for (size_t i = 0; i < pointCount; ++i)
+            addJoin(points[(i + pointCount - 1) % pointCount], points[i], points[(i + 1) % pointCount]);
+        canvas->addStrokeRing(leftPoints.data(), rightPoints.data(), leftPoints.size());
+        points.clear();
+        return;
+    }
+
+    auto startDirection = glm::normalize(points[1] - points[0]);
+    auto endDirection = glm::normalize(points[pointCount - 1] - points[pointCount - 2]);
+    addEndRow(points.front(), startDirection, -1.0f);
+    for (size_t i = 1; i + 1 < pointCount; ++i)
+        addJoin(points[i - 1], points[i], points[i + 1]);
+    addEndRow(points.back(), endDirection, 1.0f);
+    canvas->addStrokeStrip(leftPoints.data(), rightPoints.data(), leftPoints.size(), false);
+
+    addCap(points.front(), -startDirection);
+    addCap(points.back(), endDirection);
+    points.clear();
+}
+
+void AgpuStrokePathProcessor::addEndRow(const glm::vec2 &point, const glm::vec2 &direction, float capSign)
+{
+    // The square caps extend the strip by half of the width.
+    auto center = point;
+    if (canvas->strokeStyle.cap == StrokeCap::Square)
+        center += direction*(halfWidth*capSign);
+
+    auto normal = glm::vec2(-direction.y, direction.x)*halfWidth;
+    leftPoints.push_back(center + normal);
+    rightPoints.push_back(center - normal);
+}
+
+void AgpuStrokePathProcessor::addJoin(const glm::vec2 &previous, const glm::vec2 &point, const glm::vec2 &next)
+{
+    auto incomingLength = glm::length(point - previous);
+    auto outgoingLength = glm::length(next - point);
+    auto direction = (point - previous) / incomingLength;
+    auto nextDirection = (next - point) / outgoingLength;
+    auto normal = glm::vec2(-direction.y, direction.x);
+    auto nextNormal = glm::vec2(-nextDirection.y, nextDirection.x);
+
+    // A straight join only needs a row.
+    auto cross = direction.x*nextDirection.y - direction.y*nextDirection.x;
+    if (fabs(cross) < 1e-6f && glm::dot(direction, nextDirection) > 0.0f)
+    {
+        leftPoints.push_back(point + normal*halfWidth);
+        rightPoints.push_back(point - normal*halfWidth);
+        return;
+    }
+
+    auto outerSign = cross > 0.0f ? -1.0f : 1.0f;
+    auto outerNormal = normal*outerSign;
+    auto nextOuterNormal = nextNormal*outerSign;
+    auto outer = point + outerNormal*halfWidth;
+    auto nextOuter = point + nextOuterNormal*halfWidth;
+
+    // The inner offset lines meet along the bisector of the normals, at the
+    // inverse of the cosine of the half angle. The intersection is kept
+    // within the shorter segment, so sharp turns do not fold the strip.
+    auto bisector = outerNormal + nextOuterNormal;
+    auto bisectorLength = glm::length(bisector);
+    auto inner = point;
+    auto miterRatio = 0.0f;
+    if (bisectorLength > 1e-6f)
+    {
+        bisector /= bisectorLength;
+        auto cosine = std::max(glm::dot(bisector, outerNormal), 1e-6f);
+        auto sine = std::max(sqrt(1.0f - cosine*cosine), 1e-6f);
+        miterRatio = 1.0f / cosine;
+        auto innerDistance = std::min(halfWidth*miterRatio, std::min(incomingLength, outgoingLength) / sine);
+        inner = point - bisector*innerDistance;
+    }
+
+    // The rows of both segments share the inner point. The strip quad
+    // between them is the bevel of the join.
+    if (outerSign > 0.0f)
+    {
+        leftPoints.push_back(outer);
+        leftPoints.push_back(nextOuter);
+        rightPoints.push_back(inner);
+        rightPoints.push_back(inner);
+    }
+    else
+    {
+        leftPoints.push_back(inner);
+        leftPoints.push_back(inner);
+        rightPoints.push_back(outer);
+        rightPoints.push_back(nextOuter);
+    }
+
+    auto &style = canvas->strokeStyle;
+    if (style.join == StrokeJoin::Round)
+    {
+        auto startAngle = atan2(outerNormal.y, outerNormal.x);
+        auto sweepAngle = atan2(nextOuterNormal.y, nextOuterNormal.x) - startAngle;
+        if (sweepAngle > Pi)
+            sweepAngle -= TwoPi;
+        else if (sweepAngle < -Pi)
+            sweepAngle += TwoPi;
+        addRoundJoinWedge(point, startAngle, sweepAngle);
+        return;
+    }
+
+    // The miter tip is added beyond the bevel.
+    if (style.join != StrokeJoin::Miter || bisectorLength <= 1e-6f || miterRatio > style.miterLimit)
+        return;
+
+    canvas->beginConvexTriangles();
+    canvas->addVertexPosition(outer);
+    canvas->addVertexPosition(point + bisector*(halfWidth*miterRatio));
+    canvas->addVertexPosition(nextOuter);
+    canvas->addIndex(0);
+    canvas->addIndex(1);
+    canvas->addIndex(2);
+}
+
+void AgpuStrokePathProcessor::addRoundJoinWedge(const glm::vec2 &point, float startAngle, float sweepAngle)
+{
+    // Fan from the start of the arc, which covers the arc beyond the bevel.
+    auto segmentCount = computeArcSegmentCount(halfWidth, sweepAngle);
+    if (segmentCount < 2)
+        return;
+
+    canvas->beginConvexTriangles();
+    for (int i = 0; i <= segmentCount; ++i)
+    {
+        auto angle = startAngle + sweepAngle*i / segmentCount;
+        canvas->addVertexPosition(point + glm::vec2(cos(angle), sin(angle))*halfWidth);
+        if (i >= 2)
+        {
+            canvas->addIndex(0);
+            canvas->addIndex(i - 1);
+            canvas->addIndex(i);
+        }
+    }
+}
+
+void AgpuStrokePathProcessor::addCap(const glm::vec2 &point, const glm::vec2 &direction)
+{
+    auto normal = glm::vec2(-direction.y, direction.x)*halfWidth;
+    switch (canvas->strokeStyle.cap)
+    {
+    case StrokeCap::Round:
+        canvas->addStrokeFan(point, halfWidth, atan2(normal.y, normal.x), -Pi);
+        break;
+    case StrokeCap::Square:
+    case StrokeCap::Butt:
+    default:
+        // The square caps are part of the strip.
+        break;
+    }
+}
+
 } // End of namespace GUI
 } // End of namespace Loden
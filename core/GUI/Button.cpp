@@ -1,5 +1,6 @@
 #include "Loden/GUI/Button.hpp"
 #include "Loden/Color.hpp"
+#include "Loden/GUI/TextLayout.hpp"
 
 namespace Loden
 {
@@ -10,6 +11,7 @@ Button::Button(const SystemWindowPtr &systemWindow)
     : BaseType(systemWindow)
 {
 	isButtonDown_ = false;
+    setRetainingDrawing(true);
 }
 
 Button::~Button()
@@ -33,6 +35,15 @@ const std::string &Button::getLabel() const
 void Button::setLabel(const std::string &newLabel)
 {
 	label = newLabel;
+	labelLayout.reset();
+    invalidateDrawing();
+}
+
+const TextLayoutPtr &Button::getLabelLayout()
+{
+	if (!labelLayout)
+		labelLayout = layoutUtf8Text(label, 12);
+	return labelLayout;
 }
 
 bool Button::isButtonDown() const
@@ -44,6 +55,7 @@ void Button::handleMouseButtonDown(MouseButtonEvent &event)
 {
 	Widget::handleMouseButtonDown(event);
 	isButtonDown_ = true;
+    invalidateDrawing();
 	captureMouse();
 }
 
@@ -51,6 +63,7 @@ void Button::handleMouseButtonUp(MouseButtonEvent &event)
 {
 	Widget::handleMouseButtonUp(event);
 	isButtonDown_ = false;
+    invalidateDrawing();
 	releaseMouse(); 
 
     // Fire the action event only if the mouse is above me.
@@ -85,7 +98,7 @@ void Button::drawContentOn(Canvas *canvas)
 	canvas->drawRoundedRectangle(getLocalRectangle(), 5);
 
     canvas->setColor(Colors::white());
-    canvas->drawText(label, 12, glm::vec2(5, getHeight() - 5));
+    canvas->drawTextLayout(getLabelLayout(), glm::vec2(5, getHeight() - 5));
 }
 
 } // End of namespace GUI
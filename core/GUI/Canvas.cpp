@@ -1,9 +1,111 @@
-#include "Loden/GUI/Window.hpp"
+#include "Loden/GUI/Canvas.hpp"
+#include <atomic>
 
 namespace Loden
 {
 namespace GUI
 {
-	
+
+static std::atomic<uint32_t> globalDisplayListEpoch(0);
+
+CanvasDisplayList::CanvasDisplayList()
+    : epoch(getGlobalEpoch())
+{
+}
+
+CanvasDisplayList::~CanvasDisplayList()
+{
+}
+
+uint32_t CanvasDisplayList::getGlobalEpoch()
+{
+    return globalDisplayListEpoch.load(std::memory_order_relaxed);
+}
+
+void CanvasDisplayList::invalidateAll()
+{
+    globalDisplayListEpoch.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Canvas::beginDisplayListRecording()
+{
+    return false;
+}
+
+CanvasDisplayListPtr Canvas::endDisplayListRecording()
+{
+    return nullptr;
+}
+
+bool Canvas::drawDisplayList(const CanvasDisplayListPtr &displayList)
+{
+    return false;
+}
+
+static void addEllipsePath(Canvas *canvas, const Rectangle &rectangle)
+{
+    // Each quarter is a cubic, whose control points are at kappa times the
+    // radius from its ends.
+    const float Kappa = 0.5522847498f;
+    auto center = (rectangle.min + rectangle.max)*0.5f;
+    auto radius = rectangle.getSize()*0.5f;
+    auto dx = glm::vec2(radius.x, 0);
+    auto dy = glm::vec2(0, radius.y);
+
+    canvas->moveTo(center + dx);
+    canvas->cubicTo(center + dx + dy*Kappa, center + dy + dx*Kappa, center + dy);
+    canvas->cubicTo(center + dy - dx*Kappa, center - dx + dy*Kappa, center - dx);
+    canvas->cubicTo(center - dx - dy*Kappa, center - dy - dx*Kappa, center - dy);
+    canvas->cubicTo(center - dy + dx*Kappa, center + dx - dy*Kappa, center + dx);
+    canvas->closePath();
+}
+
+void Canvas::drawEllipse(const Rectangle &rectangle)
+{
+    beginStrokePath();
+    addEllipsePath(this, rectangle);
+    endStrokePath();
+}
+
+void Canvas::drawFillEllipse(const Rectangle &rectangle)
+{
+    beginFillPath(PathFillRule::Convex);
+    addEllipsePath(this, rectangle);
+    endFillPath();
+}
+
+void Canvas::pushClipRectangle(const Rectangle &rectangle)
+{
+    beginClipPath();
+    moveTo(rectangle.getBottomLeft());
+    lineTo(rectangle.getBottomRight());
+    lineTo(rectangle.getTopRight());
+    lineTo(rectangle.getTopLeft());
+    closePath();
+    endClipPath();
+}
+
+bool Canvas::isVisible(const Rectangle &rectangle) const
+{
+    return true;
+}
+
+void Canvas::drawSegments(const SegmentRecorder *segments, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        segments[i](this);
+}
+
+void Canvas::drawGlyphRun(void *binding, bool distanceField, const CanvasGlyph *glyphs, size_t count)
+{
+    beginBitmapTextDrawing(binding, distanceField);
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto sourceRectangle = glyphs[i].sourceRectangle;
+        drawBitmapCharacter(glyphs[i].destRectangle, sourceRectangle);
+    }
+    endBitmapTextDrawing();
+}
+
 } // End of namespace GUI
 } // End of namespace Loden
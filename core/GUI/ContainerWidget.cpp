@@ -59,7 +59,7 @@ void ContainerWidget::drawOn(Canvas *canvas)
 {
 	canvas->withTranslation(getPosition(), [&] {
 		// Draw the content
-		drawContentOn(canvas);
+		drawRetainedContentOn(canvas);
 		
 		// Draw the children
 		drawChildrenOn(canvas);
@@ -69,7 +69,11 @@ void ContainerWidget::drawOn(Canvas *canvas)
 void ContainerWidget::drawChildrenOn(Canvas *canvas)
 {
 	for(auto &child : children)
-		child->drawOn(canvas);
+	{
+		// Skip the children outside of the clip.
+		if(canvas->isVisible(child->getRectangle()))
+			child->drawOn(canvas);
+	}
 }
 
 void ContainerWidget::handleMouseButtonDown(MouseButtonEvent &event)
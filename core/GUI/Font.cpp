@@ -1,4 +1,6 @@
 #include "Loden/GUI/Font.hpp"
+#include "Loden/Unicode.hpp"
+#include <vector>
 
 namespace Loden
 {
@@ -6,6 +8,7 @@ namespace GUI
 {
 
 Font::Font()
+    : defaultFace(nullptr), boldFace(nullptr), boldItalicFace(nullptr), italicFace(nullptr)
 {
 }
 
@@ -16,56 +19,248 @@ Font::~Font()
 
 void Font::release()
 {
-    for (auto &face : faces)
-        face.second->release();
+    std::unique_lock<std::mutex> l(mutex);
+    for (auto &entry : faces)
+    {
+        auto &face = entry.second.face;
+        if (!face)
+            continue;
 
+        face->setFallbackChain(std::vector<FontFace*> ());
+        face->release();
+    }
+
+    defaultFace = boldFace = boldItalicFace = italicFace = nullptr;
     faces.clear();
+    fallbackFaces.clear();
 }
 
 void Font::addFace(const std::string &name, const FontFacePtr &face)
 {
-    faces.insert(std::make_pair(name, face));
+    std::unique_lock<std::mutex> l(mutex);
+    auto &entry = faces[name];
+    entry.face = face;
+    if (face)
+        updateFallbackChain(face);
+}
+
+void Font::addLazyFace(const std::string &name, const FaceLoader &loader)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    faces[name].loader = loader;
 }
 
-const Font::Faces &Font::getFaces() const
+std::vector<std::string> Font::getFaceNames() const
 {
-    return faces;
+    std::unique_lock<std::mutex> l(mutex);
+    std::vector<std::string> result;
+    result.reserve(faces.size());
+    for (auto &entry : faces)
+        result.push_back(entry.first);
+    return result;
 }
 
 FontFacePtr Font::getFace(const std::string &name)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    return getEntryFace(findEntry(name));
+}
+
+bool Font::isFaceLoaded(const std::string &name) const
+{
+    std::unique_lock<std::mutex> l(mutex);
+    auto it = faces.find(name);
+    return it != faces.end() && it->second.face;
+}
+
+void Font::preloadFaces()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    for (auto &entry : faces)
+        getEntryFace(&entry.second);
+}
+
+void Font::addFallbackFace(const FontFacePtr &face)
+{
+    if (!face)
+        return;
+
+    std::unique_lock<std::mutex> l(mutex);
+    fallbackFaces.push_back(face);
+    for (auto &entry : faces)
+    {
+        if (entry.second.face)
+            updateFallbackChain(entry.second.face);
+    }
+}
+
+Font::FallbackFaces Font::getFallbackFaces() const
+{
+    std::unique_lock<std::mutex> l(mutex);
+    return fallbackFaces;
+}
+
+FontFacePtr Font::getEntryFace(FaceEntry *entry)
+{
+    if (!entry)
+        return nullptr;
+
+    // Load lazy faces on first use. The mutex is held while loading, so
+    // concurrent requests for the same face wait for this load.
+    if (!entry->face && !entry->loadFailed && entry->loader)
+    {
+        entry->face = entry->loader();
+        entry->loadFailed = !entry->face;
+        if (entry->face)
+            updateFallbackChain(entry->face);
+    }
+
+    return entry->face;
+}
+
+Font::FaceEntry *Font::findEntry(const std::string &name)
 {
     auto it = faces.find(name);
     if (it != faces.end())
-        return it->second;
+        return &it->second;
     return nullptr;
 }
 
+void Font::updateFallbackChain(const FontFacePtr &face)
+{
+    std::vector<FontFace*> chain;
+    chain.reserve(fallbackFaces.size());
+    for (auto &fallbackFace : fallbackFaces)
+    {
+        if (fallbackFace != face)
+            chain.push_back(fallbackFace.get());
+    }
+
+    face->setFallbackChain(chain);
+}
+
 void Font::loadSpecialFaces()
 {
-    defaultFace = getFace("default");
-    boldFace = getFace("bold");
-    boldItalicFace = getFace("bold-italic");
-    italicFace = getFace("italic");
+    std::unique_lock<std::mutex> l(mutex);
+    defaultFace = findEntry("default");
+    boldFace = findEntry("bold");
+    boldItalicFace = findEntry("bold-italic");
+    italicFace = findEntry("italic");
 }
 
-const FontFacePtr &Font::getDefaultFace() const
+FontFacePtr Font::getDefaultFace()
 {
-    return defaultFace;
+    std::unique_lock<std::mutex> l(mutex);
+    return getEntryFace(defaultFace);
 }
 
-const FontFacePtr &Font::getBoldFace() const
+FontFacePtr Font::getBoldFace()
 {
-    return boldFace;
+    std::unique_lock<std::mutex> l(mutex);
+    return getEntryFace(boldFace);
 }
 
-const FontFacePtr &Font::getBoldItalicFace() const
+FontFacePtr Font::getBoldItalicFace()
 {
-    return boldItalicFace;
+    std::unique_lock<std::mutex> l(mutex);
+    return getEntryFace(boldItalicFace);
 }
 
-const FontFacePtr &Font::getItalicFace() const
+FontFacePtr Font::getItalicFace()
 {
-    return italicFace;
+    std::unique_lock<std::mutex> l(mutex);
+    return getEntryFace(italicFace);
+}
+
+// Font face
+glm::vec2 FontFace::drawCharacter(Canvas *canvas, int character, int pointSize, const glm::vec2 &position)
+{
+    TextLayout layout;
+    uint32_t codePoint = character;
+    layoutCodePointsWithFallback(layout, &codePoint, 1, pointSize);
+    return layout.draw(canvas, position);
+}
+
+glm::vec2 FontFace::drawUtf8(Canvas *canvas, const std::string &text, int pointSize, const glm::vec2 &position)
+{
+    return layoutUtf8(text, pointSize)->draw(canvas, position);
+}
+
+glm::vec2 FontFace::drawUtf16(Canvas *canvas, const std::wstring &text, int pointSize, const glm::vec2 &position)
+{
+    return layoutUtf16(text, pointSize)->draw(canvas, position);
+}
+
+Rectangle FontFace::computeUtf8TextRectangle(const std::string &text, int pointSize)
+{
+    return layoutUtf8(text, pointSize)->getBounds();
+}
+
+Rectangle FontFace::computeUtf16TextRectangle(const std::wstring &text, int pointSize)
+{
+    return layoutUtf16(text, pointSize)->getBounds();
+}
+
+TextLayoutPtr FontFace::layoutUtf8(const std::string &text, int pointSize)
+{
+    std::vector<uint32_t> codePoints;
+    decodeUtf8(text, codePoints);
+
+    auto layout = std::make_shared<TextLayout> ();
+    layoutCodePointsWithFallback(*layout, codePoints.data(), codePoints.size(), pointSize);
+    return layout;
+}
+
+TextLayoutPtr FontFace::layoutUtf16(const std::wstring &text, int pointSize)
+{
+    std::vector<uint32_t> codePoints;
+    decodeUtf16(text, codePoints);
+
+    auto layout = std::make_shared<TextLayout> ();
+    layoutCodePointsWithFallback(*layout, codePoints.data(), codePoints.size(), pointSize);
+    return layout;
+}
+
+FontFace *FontFace::resolveFaceForCharacter(uint32_t codePoint)
+{
+    if (coverage.contains(codePoint))
+        return this;
+
+    for (auto face : fallbackChain)
+    {
+        if (face->coverage.contains(codePoint))
+            return face;
+    }
+
+    // Let this face draw its missing glyph.
+    return this;
+}
+
+void FontFace::layoutCodePointsWithFallback(TextLayout &layout, const uint32_t *codePoints, size_t count, int pointSize)
+{
+    if (fallbackChain.empty())
+    {
+        layoutCodePoints(layout, codePoints, count, pointSize);
+        return;
+    }
+
+    // Split the text in runs of code points that are drawn by the same face.
+    size_t runStart = 0;
+    FontFace *runFace = nullptr;
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto face = resolveFaceForCharacter(codePoints[i]);
+        if (face != runFace)
+        {
+            if (runFace)
+                runFace->layoutCodePoints(layout, codePoints + runStart, i - runStart, pointSize);
+            runFace = face;
+            runStart = i;
+        }
+    }
+
+    if (runFace)
+        runFace->layoutCodePoints(layout, codePoints + runStart, count - runStart, pointSize);
 }
 
 } // End of namespace GUI
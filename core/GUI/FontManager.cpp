@@ -1,6 +1,8 @@
 #include "Loden/GUI/FontManager.hpp"
 #include "Loden/JSON.hpp"
 #include "Loden/FileSystem.hpp"
+#include "Loden/Settings.hpp"
+#include "Loden/ThreadPool.hpp"
 #include "FreeTypeFont.hpp"
 #include "LodenFont.hpp"
 
@@ -10,7 +12,7 @@ namespace GUI
 {
 
 FontManager::FontManager(Engine *engine)
-    : engine(engine)
+    : engine(engine), pendingPreloadCount(0)
 {
 }
 
@@ -29,6 +31,7 @@ bool FontManager::initialize()
         fontLoaders.push_back(fontLoader);
 
     loadFontsFromFile("core-assets/fonts/fonts.json");
+    preloadWarmSet();
 
     return true;
 }
@@ -60,7 +63,30 @@ bool FontManager::loadFontsFromFile(const std::string &fontsDescriptionFileName)
         }
     }
 
-    // Load the fonts.
+    // Read the warm set. Its entries are font names, or font and face names
+    // separated by a slash.
+    if (document.HasMember("warm-set"))
+    {
+        auto &warmSetDesc = document["warm-set"];
+        if (!warmSetDesc.IsArray())
+            return false;
+
+        for (auto it = warmSetDesc.Begin(); it != warmSetDesc.End(); ++it)
+        {
+            if (!it->IsString())
+                return false;
+
+            std::string entry = it->GetString();
+            auto separator = entry.find('/');
+            if (separator == std::string::npos)
+                warmSet.push_back(std::make_pair(entry, std::string()));
+            else
+                warmSet.push_back(std::make_pair(entry.substr(0, separator), entry.substr(separator + 1)));
+        }
+    }
+
+    // Register the fonts. Their faces are loaded on first use.
+    std::vector<std::pair<FontPtr, std::vector<std::string> > > fallbackChains;
     if (document.HasMember("fonts"))
     {
         auto &fontsDesc = document["fonts"];
@@ -91,13 +117,44 @@ bool FontManager::loadFontsFromFile(const std::string &fontsDescriptionFileName)
                 if (!faceFileName.IsString())
                     return false;
 
-                auto face = loadFaceFromFile(joinPath(basePath, faceFileName.GetString()));
-                if (face)
-                    font->addFace(faceName, face);
+                auto faceFullFileName = joinPath(basePath, faceFileName.GetString());
+                font->addLazyFace(faceName, [this, faceFullFileName] {
+                    return loadFaceFromFile(faceFullFileName);
+                });
             }
 
             // Cache the special faces.
             font->loadSpecialFaces();
+
+            // Read the names of the fallback fonts.
+            if (fontDesc.HasMember("fallback"))
+            {
+                auto &fallbackDesc = fontDesc["fallback"];
+                if (!fallbackDesc.IsArray())
+                    return false;
+
+                std::vector<std::string> fallbackNames;
+                for (auto fallbackIt = fallbackDesc.Begin(); fallbackIt != fallbackDesc.End(); ++fallbackIt)
+                {
+                    if (!fallbackIt->IsString())
+                        return false;
+                    fallbackNames.push_back(fallbackIt->GetString());
+                }
+
+                fallbackChains.push_back(std::make_pair(font, fallbackNames));
+            }
+        }
+    }
+
+    // Build the fallback chains, once every font of the file is registered.
+    // This loads the default faces of the fallback fonts.
+    for (auto &chain : fallbackChains)
+    {
+        for (auto &fallbackName : chain.second)
+        {
+            auto fallbackFont = getFont(fallbackName);
+            if (fallbackFont)
+                chain.first->addFallbackFace(fallbackFont->getDefaultFace());
         }
     }
 
@@ -128,24 +185,95 @@ FontFacePtr FontManager::loadFaceFromFile(const std::string &fileName)
     return nullptr;
 }
 
+void FontManager::preloadWarmSet()
+{
+    auto backgroundLoading = engine->getSettings()->getBoolValue("Fonts", "BackgroundLoading", true);
+    for (auto &entry : warmSet)
+    {
+        auto font = getFont(entry.first);
+        if (!font)
+            continue;
+
+        if (backgroundLoading)
+            queuePreload(font, entry.second);
+        else if (entry.second.empty())
+            font->preloadFaces();
+        else
+            font->getFace(entry.second);
+    }
+}
+
+void FontManager::queuePreload(const FontPtr &font, const std::string &faceName)
+{
+    auto &threadPool = engine->getThreadPool();
+    if (!font || !threadPool)
+        return;
+
+    {
+        std::unique_lock<std::mutex> l(preloadMutex);
+        ++pendingPreloadCount;
+    }
+
+    threadPool->submit([this, font, faceName] {
+        if (faceName.empty())
+            font->preloadFaces();
+        else
+            font->getFace(faceName);
+
+        std::unique_lock<std::mutex> l(preloadMutex);
+        if (--pendingPreloadCount == 0)
+            preloadFinishedCondition.notify_all();
+    });
+}
+
+void FontManager::waitPendingPreloads()
+{
+    std::unique_lock<std::mutex> l(preloadMutex);
+    while (pendingPreloadCount > 0)
+        preloadFinishedCondition.wait(l);
+}
+
 void FontManager::shutdown()
 {
-    for (auto &font : fonts)
-        font.second->release();
-    fonts.clear();
+    waitPendingPreloads();
+    textLayoutCache.clear();
+
+    {
+        std::unique_lock<std::mutex> l(fontsMutex);
+        for (auto &font : fonts)
+            font.second->release();
+        fonts.clear();
+    }
 
     for(auto &loader : fontLoaders)
         loader->shutdown();
     fontLoaders.clear();
 }
 
+void FontManager::beginFrame()
+{
+    for (auto &loader : fontLoaders)
+        loader->beginFrame();
+}
+
+void FontManager::markShaderResourcesUsed(agpu_shader_resource_binding *const *bindings, size_t count)
+{
+    if (!count)
+        return;
+
+    for (auto &loader : fontLoaders)
+        loader->markShaderResourcesUsed(bindings, count);
+}
+
 void FontManager::addFont(const std::string &name, const FontPtr &font)
 {
+    std::unique_lock<std::mutex> l(fontsMutex);
     fonts.insert(std::make_pair(name, font));
 }
 
 FontPtr FontManager::getFont(const std::string &name)
 {
+    std::unique_lock<std::mutex> l(fontsMutex);
     auto it = fonts.find(name);
     if (it != fonts.end())
         return it->second;
@@ -172,5 +300,10 @@ FontPtr FontManager::getDefaultMonospaceFont() const
     return defaultMononospacedFont;
 }
 
+TextLayoutCache &FontManager::getTextLayoutCache()
+{
+    return textLayoutCache;
+}
+
 } // End of namespace Loden
 } // End of namespace GUI
@@ -1,8 +1,15 @@
 #include "FreeTypeFont.hpp"
 #include <glm/mat3x3.hpp>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
 #include "Loden/Printing.hpp"
 #include "Loden/FileSystem.hpp"
 #include "Loden/GUI/Canvas.hpp"
+#include "Loden/Settings.hpp"
+#include "Loden/LRUCache.hpp"
+#include "Loden/Math.hpp"
+#include <vector>
+#include <unordered_map>
 #include FT_OUTLINE_H
 
 namespace Loden
@@ -11,23 +18,171 @@ namespace GUI
 {
 
 static constexpr float ScaleFactor = 1.0f / 64.0f;
+static constexpr size_t DefaultGlyphOutlineCacheBudget = 1 << 20;
+
+// The largest distance in pixels between an outline curve and its chords.
+static constexpr float GlyphCurveTolerance = 0.2f;
 
 inline glm::vec2 convertFreeTypeVector(const FT_Vector *vector)
 {
     return glm::vec2(vector->x, vector->y);
 }
 
+/**
+ * A flattened glyph outline for a specific pixel size. The points are
+ * relative to the pen position, with the Y axis pointing down.
+ */
+struct FreeTypeGlyphOutline
+{
+    FreeTypeGlyphOutline()
+        : valid(false) {}
+
+    size_t getMemoryCost() const
+    {
+        return sizeof(FreeTypeGlyphOutline) + points.capacity()*sizeof(glm::vec2) + contourEnds.capacity()*sizeof(uint32_t);
+    }
+
+    bool valid;
+    std::vector<glm::vec2> points;
+    std::vector<uint32_t> contourEnds;
+};
+
+/**
+ * The metrics of a glyph for a specific pixel size. The bounds are relative
+ * to the pen position, with the Y axis pointing down.
+ */
+struct FreeTypeGlyphMetrics
+{
+    enum State : uint8_t
+    {
+        Unloaded = 0,
+        Valid,
+        Invalid,
+    };
+
+    FreeTypeGlyphMetrics()
+        : advance(0.0f), bounds(glm::vec2(0, 0), glm::vec2(0, 0)), state(Unloaded) {}
+
+    float advance;
+    Rectangle bounds;
+    State state;
+};
+
+/**
+ * The glyph metrics and kerning pairs of a face at a specific size. The
+ * metrics table is indexed directly by the glyph index.
+ */
+struct FreeTypeSizeMetrics
+{
+    std::vector<FreeTypeGlyphMetrics> glyphs;
+    std::unordered_map<uint64_t, float> kerningPairs;
+};
+
+/**
+ * Tracks the canvas drawing mode while drawing a string, which can switch
+ * between glyph atlas quads and outline fill paths. The quads of the same
+ * atlas page are batched into a single glyph run.
+ */
+class FreeTypeTextDrawingState
+{
+public:
+    FreeTypeTextDrawingState(Canvas *canvas)
+        : canvas(canvas), atlasPage(-1), atlasBinding(nullptr), fillingPath(false), glyphs(getGlyphBuffer())
+    {
+        glyphs.clear();
+    }
+
+    ~FreeTypeTextDrawingState()
+    {
+        finish();
+    }
+
+    void useAtlasPage(int page, agpu_shader_resource_binding *binding)
+    {
+        if (fillingPath)
+        {
+            canvas->endFillPath();
+            fillingPath = false;
+        }
+
+        if (atlasPage != page)
+        {
+            flushGlyphs();
+            atlasPage = page;
+            atlasBinding = binding;
+        }
+    }
+
+    void addAtlasGlyph(const Rectangle &destRectangle, const Rectangle &sourceRectangle)
+    {
+        CanvasGlyph glyph;
+        glyph.destRectangle = destRectangle;
+        glyph.sourceRectangle = sourceRectangle;
+        glyphs.push_back(glyph);
+    }
+
+    void useOutlines()
+    {
+        flushGlyphs();
+        atlasPage = -1;
+
+        if (!fillingPath)
+        {
+            canvas->beginFillPath(PathFillRule::NonZero);
+            fillingPath = true;
+        }
+    }
+
+    void finish()
+    {
+        flushGlyphs();
+        if (fillingPath)
+            canvas->endFillPath();
+        atlasPage = -1;
+        fillingPath = false;
+    }
+
+    Canvas *canvas;
+
+private:
+    // The glyph buffer is reused between strings, to avoid allocating while
+    // drawing.
+    static std::vector<CanvasGlyph> &getGlyphBuffer()
+    {
+        static thread_local std::vector<CanvasGlyph> buffer;
+        return buffer;
+    }
+
+    void flushGlyphs()
+    {
+        if (!glyphs.empty())
+            canvas->drawGlyphRun(atlasBinding, false, glyphs.data(), glyphs.size());
+        glyphs.clear();
+    }
+
+    int atlasPage;
+    agpu_shader_resource_binding *atlasBinding;
+    bool fillingPath;
+    std::vector<CanvasGlyph> &glyphs;
+};
+
 /**
  * Free type font face wrapper.
  */
 class FreeTypeFace: public FontFace
 {
 public:
-    FreeTypeFace(FT_Face face)
-        : face(face)
+    FreeTypeFace(FT_Face face, const GlyphAtlasPtr &glyphAtlas = nullptr)
+        : face(face), glyphAtlas(glyphAtlas), outlineCache(DefaultGlyphOutlineCacheBudget)
     {
         currentPointSize = -1;
         hasKerning = FT_HAS_KERNING(face);
+        atlasFaceId = glyphAtlas ? glyphAtlas->allocateFaceId() : 0;
+        lastSizeMetrics = nullptr;
+        lastSizeMetricsPointSize = -1;
+        for (auto &glyphIndex : latinGlyphIndices)
+            glyphIndex = -1;
+        computeCoverage();
     }
 
     ~FreeTypeFace()
@@ -37,28 +192,54 @@ public:
 
     void release()
     {
+        std::unique_lock<std::mutex> l(faceMutex);
+        outlineCache.clear();
+        sizeMetrics.clear();
+        lastSizeMetrics = nullptr;
+        lastSizeMetricsPointSize = -1;
         if (face)
             FT_Done_Face(face);
         face = nullptr;
     }
 
-    glm::vec2 drawNextCharacter(Canvas *canvas, int character, int previousCharacter, int pointSize, const glm::vec2 &position);
-    glm::vec2 appendCharacterBoundingBox(int character, int previousCharacter, int pointSize, const glm::vec2 &position, Rectangle &accumulatedBoundingBox);
-
-    virtual glm::vec2 drawCharacter(Canvas *canvas, int character, int pointSize, const glm::vec2 &position);
-    virtual glm::vec2 drawUtf8(Canvas *canvas, const std::string &text, int pointSize, const glm::vec2 &position);
-    virtual glm::vec2 drawUtf16(Canvas *canvas, const std::wstring &text, int pointSize, const glm::vec2 &position);
+    virtual void layoutCodePoints(TextLayout &layout, const uint32_t *codePoints, size_t count, int pointSize);
+    virtual void drawLayoutRun(Canvas *canvas, const TextLayout &layout, const TextLayoutRun &run, const glm::vec2 &position);
 
-    virtual Rectangle computeUtf8TextRectangle(const std::string &text, int pointSize);
-    virtual Rectangle computeUtf16TextRectangle(const std::wstring &text, int pointSize);
+    void setOutlineCacheBudget(size_t budget)
+    {
+        std::unique_lock<std::mutex> l(faceMutex);
+        outlineCache.setBudget(budget);
+    }
 
 private:
-    void drawOutline(Canvas *canvas, FT_Outline *outline, const glm::vec2 &scale, const glm::vec2 &position);
+    typedef LRUCache<uint64_t, FreeTypeGlyphOutline> OutlineCache;
+
+    void computeCoverage();
+    FT_UInt getGlyphIndex(uint32_t character);
+    FreeTypeSizeMetrics &getSizeMetrics(int pointSize);
+    const FreeTypeGlyphMetrics &getGlyphMetrics(FreeTypeSizeMetrics &metrics, int pointSize, FT_UInt glyphIndex);
+    const FreeTypeGlyphOutline &getGlyphOutline(FT_UInt glyphIndex);
+    bool getAtlasGlyph(FT_UInt glyphIndex, GlyphAtlasEntry &entry);
+    void flattenOutline(FT_Outline *outline, FreeTypeGlyphOutline &result);
+    void drawGlyph(FreeTypeTextDrawingState &state, FT_UInt glyphIndex, const glm::vec2 &position);
+    float computeKerning(FreeTypeSizeMetrics &metrics, int pointSize, FT_UInt previousGlyph, FT_UInt glyphIndex);
     bool updatePointSize(int newPointSize);
 
+    // A FreeType face can only be used by a thread at a time, and the
+    // metrics and the outlines are cached lazily.
+    std::mutex faceMutex;
     FT_Face face;
     int currentPointSize;
     bool hasKerning;
+    GlyphAtlasPtr glyphAtlas;
+    uint32_t atlasFaceId;
+    OutlineCache outlineCache;
+
+    // Metrics
+    int32_t latinGlyphIndices[256];
+    std::unordered_map<int, std::unique_ptr<FreeTypeSizeMetrics> > sizeMetrics;
+    FreeTypeSizeMetrics *lastSizeMetrics;
+    int lastSizeMetricsPointSize;
 };
 
 bool FreeTypeFace::updatePointSize(int newPointSize)
@@ -77,227 +258,309 @@ bool FreeTypeFace::updatePointSize(int newPointSize)
     return true;
 }
 
-glm::vec2 FreeTypeFace::appendCharacterBoundingBox(int character, int previousCharacter, int pointSize, const glm::vec2 &position, Rectangle &accumulatedBoundingBox)
+const FreeTypeGlyphOutline &FreeTypeFace::getGlyphOutline(FT_UInt glyphIndex)
 {
-    // Get the glyph index.
-    auto glyphIndex = FT_Get_Char_Index(face, character);
+    auto key = uint64_t(glyphIndex) | (uint64_t(uint32_t(currentPointSize)) << 32);
+    auto cached = outlineCache.find(key);
+    if (cached)
+        return *cached;
+
+    FreeTypeGlyphOutline result;
 
-    // Load the glyph.
+    // Load the glyph. Failures are cached as well, to avoid retrying them on each frame.
     auto error = FT_Load_Glyph(face, glyphIndex, FT_LOAD_NO_BITMAP);
-    if (error)
-        return position;
     auto glyph = face->glyph;
 
     // Only support outline fonts.
-    if (glyph->format != FT_GLYPH_FORMAT_OUTLINE)
-        return position;
+    if (!error && glyph->format == FT_GLYPH_FORMAT_OUTLINE)
+    {
+        result.valid = true;
+        flattenOutline(&glyph->outline, result);
+    }
 
-    // Get the glyph metrics.
-    auto &metrics = glyph->metrics;
-    auto bearingY = metrics.horiBearingY * ScaleFactor;
-    auto advance = metrics.horiAdvance*ScaleFactor;
+    auto cost = result.getMemoryCost();
+    return outlineCache.insert(key, std::move(result), cost);
+}
 
-    // Get the kerning.
-    auto kerning = 0.0f;
-    if (hasKerning && previousCharacter >= 0 && glyphIndex != 0)
+void FreeTypeFace::computeCoverage()
+{
+    FT_UInt glyphIndex;
+    auto character = FT_Get_First_Char(face, &glyphIndex);
+    while (glyphIndex != 0)
     {
-        auto previousGlyph = FT_Get_Char_Index(face, previousCharacter);
-        if (previousGlyph != 0)
-        {
-            FT_Vector delta;
-            FT_Get_Kerning(face, previousGlyph, glyphIndex, FT_KERNING_DEFAULT, &delta);
-            kerning = delta.x * ScaleFactor;
-        }
+        coverage.insert(uint32_t(character));
+        character = FT_Get_Next_Char(face, character, &glyphIndex);
     }
+}
 
-    // Draw the outline.
-    auto scale = glm::vec2(ScaleFactor, -ScaleFactor);
-    auto translation = position + glm::vec2(0, bearingY);
+FT_UInt FreeTypeFace::getGlyphIndex(uint32_t character)
+{
+    if (character >= 256)
+        return FT_Get_Char_Index(face, character);
 
-    auto minX = metrics.horiBearingX * ScaleFactor;
-    auto maxX = (metrics.horiBearingX + metrics.width) * ScaleFactor;
+    auto &glyphIndex = latinGlyphIndices[character];
+    if (glyphIndex < 0)
+        glyphIndex = FT_Get_Char_Index(face, character);
+    return FT_UInt(glyphIndex);
+}
 
-    auto minY = -metrics.horiBearingY * ScaleFactor;
-    auto maxY = (metrics.height - metrics.horiBearingY) * ScaleFactor;
+FreeTypeSizeMetrics &FreeTypeFace::getSizeMetrics(int pointSize)
+{
+    if (lastSizeMetrics && lastSizeMetricsPointSize == pointSize)
+        return *lastSizeMetrics;
 
-    accumulatedBoundingBox.insertRectangle(Rectangle(position + glm::vec2(minX, minY), position + glm::vec2(maxX, maxY)));
+    auto &metrics = sizeMetrics[pointSize];
+    if (!metrics)
+    {
+        metrics.reset(new FreeTypeSizeMetrics());
+        metrics->glyphs.resize(face->num_glyphs);
 
-    // Compute the advance.
-    return position + glm::vec2(advance + kerning, 0);
+        // Fill the Latin-1 glyphs eagerly, since almost every text uses them.
+        for (uint32_t c = 0x20; c < 0x100; ++c)
+        {
+            if (c == 0x7F)
+                c = 0xA0;
+            getGlyphMetrics(*metrics, pointSize, getGlyphIndex(c));
+        }
+    }
+
+    lastSizeMetrics = metrics.get();
+    lastSizeMetricsPointSize = pointSize;
+    return *metrics;
 }
 
-glm::vec2 FreeTypeFace::drawNextCharacter(Canvas *canvas, int character, int previousCharacter, int pointSize, const glm::vec2 &position)
+const FreeTypeGlyphMetrics &FreeTypeFace::getGlyphMetrics(FreeTypeSizeMetrics &metrics, int pointSize, FT_UInt glyphIndex)
 {
-    // Get the glyph index.
-    auto glyphIndex = FT_Get_Char_Index(face, character);
+    static const FreeTypeGlyphMetrics invalidMetrics;
+    if (glyphIndex >= metrics.glyphs.size())
+        return invalidMetrics;
+
+    auto &result = metrics.glyphs[glyphIndex];
+    if (result.state != FreeTypeGlyphMetrics::Unloaded)
+        return result;
+
+    result.state = FreeTypeGlyphMetrics::Invalid;
+    if (!updatePointSize(pointSize))
+        return result;
 
-    // Load the glyph.
     auto error = FT_Load_Glyph(face, glyphIndex, FT_LOAD_NO_BITMAP);
-    if (error)
-        return position;
     auto glyph = face->glyph;
 
     // Only support outline fonts.
-    if (glyph->format != FT_GLYPH_FORMAT_OUTLINE)
-        return position;
-
-    // Get the glyph metrics.
-    auto &metrics = glyph->metrics;
-    auto advance = metrics.horiAdvance*ScaleFactor;
+    if (error || glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+        return result;
 
-    // Get the kerning.
-    auto kerning = 0.0f;
-    if (hasKerning && previousCharacter >= 0 && glyphIndex != 0)
-    {
-        auto previousGlyph = FT_Get_Char_Index(face, previousCharacter);
-        if (previousGlyph != 0)
-        {
-            FT_Vector delta;
-            FT_Get_Kerning(face, previousGlyph, glyphIndex, FT_KERNING_DEFAULT, &delta);
-            kerning = delta.x * ScaleFactor;
-        }
-    }
+    auto &glyphMetrics = glyph->metrics;
+    auto minX = glyphMetrics.horiBearingX * ScaleFactor;
+    auto maxX = (glyphMetrics.horiBearingX + glyphMetrics.width) * ScaleFactor;
 
-    // Draw the outline.
-    auto scale = glm::vec2(ScaleFactor, -ScaleFactor);
-    auto translation = position;
-    drawOutline(canvas, &glyph->outline, scale, position);
+    auto minY = -glyphMetrics.horiBearingY * ScaleFactor;
+    auto maxY = (glyphMetrics.height - glyphMetrics.horiBearingY) * ScaleFactor;
 
-    // Compute the advance.
-    return position + glm::vec2(advance + kerning, 0);
+    result.advance = glyphMetrics.horiAdvance*ScaleFactor;
+    result.bounds = Rectangle(glm::vec2(minX, minY), glm::vec2(maxX, maxY));
+    result.state = FreeTypeGlyphMetrics::Valid;
+    return result;
 }
 
-void FreeTypeFace::drawOutline(Canvas *canvas, FT_Outline *outline, const glm::vec2 &scale, const glm::vec2 &translation)
+float FreeTypeFace::computeKerning(FreeTypeSizeMetrics &metrics, int pointSize, FT_UInt previousGlyph, FT_UInt glyphIndex)
 {
-    struct DrawState
-    {
-        Canvas *canvas;
-        glm::vec2 scale;
-        glm::vec2 translation;
-    };
-
-    FT_Outline_Funcs funcs;
-    memset(&funcs, 0, sizeof(funcs));
-    funcs.move_to = [](const FT_Vector *to, void *user) {
-        auto state = reinterpret_cast<DrawState*> (user);
-        auto transformedTo = convertFreeTypeVector(to) * state->scale + state->translation;
-        state->canvas->moveTo(transformedTo);
-        return 0;
-    };
-    funcs.line_to = [](const FT_Vector *to, void *user) {
-        auto state = reinterpret_cast<DrawState*> (user);
-        auto transformedTo = convertFreeTypeVector(to) * state->scale + state->translation;
-        state->canvas->lineTo(transformedTo);
-        return 0;
-    };
-    funcs.conic_to = [](const FT_Vector *control, const FT_Vector *to, void *user) {
-        auto state = reinterpret_cast<DrawState*> (user);
-        auto transformedControl = convertFreeTypeVector(control) * state->scale + state->translation;
-        auto transformedTo = convertFreeTypeVector(to) * state->scale + state->translation;
-        state->canvas->quadTo(transformedControl, transformedTo);
-        return 0;
-    };
-    funcs.cubic_to = [](const FT_Vector *control1, const FT_Vector *control2, const FT_Vector *to, void *user) {
-        auto state = reinterpret_cast<DrawState*> (user);
-        auto transformedControl1 = convertFreeTypeVector(control1) * state->scale + state->translation;
-        auto transformedControl2 = convertFreeTypeVector(control2) * state->scale + state->translation;
-        auto transformedTo = convertFreeTypeVector(to) * state->scale + state->translation;
-        state->canvas->cubicTo(transformedControl1, transformedControl2, transformedTo);
-        return 0;
-    };
+    if (!hasKerning || previousGlyph == 0 || glyphIndex == 0)
+        return 0.0f;
 
-    DrawState state;
-    state.canvas = canvas;
-    state.scale = scale;
-    state.translation = translation;
-    FT_Outline_Decompose(outline, &funcs, &state);
-}
+    auto key = (uint64_t(previousGlyph) << 32) | uint64_t(glyphIndex);
+    auto it = metrics.kerningPairs.find(key);
+    if (it != metrics.kerningPairs.end())
+        return it->second;
 
-glm::vec2 FreeTypeFace::drawCharacter(Canvas *canvas, int character, int pointSize, const glm::vec2 &position)
-{
-    if (!updatePointSize(pointSize))
-        return position;
+    auto kerning = 0.0f;
+    FT_Vector delta;
+    if (updatePointSize(pointSize) && !FT_Get_Kerning(face, previousGlyph, glyphIndex, FT_KERNING_DEFAULT, &delta))
+        kerning = delta.x * ScaleFactor;
 
-    canvas->beginFillPath(PathFillRule::NonZero);
-    auto result = drawNextCharacter(canvas, character, -1, pointSize, position);
-    canvas->endFillPath();
-    return result;
+    metrics.kerningPairs.insert(std::make_pair(key, kerning));
+    return kerning;
 }
 
-glm::vec2 FreeTypeFace::drawUtf8(Canvas *canvas, const std::string &text, int pointSize, const glm::vec2 &position)
+void FreeTypeFace::layoutCodePoints(TextLayout &layout, const uint32_t *codePoints, size_t count, int pointSize)
 {
-    if (!updatePointSize(pointSize))
-        return position;
-
-    // TODO: Decode the UTF-8 character
-    auto currentPosition = position;
-    canvas->beginFillPath(PathFillRule::NonZero);
-    int previousCharacter = -1;
-    for (size_t i = 0; i < text.size(); ++i)
+    std::unique_lock<std::mutex> l(faceMutex);
+    auto &metrics = getSizeMetrics(pointSize);
+    auto pen = layout.getAdvance();
+    layout.beginRun(this, pointSize);
+    FT_UInt previousGlyph = 0;
+    for (size_t i = 0; i < count; ++i)
     {
-        int character = text[i];
-        currentPosition = drawNextCharacter(canvas, character, previousCharacter, pointSize, currentPosition);
-        previousCharacter = character;
+        auto glyphIndex = getGlyphIndex(codePoints[i]);
+        auto &glyphMetrics = getGlyphMetrics(metrics, pointSize, glyphIndex);
+        if (glyphMetrics.state != FreeTypeGlyphMetrics::Valid)
+            continue;
+
+        pen.x += computeKerning(metrics, pointSize, previousGlyph, glyphIndex);
+        layout.addGlyph(glyphIndex, pen, Rectangle(pen + glyphMetrics.bounds.min, pen + glyphMetrics.bounds.max));
+        pen.x += glyphMetrics.advance;
+        previousGlyph = glyphIndex;
     }
-    canvas->endFillPath();
+    layout.endRun(pen);
+}
 
-    return currentPosition;
+void FreeTypeFace::drawLayoutRun(Canvas *canvas, const TextLayout &layout, const TextLayoutRun &run, const glm::vec2 &position)
+{
+    std::unique_lock<std::mutex> l(faceMutex);
+    if (!updatePointSize(run.pointSize))
+        return;
+
+    FreeTypeTextDrawingState state(canvas);
+    auto glyphs = &layout.getGlyphs()[run.firstGlyph];
+    for (size_t i = 0; i < run.glyphCount; ++i)
+        drawGlyph(state, glyphs[i].glyph, position + glyphs[i].position);
 }
 
-glm::vec2 FreeTypeFace::drawUtf16(Canvas *canvas, const std::wstring &text, int pointSize, const glm::vec2 &position)
+bool FreeTypeFace::getAtlasGlyph(FT_UInt glyphIndex, GlyphAtlasEntry &entry)
 {
-    if (!updatePointSize(pointSize))
-        return position;
+    auto key = GlyphAtlas::makeGlyphKey(atlasFaceId, glyphIndex, currentPointSize);
+    if (glyphAtlas->findGlyph(key, entry))
+        return true;
 
-    // TODO: Decode the UTF-16 character
-    auto currentPosition = position;
-    canvas->beginFillPath(PathFillRule::NonZero);
-    int previousCharacter = -1;
-    for (size_t i = 0; i < text.size(); ++i)
+    // Rasterize the glyph.
+    auto error = FT_Load_Glyph(face, glyphIndex, FT_LOAD_RENDER);
+    if (error)
     {
-        int character = text[i];
-        currentPosition = drawNextCharacter(canvas, character, previousCharacter, pointSize, currentPosition);
-        previousCharacter = character;
+        glyphAtlas->insertUnavailableGlyph(key, 0.0f);
+        return false;
     }
-    canvas->endFillPath();
 
-    return currentPosition;
+    // Remember the bitmaps that cannot be stored, to keep using their outline.
+    auto glyph = face->glyph;
+    auto &bitmap = glyph->bitmap;
+    int width = bitmap.width;
+    int height = bitmap.rows;
+    auto advance = glyph->metrics.horiAdvance*ScaleFactor;
+    if (width > 0 && height > 0 && bitmap.pixel_mode != FT_PIXEL_MODE_GRAY)
+    {
+        glyphAtlas->insertUnavailableGlyph(key, advance);
+        return false;
+    }
+
+    // Rows are stored bottom-up when the pitch is negative.
+    const uint8_t *topRow = bitmap.buffer;
+    if (bitmap.pitch < 0 && height > 0)
+        topRow -= ptrdiff_t(bitmap.pitch) * (height - 1);
+
+    auto offset = glm::vec2(glyph->bitmap_left, -glyph->bitmap_top);
+    return glyphAtlas->insertGlyph(key, width, height, bitmap.pitch, topRow, offset, advance, entry);
 }
 
-Rectangle FreeTypeFace::computeUtf8TextRectangle(const std::string &text, int pointSize)
+void FreeTypeFace::drawGlyph(FreeTypeTextDrawingState &state, FT_UInt glyphIndex, const glm::vec2 &position)
 {
-    if (!updatePointSize(pointSize))
-        return Rectangle();
-
-    int previousCharacter = -1;
-    glm::vec2 currentPosition(0);
-    Rectangle boundingBox(glm::vec2(0, 0), glm::vec2(0, 0));
-    for (size_t i = 0; i < text.size(); ++i)
+    // Try to use the glyph atlas first.
+    if (glyphAtlas)
     {
-        int character = text[i];
-        currentPosition = appendCharacterBoundingBox(character, previousCharacter, pointSize, currentPosition, boundingBox);
-        previousCharacter = character;
+        GlyphAtlasEntry atlasGlyph;
+        if (getAtlasGlyph(glyphIndex, atlasGlyph) && atlasGlyph.page != GlyphAtlasEntry::UnavailablePage)
+        {
+            if (atlasGlyph.page == GlyphAtlasEntry::EmptyPage)
+                return;
+
+            state.useAtlasPage(atlasGlyph.page, glyphAtlas->getPageBinding(atlasGlyph.page));
+
+            // Keep the quads aligned with the pixel grid.
+            auto pen = glm::floor(position + 0.5f);
+            Rectangle dest(pen + atlasGlyph.offset, pen + atlasGlyph.offset + atlasGlyph.size);
+            state.addAtlasGlyph(dest, atlasGlyph.sourceRectangle);
+            return;
+        }
     }
 
-    return boundingBox;
+    auto &outline = getGlyphOutline(glyphIndex);
+    if (!outline.valid)
+        return;
+
+    // Replay the flattened contours at the pen position.
+    state.useOutlines();
+    auto canvas = state.canvas;
+    uint32_t start = 0;
+    for (auto end : outline.contourEnds)
+    {
+        if (end > start)
+        {
+            canvas->moveTo(outline.points[start] + position);
+            for (auto i = start + 1; i < end; ++i)
+                canvas->lineTo(outline.points[i] + position);
+        }
+        start = end;
+    }
 }
 
-Rectangle FreeTypeFace::computeUtf16TextRectangle(const std::wstring &text, int pointSize)
+void FreeTypeFace::flattenOutline(FT_Outline *outline, FreeTypeGlyphOutline &result)
 {
-    if (!updatePointSize(pointSize))
-        return Rectangle();
-
-    int previousCharacter = -1;
-    glm::vec2 currentPosition(0);
-    Rectangle boundingBox(glm::vec2(0, 0), glm::vec2(0, 0));
-    for (size_t i = 0; i < text.size(); ++i)
+    struct FlattenState
     {
-        int character = text[i];
-        currentPosition = appendCharacterBoundingBox(character, previousCharacter, pointSize, currentPosition, boundingBox);
-        previousCharacter = character;
-    }
+        static void lineTo(FlattenState *state, const glm::vec2 &point)
+        {
+            state->result->points.push_back(point);
+            state->currentPosition = point;
+        }
+
+        static void quadTo(FlattenState *state, const glm::vec2 &control, const glm::vec2 &point)
+        {
+            flattenQuadraticBezier(state->currentPosition, control, point, GlyphCurveTolerance, [=](const glm::vec2 &p) {
+                lineTo(state, p);
+            });
+        }
+
+        static void cubicTo(FlattenState *state, const glm::vec2 &control, const glm::vec2 &control2, const glm::vec2 &point)
+        {
+            flattenCubicBezier(state->currentPosition, control, control2, point, GlyphCurveTolerance, [=](const glm::vec2 &p) {
+                lineTo(state, p);
+            });
+        }
+
+        void endContour()
+        {
+            if (result->contourEnds.empty() || result->contourEnds.back() != result->points.size())
+                result->contourEnds.push_back(uint32_t(result->points.size()));
+        }
+
+        FreeTypeGlyphOutline *result;
+        glm::vec2 currentPosition;
+        glm::vec2 scale;
+    };
+
+    FT_Outline_Funcs funcs;
+    memset(&funcs, 0, sizeof(funcs));
+    funcs.move_to = [](const FT_Vector *to, void *user) {
+        auto state = reinterpret_cast<FlattenState*> (user);
+        state->endContour();
+        state->currentPosition = convertFreeTypeVector(to) * state->scale;
+        state->result->points.push_back(state->currentPosition);
+        return 0;
+    };
+    funcs.line_to = [](const FT_Vector *to, void *user) {
+        auto state = reinterpret_cast<FlattenState*> (user);
+        FlattenState::lineTo(state, convertFreeTypeVector(to) * state->scale);
+        return 0;
+    };
+    funcs.conic_to = [](const FT_Vector *control, const FT_Vector *to, void *user) {
+        auto state = reinterpret_cast<FlattenState*> (user);
+        FlattenState::quadTo(state, convertFreeTypeVector(control) * state->scale, convertFreeTypeVector(to) * state->scale);
+        return 0;
+    };
+    funcs.cubic_to = [](const FT_Vector *control1, const FT_Vector *control2, const FT_Vector *to, void *user) {
+        auto state = reinterpret_cast<FlattenState*> (user);
+        FlattenState::cubicTo(state, convertFreeTypeVector(control1) * state->scale,
+            convertFreeTypeVector(control2) * state->scale, convertFreeTypeVector(to) * state->scale);
+        return 0;
+    };
+
+    FlattenState state;
+    state.result = &result;
+    state.scale = glm::vec2(ScaleFactor, -ScaleFactor);
+    FT_Outline_Decompose(outline, &funcs, &state);
+    state.endContour();
 
-    return boundingBox;
+    result.points.shrink_to_fit();
+    result.contourEnds.shrink_to_fit();
 }
 
 FreeTypeFontLoader::FreeTypeFontLoader(Engine *engine)
@@ -318,14 +581,31 @@ bool FreeTypeFontLoader::initialize()
         return false;
     }
 
+    // Rasterize the glyphs into a shared atlas, instead of filling their outlines.
+    if (engine && engine->getSettings()->getBoolValue("Fonts", "GlyphAtlas", true))
+        glyphAtlas = GlyphAtlas::create(engine);
+
     return true;
 }
 
 void FreeTypeFontLoader::shutdown()
 {
+    glyphAtlas.reset();
     FT_Done_FreeType(library);
 }
 
+void FreeTypeFontLoader::beginFrame()
+{
+    if (glyphAtlas)
+        glyphAtlas->beginFrame();
+}
+
+void FreeTypeFontLoader::markShaderResourcesUsed(agpu_shader_resource_binding *const *bindings, size_t count)
+{
+    if (glyphAtlas)
+        glyphAtlas->markPageBindingsUsed(bindings, count);
+}
+
 bool FreeTypeFontLoader::canLoadFaceFromFile(const std::string &fileName)
 {
     return extensionOfPath(fileName) == ".ttf";
@@ -333,6 +613,8 @@ bool FreeTypeFontLoader::canLoadFaceFromFile(const std::string &fileName)
 
 FontFacePtr FreeTypeFontLoader::loadFaceFromFile(const std::string &fileName)
 {
+    // The library is shared by the faces that are loaded in the background.
+    std::unique_lock<std::mutex> l(libraryMutex);
     FT_Face face;
     auto error = FT_New_Face(library, fileName.c_str(), 0, &face);
     if (error)
@@ -341,7 +623,7 @@ FontFacePtr FreeTypeFontLoader::loadFaceFromFile(const std::string &fileName)
         return nullptr;
     }
 
-    return std::make_shared<FreeTypeFace> (face);
+    return std::make_shared<FreeTypeFace> (face, glyphAtlas);
 }
 
 } // End of namespace GUI
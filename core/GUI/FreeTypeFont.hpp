@@ -4,6 +4,8 @@
 #include "Loden/Engine.hpp"
 #include "Loden/GUI/Font.hpp"
 #include "Loden/GUI/FontManager.hpp"
+#include "Loden/GUI/GlyphAtlas.hpp"
+#include <mutex>
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
@@ -27,9 +29,14 @@ public:
     bool canLoadFaceFromFile(const std::string &fileName);
     FontFacePtr loadFaceFromFile(const std::string &fileName);
 
+    void beginFrame();
+    void markShaderResourcesUsed(agpu_shader_resource_binding *const *bindings, size_t count);
+
 private:
     Engine *engine;
     FT_Library library;
+    std::mutex libraryMutex;
+    GlyphAtlasPtr glyphAtlas;
 };
 
 } // End of namespace GUI
@@ -0,0 +1,291 @@
+#include "Loden/GUI/GlyphAtlas.hpp"
+#include "Loden/GUI/Canvas.hpp"
+#include "Loden/PipelineStateManager.hpp"
+#include "Loden/Printing.hpp"
+#include <string.h>
+
+namespace Loden
+{
+namespace GUI
+{
+
+GlyphAtlas::GlyphAtlas()
+    : engine(nullptr), pageSize(0), maxPageCount(0), nextFaceId(1), currentFrame(EvictionFrameLatency), retryFrame(0)
+{
+}
+
+GlyphAtlas::~GlyphAtlas()
+{
+}
+
+GlyphAtlasPtr GlyphAtlas::create(Engine *engine, int pageSize, int maxPageCount)
+{
+    auto shaderSignature = engine->getPipelineStateManager()->getShaderSignature("GUI");
+    if (!shaderSignature)
+        return nullptr;
+
+    auto atlas = std::make_shared<GlyphAtlas> ();
+    atlas->engine = engine;
+    atlas->shaderSignature = shaderSignature;
+    atlas->pageSize = pageSize;
+    atlas->maxPageCount = maxPageCount;
+    return atlas;
+}
+
+uint32_t GlyphAtlas::allocateFaceId()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    return nextFaceId++;
+}
+
+void GlyphAtlas::beginFrame()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    ++currentFrame;
+
+    // The pages that were in use may be evictable now.
+    if (!retriedGlyphKeys.empty() && currentFrame >= retryFrame)
+        retryUnavailableGlyphs();
+}
+
+void GlyphAtlas::markPageBindingsUsed(agpu_shader_resource_binding *const *bindings, size_t count)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (auto &page : pages)
+        {
+            if (page.binding.get() == bindings[i])
+            {
+                page.lastUsedFrame = currentFrame;
+                break;
+            }
+        }
+    }
+}
+
+bool GlyphAtlas::findGlyph(uint64_t key, GlyphAtlasEntry &result)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    auto it = glyphs.find(key);
+    if (it == glyphs.end())
+        return false;
+
+    auto &entry = it->second;
+    if (entry.page >= 0)
+        pages[entry.page].lastUsedFrame = currentFrame;
+    result = entry;
+    return true;
+}
+
+bool GlyphAtlas::insertGlyph(uint64_t key, int width, int height, int pitch, const uint8_t *pixels, const glm::vec2 &offset, float advance, GlyphAtlasEntry &result)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    GlyphAtlasEntry entry;
+    entry.page = GlyphAtlasEntry::EmptyPage;
+    entry.offset = offset;
+    entry.size = glm::vec2(0, 0);
+    entry.advance = advance;
+
+    // Empty glyphs only need their advance.
+    if (width <= 0 || height <= 0)
+    {
+        result = glyphs[key] = entry;
+        return true;
+    }
+
+    // A glyph larger than a page never fits.
+    auto paddedWidth = width + GlyphPadding*2;
+    auto paddedHeight = height + GlyphPadding*2;
+    entry.page = GlyphAtlasEntry::UnavailablePage;
+    if (paddedWidth > pageSize || paddedHeight > pageSize)
+    {
+        result = glyphs[key] = entry;
+        return true;
+    }
+
+    // Every page is in use by the frames in flight, so try again later.
+    int x, y;
+    auto pageIndex = allocateRegion(paddedWidth, paddedHeight, x, y);
+    if (pageIndex < 0)
+    {
+        if (retriedGlyphKeys.empty())
+            retryFrame = currentFrame + EvictionFrameLatency;
+        retriedGlyphKeys.push_back(key);
+        result = glyphs[key] = entry;
+        return true;
+    }
+
+    // Copy the glyph into a zero padded staging area.
+    uploadBuffer.assign(paddedWidth*paddedHeight, 0);
+    for (int row = 0; row < height; ++row)
+        memcpy(&uploadBuffer[(row + GlyphPadding)*paddedWidth + GlyphPadding], pixels + ptrdiff_t(row)*pitch, width);
+
+    auto &page = pages[pageIndex];
+    agpu_size3d sourceSize = { agpu_uint(paddedWidth), agpu_uint(paddedHeight), 1 };
+    agpu_region3d destRegion = { agpu_uint(x), agpu_uint(y), 0, agpu_uint(paddedWidth), agpu_uint(paddedHeight), 1 };
+    page.texture->getHandle()->uploadTextureSubData(0, 0, paddedWidth, paddedWidth*paddedHeight, &sourceSize, &destRegion, &uploadBuffer[0]);
+    page.glyphKeys.push_back(key);
+    page.lastUsedFrame = currentFrame;
+
+    auto texcoordScale = 1.0f / pageSize;
+    entry.page = pageIndex;
+    entry.sourceRectangle = Rectangle(glm::vec2(x, y)*texcoordScale, glm::vec2(x + paddedWidth, y + paddedHeight)*texcoordScale);
+    entry.offset = offset - float(GlyphPadding);
+    entry.size = glm::vec2(paddedWidth, paddedHeight);
+    result = glyphs[key] = entry;
+    return true;
+}
+
+void GlyphAtlas::insertUnavailableGlyph(uint64_t key, float advance)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    GlyphAtlasEntry entry;
+    entry.page = GlyphAtlasEntry::UnavailablePage;
+    entry.offset = glm::vec2(0, 0);
+    entry.size = glm::vec2(0, 0);
+    entry.advance = advance;
+    glyphs[key] = entry;
+}
+
+agpu_shader_resource_binding *GlyphAtlas::getPageBinding(int page) const
+{
+    std::unique_lock<std::mutex> l(mutex);
+    if (page < 0 || size_t(page) >= pages.size())
+        return nullptr;
+    return pages[page].binding.get();
+}
+
+bool GlyphAtlas::createPage()
+{
+    auto &device = engine->getAgpuDevice();
+
+    agpu_texture_description desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.type = AGPU_TEXTURE_2D;
+    desc.format = AGPU_TEXTURE_FORMAT_R8_UNORM;
+    desc.width = (agpu_uint)pageSize;
+    desc.height = (agpu_uint)pageSize;
+    desc.depthOrArraySize = 1;
+    desc.miplevels = 1;
+    desc.sample_count = 1;
+    desc.sample_quality = 0;
+    desc.flags = AGPU_TEXTURE_FLAG_UPLOADED;
+    agpu_texture_ref handle = device->createTexture(&desc);
+    if (!handle)
+    {
+        printError("Failed to create a glyph atlas page.\n");
+        return false;
+    }
+
+    // Start with a cleared page.
+    std::vector<uint8_t> clearData(pageSize*pageSize, 0);
+    handle->uploadTextureData(0, 0, pageSize, pageSize*pageSize, &clearData[0]);
+
+    Page page;
+    page.texture = std::make_shared<Texture> (handle);
+    page.binding = shaderSignature->createShaderResourceBinding(2);
+    if (!page.binding)
+        return false;
+    page.binding->bindTexture(0, handle.get(), 0, -1, 0.0);
+    page.nextShelfY = 0;
+    page.lastUsedFrame = currentFrame;
+    pages.push_back(page);
+    return true;
+}
+
+bool GlyphAtlas::allocateInPage(Page &page, int width, int height, int &x, int &y)
+{
+    // Look for a shelf with enough room, without wasting too much height.
+    for (auto &shelf : page.shelves)
+    {
+        if (shelf.height >= height && shelf.height <= height + height / 2 + 2 && shelf.nextX + width <= pageSize)
+        {
+            x = shelf.nextX;
+            y = shelf.y;
+            shelf.nextX += width;
+            return true;
+        }
+    }
+
+    // Open a new shelf.
+    if (page.nextShelfY + height > pageSize)
+        return false;
+
+    Shelf shelf;
+    shelf.y = page.nextShelfY;
+    shelf.height = height;
+    shelf.nextX = width;
+    page.shelves.push_back(shelf);
+    page.nextShelfY += height;
+
+    x = 0;
+    y = shelf.y;
+    return true;
+}
+
+int GlyphAtlas::allocateRegion(int width, int height, int &x, int &y)
+{
+    for (size_t i = 0; i < pages.size(); ++i)
+    {
+        if (allocateInPage(pages[i], width, height, x, y))
+            return int(i);
+    }
+
+    if (int(pages.size()) < maxPageCount)
+    {
+        if (!createPage())
+            return -1;
+        if (allocateInPage(pages.back(), width, height, x, y))
+            return int(pages.size() - 1);
+        return -1;
+    }
+
+    // Evict the least recently used page that is not referenced by a frame in flight.
+    int victim = -1;
+    for (size_t i = 0; i < pages.size(); ++i)
+    {
+        auto &page = pages[i];
+        if (page.lastUsedFrame + EvictionFrameLatency > currentFrame)
+            continue;
+        if (victim < 0 || page.lastUsedFrame < pages[victim].lastUsedFrame)
+            victim = int(i);
+    }
+
+    if (victim < 0)
+        return -1;
+
+    evictPage(pages[victim]);
+    if (allocateInPage(pages[victim], width, height, x, y))
+        return victim;
+    return -1;
+}
+
+void GlyphAtlas::evictPage(Page &page)
+{
+    // Retained drawing may reference the glyphs of this page.
+    CanvasDisplayList::invalidateAll();
+
+    for (auto key : page.glyphKeys)
+        glyphs.erase(key);
+    page.glyphKeys.clear();
+    page.shelves.clear();
+    page.nextShelfY = 0;
+
+    // There is room again for the glyphs that did not fit.
+    retryUnavailableGlyphs();
+}
+
+void GlyphAtlas::retryUnavailableGlyphs()
+{
+    for (auto key : retriedGlyphKeys)
+    {
+        auto it = glyphs.find(key);
+        if (it != glyphs.end() && it->second.page == GlyphAtlasEntry::UnavailablePage)
+            glyphs.erase(it);
+    }
+    retriedGlyphKeys.clear();
+}
+
+} // End of namespace GUI
+} // End of namespace Loden
@@ -1,5 +1,6 @@
 #include "Loden/GUI/Label.hpp"
 #include "Loden/Color.hpp"
+#include "Loden/GUI/TextLayout.hpp"
 
 namespace Loden
 {
@@ -7,11 +8,12 @@ namespace GUI
 {
 
 Label::Label(const SystemWindowPtr &systemWindow)
-    : BaseType(systemWindow)
+    : BaseType(systemWindow), wordWrap(false), paragraphLayoutDirty(true)
 {
     setForegroundColor(Colors::white());
     setBackgroundColor(Colors::transparent());
     setTextSize(12);
+    setRetainingDrawing(true);
 }
 
 Label::~Label()
@@ -29,7 +31,23 @@ LabelPtr Label::create(const SystemWindowPtr &systemWindow, const std::string &t
 
 glm::vec2 Label::getMinimalSize()
 {
-    return computeUtf8TextSize(text, textSize);
+    if (isMultiline())
+    {
+        auto &paragraph = getParagraphLayout();
+        return glm::vec2(paragraph.getWidth() + 10, paragraph.getHeight() + 10);
+    }
+
+    auto &layout = getTextLayout();
+    if (!layout)
+        return glm::vec2();
+    return layout->getSize();
+}
+
+const TextLayoutPtr &Label::getTextLayout()
+{
+    if (!textLayout)
+        textLayout = layoutUtf8Text(text, textSize);
+    return textLayout;
 }
 
 const std::string &Label::getText() const
@@ -40,6 +58,9 @@ const std::string &Label::getText() const
 void Label::setText(const std::string &newText)
 {
     text = newText;
+    textLayout.reset();
+    paragraphLayoutDirty = true;
+    invalidateDrawing();
 }
 
 int Label::getTextSize() const
@@ -50,6 +71,54 @@ int Label::getTextSize() const
 void Label::setTextSize(int newTextSize)
 {
     textSize = newTextSize;
+    textLayout.reset();
+    paragraphLayoutDirty = true;
+    invalidateDrawing();
+}
+
+bool Label::getWordWrap() const
+{
+    return wordWrap;
+}
+
+void Label::setWordWrap(bool newWordWrap)
+{
+    wordWrap = newWordWrap;
+    updateWrapWidth();
+    invalidateDrawing();
+}
+
+bool Label::isMultiline() const
+{
+    return wordWrap || text.find('\n') != std::string::npos;
+}
+
+ParagraphLayout &Label::getParagraphLayout()
+{
+    // The measurer needs the font, so the layout is only built when used.
+    if (paragraphLayoutDirty)
+    {
+        paragraphLayout.setText(std::string());
+        paragraphLayout.setMeasurer(makeUtf8TextMeasurer(textSize));
+        paragraphLayout.setLineHeight(textSize*LineSpacing);
+        paragraphLayout.setMaxWidth(getWrapWidth());
+        paragraphLayout.setText(text);
+        paragraphLayoutDirty = false;
+    }
+
+    return paragraphLayout;
+}
+
+float Label::getWrapWidth() const
+{
+    return wordWrap ? getWidth() - 10 : 0.0f;
+}
+
+void Label::updateWrapWidth()
+{
+    // A dirty layout takes the width when it is rebuilt.
+    if (!paragraphLayoutDirty)
+        paragraphLayout.setMaxWidth(getWrapWidth());
 }
 
 const glm::vec4 &Label::getForegroundColor()
@@ -60,6 +129,24 @@ const glm::vec4 &Label::getForegroundColor()
 void Label::setForegroundColor(const glm::vec4 &newForeground)
 {
     foregroundColor = newForeground;
+    invalidateDrawing();
+}
+
+const TextEffect &Label::getTextEffect() const
+{
+    return textEffect;
+}
+
+void Label::setTextEffect(const TextEffect &newTextEffect)
+{
+    textEffect = newTextEffect;
+    invalidateDrawing();
+}
+
+void Label::handleSizeChanged(SizeChangedEvent &event)
+{
+    updateWrapWidth();
+    BaseType::handleSizeChanged(event);
 }
 
 void Label::drawContentOn(Canvas *canvas)
@@ -72,7 +159,31 @@ void Label::drawContentOn(Canvas *canvas)
     }
 
     canvas->setColor(getForegroundColor());
-    canvas->drawText(text, textSize, glm::vec2(5, getHeight() - 5));
+    canvas->withTextEffect(textEffect, [&] {
+        if (isMultiline())
+            drawMultilineText(canvas);
+        else
+            canvas->drawTextLayout(getTextLayout(), glm::vec2(5, getHeight() - 5));
+    });
+}
+
+void Label::drawMultilineText(Canvas *canvas)
+{
+    auto &paragraph = getParagraphLayout();
+
+    auto lineHeight = paragraph.getLineHeight();
+    auto lineCount = paragraph.getLineCount();
+    auto &paragraphText = paragraph.getText();
+    for (size_t i = 0; i < lineCount; ++i)
+    {
+        auto baseline = 5 + textSize + i*lineHeight;
+        if (baseline - lineHeight > getHeight())
+            break;
+
+        auto line = paragraph.getLine(i);
+        if (line.end > line.start)
+            canvas->drawText(paragraphText.substr(line.start, line.end - line.start), textSize, glm::vec2(5, baseline));
+    }
 }
 
 } // End of namespace GUI
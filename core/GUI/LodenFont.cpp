@@ -16,6 +16,18 @@ namespace Loden
 namespace GUI
 {
 
+/**
+ * The glyph data that is used for laying out and drawing text. The
+ * rectangles are in base point size units, including the cell margin.
+ */
+struct LodenFontGlyph
+{
+    Rectangle sourceRectangle;
+    glm::vec2 offset;
+    glm::vec2 size;
+    float advance;
+};
+
 class LodenFontFace : public ObjectSubclass<LodenFontFace, FontFace>
 {
     LODEN_OBJECT_TYPE(LodenFontFace);
@@ -25,30 +37,40 @@ public:
 
     virtual void release();
 
-    virtual glm::vec2 drawCharacter(Canvas *canvas, int character, int pointSize, const glm::vec2 &position);
-    virtual glm::vec2 drawUtf8(Canvas *canvas, const std::string &text, int pointSize, const glm::vec2 &position);
-    virtual glm::vec2 drawUtf16(Canvas *canvas, const std::wstring &text, int pointSize, const glm::vec2 &position);
-
-    virtual Rectangle computeUtf8TextRectangle(const std::string &text, int pointSize);
-    virtual Rectangle computeUtf16TextRectangle(const std::wstring &text, int pointSize);
+    virtual void layoutCodePoints(TextLayout &layout, const uint32_t *codePoints, size_t count, int pointSize);
+    virtual void drawLayoutRun(Canvas *canvas, const TextLayout &layout, const TextLayoutRun &run, const glm::vec2 &position);
 
     bool read(FILE *in, Image::ImageBuffer *image);
 
 private:
+    static constexpr uint32_t CharMapPageBits = 8;
+    static constexpr uint32_t CharMapPageSize = 1 << CharMapPageBits;
+    static constexpr uint32_t CharMapPageCount = 0x10000 / CharMapPageSize;
+
     float computeScaleFactor(int pointSize);
-    int getGlyphForCharacter(int character);
+    uint32_t getGlyphForCharacter(uint32_t character);
+
+    void buildCharacterMap(const std::vector<LodenFontCharMapEntry> &entries);
+    void buildGlyphs(const std::vector<LodenFontGlyphMetadata> &glyphMetadata);
 
-    Rectangle computeSourceRectangle(LodenFontGlyphMetadata &glyph, float scaleFactor);
-    Rectangle computeDestinationRectangle(LodenFontGlyphMetadata &glyph, float scaleFactor, const glm::vec2 &position);
-    glm::vec2 drawNextCharacter(Canvas *canvas, int character, int previousCharacter, int pointSize, const glm::vec2 &position);
-    glm::vec2 appendCharacterBoundingBox(int character, int previousCharacter, int pointSize, const glm::vec2 &position, Rectangle &accumulatedBoundingBox);
+    Rectangle computeDestinationRectangle(const LodenFontGlyph &glyph, float scaleFactor, const glm::vec2 &position);
 
     Engine *engine;
 
     float basePointSize;
     bool isSignedDistanceField;
-    std::vector<LodenFontGlyphMetadata> glyphData;
-    std::unordered_map<uint32_t, uint32_t> characterMap;
+
+    // The glyph data that is read for every character. The file metadata
+    // is only used for building it.
+    std::vector<LodenFontGlyph> glyphs;
+
+    // The basic multilingual plane is mapped with a two level table. The
+    // page table holds offsets of 256 entry pages, and the page at offset
+    // zero is the shared empty page. The other planes use a hash table.
+    uint32_t charMapPageTable[CharMapPageCount];
+    std::vector<uint32_t> charMapPages;
+    std::unordered_map<uint32_t, uint32_t> astralCharacterMap;
+
     TexturePtr texture;
     agpu_shader_resource_binding_ref textureBinding;
     glm::vec2 texcoordScale;
@@ -73,102 +95,98 @@ float LodenFontFace::computeScaleFactor(int pointSize)
     return float(pointSize) / basePointSize;
 }
 
-int LodenFontFace::getGlyphForCharacter(int character)
+uint32_t LodenFontFace::getGlyphForCharacter(uint32_t character)
 {
-    auto it = characterMap.find(character);
-    if (it != characterMap.end())
+    if (character < 0x10000)
+        return charMapPages[charMapPageTable[character >> CharMapPageBits] + (character & (CharMapPageSize - 1))];
+
+    auto it = astralCharacterMap.find(character);
+    if (it != astralCharacterMap.end())
         return it->second;
     return 0;
 }
 
-Rectangle LodenFontFace::computeSourceRectangle(LodenFontGlyphMetadata &glyph, float scaleFactor)
-{
-    return Rectangle((glyph.min - marginSize)*texcoordScale, (glyph.max + marginSize)*texcoordScale);
-}
-
-Rectangle LodenFontFace::computeDestinationRectangle(LodenFontGlyphMetadata &glyph, float scaleFactor, const glm::vec2 &position)
-{
-    glm::vec2 drawPosition = position + glm::vec2(glyph.horizontalBearing.x - marginSize, -glyph.horizontalBearing.y - marginSize) *scaleFactor;
-    auto size = (glyph.max - glyph.min + marginSize*2)*scaleFactor;
-    return Rectangle(drawPosition, drawPosition + size);
-}
-
-glm::vec2 LodenFontFace::drawNextCharacter(Canvas *canvas, int character, int previousCharacter, int pointSize, const glm::vec2 &position)
-{
-    auto &glyph = glyphData[getGlyphForCharacter(character)];
-
-    auto scaleFactor = computeScaleFactor(pointSize);
-    //printf("Scale factor: %f\n", scaleFactor);
-
-    Rectangle source = computeSourceRectangle(glyph, scaleFactor);
-    Rectangle dest = computeDestinationRectangle(glyph, scaleFactor, position);
-
-    // Draw the character
-    canvas->drawBitmapCharacter(dest, source);
-
-    return position + glm::vec2(glyph.advance.x*scaleFactor, 0);
-}
-
-glm::vec2 LodenFontFace::appendCharacterBoundingBox(int character, int previousCharacter, int pointSize, const glm::vec2 &position, Rectangle &accumulatedBoundingBox)
+void LodenFontFace::buildCharacterMap(const std::vector<LodenFontCharMapEntry> &entries)
 {
-    auto &glyph = glyphData[getGlyphForCharacter(character)];
-    auto scaleFactor = computeScaleFactor(pointSize);
-
-    Rectangle rect = computeDestinationRectangle(glyph, scaleFactor, position);
-    accumulatedBoundingBox.insertRectangle(rect);
+    for (auto &offset : charMapPageTable)
+        offset = 0;
+    charMapPages.assign(CharMapPageSize, 0);
 
-    return position + glm::vec2(glyph.advance.x*scaleFactor, 0);
-}
-
-glm::vec2 LodenFontFace::drawCharacter(Canvas *canvas, int character, int pointSize, const glm::vec2 &position)
-{
-    canvas->beginBitmapTextDrawing(textureBinding.get(), isSignedDistanceField);
-    auto result = drawNextCharacter(canvas, character, -1, pointSize, position);
-    canvas->endBitmapTextDrawing();
-    return result;
+    for (auto &entry : entries)
+    {
+        if (entry.character < 0 || entry.glyph < 0 || size_t(entry.glyph) >= glyphs.size())
+            continue;
+
+        auto character = uint32_t(entry.character);
+        coverage.insert(character);
+        if (character >= 0x10000)
+        {
+            astralCharacterMap.insert(std::make_pair(character, uint32_t(entry.glyph)));
+            continue;
+        }
+
+        auto &pageOffset = charMapPageTable[character >> CharMapPageBits];
+        if (pageOffset == 0)
+        {
+            pageOffset = uint32_t(charMapPages.size());
+            charMapPages.resize(charMapPages.size() + CharMapPageSize, 0);
+        }
+
+        charMapPages[pageOffset + (character & (CharMapPageSize - 1))] = uint32_t(entry.glyph);
+    }
 }
 
-glm::vec2 LodenFontFace::drawUtf8(Canvas *canvas, const std::string &text, int pointSize, const glm::vec2 &position)
+void LodenFontFace::buildGlyphs(const std::vector<LodenFontGlyphMetadata> &glyphMetadata)
 {
-    // TODO: Decode the UTF-8 character
-    auto currentPosition = position;
-    //printf("Draw text %s\n", text.c_str());
-    canvas->beginBitmapTextDrawing(textureBinding.get(), isSignedDistanceField);
-    int previousCharacter = -1;
-    for (size_t i = 0; i < text.size(); ++i)
+    glyphs.resize(glyphMetadata.size());
+    for (size_t i = 0; i < glyphMetadata.size(); ++i)
     {
-        int character = text[i];
-        currentPosition = drawNextCharacter(canvas, character, previousCharacter, pointSize, currentPosition);
-        previousCharacter = character;
+        auto &metadata = glyphMetadata[i];
+        auto &glyph = glyphs[i];
+        glyph.sourceRectangle = Rectangle((metadata.min - marginSize)*texcoordScale, (metadata.max + marginSize)*texcoordScale);
+        glyph.offset = glm::vec2(metadata.horizontalBearing.x - marginSize, -metadata.horizontalBearing.y - marginSize);
+        glyph.size = metadata.max - metadata.min + marginSize*2;
+        glyph.advance = metadata.advance.x;
     }
-    canvas->endBitmapTextDrawing();
-
-    return currentPosition;
 }
 
-glm::vec2 LodenFontFace::drawUtf16(Canvas *canvas, const std::wstring &text, int pointSize, const glm::vec2 &position)
+Rectangle LodenFontFace::computeDestinationRectangle(const LodenFontGlyph &glyph, float scaleFactor, const glm::vec2 &position)
 {
-    return position;
+    glm::vec2 drawPosition = position + glyph.offset*scaleFactor;
+    return Rectangle(drawPosition, drawPosition + glyph.size*scaleFactor);
 }
 
-Rectangle LodenFontFace::computeUtf8TextRectangle(const std::string &text, int pointSize)
+void LodenFontFace::layoutCodePoints(TextLayout &layout, const uint32_t *codePoints, size_t count, int pointSize)
 {
-    int previousCharacter = -1;
-    glm::vec2 currentPosition(0);
-    Rectangle boundingBox(glm::vec2(0, 0), glm::vec2(0, 0));
-    for (size_t i = 0; i < text.size(); ++i)
+    auto scaleFactor = computeScaleFactor(pointSize);
+    auto pen = layout.getAdvance();
+    layout.beginRun(this, pointSize);
+    for (size_t i = 0; i < count; ++i)
     {
-        int character = text[i];
-        currentPosition = appendCharacterBoundingBox(character, previousCharacter, pointSize, currentPosition, boundingBox);
-        previousCharacter = character;
+        auto glyphIndex = getGlyphForCharacter(codePoints[i]);
+        auto &glyph = glyphs[glyphIndex];
+        layout.addGlyph(glyphIndex, pen, computeDestinationRectangle(glyph, scaleFactor, pen));
+        pen.x += glyph.advance*scaleFactor;
     }
-
-    return boundingBox;
+    layout.endRun(pen);
 }
 
-Rectangle LodenFontFace::computeUtf16TextRectangle(const std::wstring &text, int pointSize)
+void LodenFontFace::drawLayoutRun(Canvas *canvas, const TextLayout &layout, const TextLayoutRun &run, const glm::vec2 &position)
 {
-    return Rectangle();
+    auto scaleFactor = computeScaleFactor(run.pointSize);
+    auto layoutGlyphs = &layout.getGlyphs()[run.firstGlyph];
+
+    // Submit the whole run at once. The glyph array is reused between
+    // runs, to avoid allocating while drawing.
+    static thread_local std::vector<CanvasGlyph> runGlyphs;
+    runGlyphs.resize(run.glyphCount);
+    for (size_t i = 0; i < run.glyphCount; ++i)
+    {
+        auto &glyph = glyphs[layoutGlyphs[i].glyph];
+        runGlyphs[i].destRectangle = computeDestinationRectangle(glyph, scaleFactor, position + layoutGlyphs[i].position);
+        runGlyphs[i].sourceRectangle = glyph.sourceRectangle;
+    }
+    canvas->drawGlyphRun(textureBinding.get(), isSignedDistanceField, runGlyphs.data(), runGlyphs.size());
 }
 
 bool LodenFontFace::read(FILE *in, Image::ImageBuffer *image)
@@ -189,8 +207,11 @@ bool LodenFontFace::read(FILE *in, Image::ImageBuffer *image)
     marginSize = std::max(0, int(header.cellMargin) - 1);
 
     // Read the glyph metadata.
-    glyphData.resize(header.numberOfGlyphs);
-    if (fread(&glyphData[0], sizeof(LodenFontGlyphMetadata), glyphData.size(), in) != glyphData.size())
+    if (header.numberOfGlyphs == 0)
+        return false;
+
+    std::vector<LodenFontGlyphMetadata> glyphMetadata(header.numberOfGlyphs);
+    if (fread(&glyphMetadata[0], sizeof(LodenFontGlyphMetadata), glyphMetadata.size(), in) != glyphMetadata.size())
         return false;
 
     // Read the character map
@@ -198,10 +219,10 @@ bool LodenFontFace::read(FILE *in, Image::ImageBuffer *image)
     if (fread(&charMapEntries[0], sizeof(LodenFontCharMapEntry), charMapEntries.size(), in) != charMapEntries.size())
         return false;
 
-    // Insert the character map entries into the hash table.
-    characterMap.reserve(charMapEntries.size());
-    for (auto &entry : charMapEntries)
-        characterMap.insert(std::make_pair(entry.character, entry.glyph));
+    // Build the glyph data, and the character map tables.
+    texcoordScale = glm::vec2(1.0f / image->getWidth(), 1.0f / image->getHeight());
+    buildGlyphs(glyphMetadata);
+    buildCharacterMap(charMapEntries);
 
     // Create the texture for the image.
     auto format = isSignedDistanceField ? AGPU_TEXTURE_FORMAT_R8_SNORM : AGPU_TEXTURE_FORMAT_R8_UNORM;
@@ -220,9 +241,6 @@ bool LodenFontFace::read(FILE *in, Image::ImageBuffer *image)
 
     // Bind the texture.
     textureBinding->bindTexture(0, texture->getHandle().get(), 0, -1, 0.0);
-
-    // Compute the texcoord scale factor
-    texcoordScale = glm::vec2(1.0f / image->getWidth(), 1.0f / image->getHeight());
     return true;
 }
 
@@ -2,6 +2,7 @@
 #include "Loden/GUI/Menu.hpp"
 #include "Loden/GUI/MenuBar.hpp"
 #include "Loden/Color.hpp"
+#include "Loden/GUI/TextLayout.hpp"
 
 namespace Loden
 {
@@ -44,6 +45,7 @@ const std::string &MenuItem::getText() const
 void MenuItem::setText(const std::string &newText)
 {
     text = newText;
+    textLayout.reset();
 }
 
 const MenuPtr &MenuItem::getMenu() const
@@ -76,7 +78,7 @@ void MenuItem::drawContentOnMenuBar(MenuBar *menuBar, Canvas *canvas)
     }
 
     canvas->setColor(Colors::white());
-    canvas->drawText(text, 14, glm::vec2(BorderSize, BorderSize + textSize.y + (height - BorderSize * 2 - textSize.y) / 2 ));
+    canvas->drawTextLayout(textLayout, glm::vec2(BorderSize, BorderSize + textSize.y + (height - BorderSize * 2 - textSize.y) / 2 ));
 }
 
 void MenuItem::drawContentOnMenu(Menu *menu, Canvas *canvas)
@@ -89,18 +91,20 @@ void MenuItem::drawContentOnMenu(Menu *menu, Canvas *canvas)
     }
 
     canvas->setColor(Colors::white());
-    canvas->drawText(text, 14, glm::vec2(BorderSize, BorderSize + textSize.y));
+    canvas->drawTextLayout(textLayout, glm::vec2(BorderSize, BorderSize + textSize.y));
 }
 
 void MenuItem::addedToMenuBar(const MenuBarPtr &menuBar)
 {
-    textSize = menuBar->computeUtf8TextSize(text, 14);
+    textLayout = menuBar->layoutUtf8Text(text, TextSize);
+    textSize = textLayout ? textLayout->getSize() : glm::vec2();
     size = glm::vec2(textSize.x + BorderSize * 2, textSize.y);
 }
 
 void MenuItem::addedToMenu(const MenuPtr &menu)
 {
-    textSize = menu->computeUtf8TextSize(text, 14);
+    textLayout = menu->layoutUtf8Text(text, TextSize);
+    textSize = textLayout ? textLayout->getSize() : glm::vec2();
     size = glm::vec2(textSize.x + BorderSize * 2, textSize.y + BorderSize * 2);
 }
 
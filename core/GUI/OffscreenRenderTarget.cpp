@@ -0,0 +1,303 @@
+#include "Loden/GUI/OffscreenRenderTarget.hpp"
+#include "Loden/GUI/AgpuCanvas.hpp"
+#include "Loden/GUI/FontManager.hpp"
+#include "Loden/GUI/Widget.hpp"
+#include "Loden/Matrices.hpp"
+#include "Loden/PipelineStateManager.hpp"
+#include "Loden/Printing.hpp"
+#include "Loden/Settings.hpp"
+#include "Loden/TransformationBlock.hpp"
+#include <algorithm>
+#include <string.h>
+
+namespace Loden
+{
+namespace GUI
+{
+
+OffscreenRenderTarget::OffscreenRenderTarget()
+{
+    width = 0;
+    height = 0;
+    transformationBlockData = nullptr;
+    sampleCount = 1;
+    sampleQuality = 0;
+    hasInvertedY = false;
+}
+
+OffscreenRenderTarget::~OffscreenRenderTarget()
+{
+}
+
+OffscreenRenderTargetPtr OffscreenRenderTarget::create(const EnginePtr &engine, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+    {
+        printError("Invalid offscreen render target extent %dx%d\n", width, height);
+        return nullptr;
+    }
+
+    // Use the same multisampling as the system windows.
+    auto &settings = engine->getSettings();
+    auto target = OffscreenRenderTargetPtr(new OffscreenRenderTarget());
+    target->engine = engine;
+    target->width = width;
+    target->height = height;
+    target->device = engine->getAgpuDevice();
+    target->commandQueue = engine->getGraphicsCommandQueue();
+    target->sampleCount = std::max(1, settings->getIntValue("Rendering", "SampleCount", 1));
+    target->sampleQuality = settings->getIntValue("Rendering", "SampleQuality", 0);
+    target->hasInvertedY = target->device->hasTopLeftNdcOrigin();
+
+    if (!target->initialize())
+        return nullptr;
+
+    return target;
+}
+
+agpu_texture_ref OffscreenRenderTarget::createRenderTexture(agpu_texture_format format, agpu_texture_flags flags, unsigned int samples, unsigned int quality)
+{
+    agpu_texture_description desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.type = AGPU_TEXTURE_2D;
+    desc.width = width;
+    desc.height = height;
+    desc.depthOrArraySize = 1;
+    desc.format = format;
+    desc.flags = flags;
+    desc.miplevels = 1;
+    desc.sample_count = samples;
+    desc.sample_quality = quality;
+    return device->createTexture(&desc);
+}
+
+bool OffscreenRenderTarget::initialize()
+{
+    // Create the transformation buffer.
+    {
+        agpu_buffer_description desc;
+        desc.size = TransformationBlock_AlignedSize;
+        desc.usage = AGPU_DYNAMIC;
+        desc.binding = AGPU_UNIFORM_BUFFER;
+        desc.mapping_flags = AGPU_MAP_WRITE_BIT | AGPU_MAP_PERSISTENT_BIT | AGPU_MAP_COHERENT_BIT;
+        desc.stride = 0;
+        transformationBuffer = device->createBuffer(&desc, nullptr);
+        if (!transformationBuffer)
+        {
+            printError("Failed to create an uniform buffer object.\n");
+            return false;
+        }
+
+        transformationBlockData = (uint8_t*)transformationBuffer->mapBuffer(AGPU_WRITE_ONLY);
+        if (!transformationBlockData)
+        {
+            printError("Failed to map an uniform buffer object.\n");
+            return false;
+        }
+    }
+
+    // Get the gui shader signature.
+    auto &pipelineStateManager = engine->getPipelineStateManager();
+    shaderSignature = pipelineStateManager->getShaderSignature("GUI");
+    if (!shaderSignature)
+    {
+        printError("Failed to retrieve the GUI shader signature.\n");
+        return false;
+    }
+
+    // The color buffer is read back, so it cannot be a render buffer.
+    agpu_texture_view_description colorViewDesc;
+    agpu_texture_view_description depthStencilViewDesc;
+    colorbuffer = createRenderTexture(AGPU_TEXTURE_FORMAT_B8G8R8A8_UNORM, agpu_texture_flags(AGPU_TEXTURE_FLAG_RENDER_TARGET | AGPU_TEXTURE_FLAG_READED_BACK), 1, 0);
+    if (!colorbuffer)
+    {
+        printError("Failed to create the offscreen color buffer.\n");
+        return false;
+    }
+    colorbuffer->getFullViewDescription(&colorViewDesc);
+
+    auto depthStencilBuffer = createRenderTexture(AGPU_TEXTURE_FORMAT_D24_UNORM_S8_UINT, agpu_texture_flags(AGPU_TEXTURE_FLAG_DEPTH | AGPU_TEXTURE_FLAG_STENCIL | AGPU_TEXTURE_FLAG_RENDERBUFFER_ONLY), sampleCount, sampleQuality);
+    if (!depthStencilBuffer)
+    {
+        printError("Failed to create the offscreen depth stencil buffer.\n");
+        return false;
+    }
+    depthStencilBuffer->getFullViewDescription(&depthStencilViewDesc);
+
+    // With multisampling, draw into a multisample buffer and resolve it into the color buffer.
+    if (sampleCount > 1)
+    {
+        auto multisampleColorbuffer = createRenderTexture(AGPU_TEXTURE_FORMAT_B8G8R8A8_UNORM, agpu_texture_flags(AGPU_TEXTURE_FLAG_RENDER_TARGET | AGPU_TEXTURE_FLAG_RENDERBUFFER_ONLY), sampleCount, sampleQuality);
+        if (!multisampleColorbuffer)
+        {
+            printError("Failed to create the offscreen multisample color buffer.\n");
+            return false;
+        }
+
+        agpu_texture_view_description multisampleColorViewDesc;
+        multisampleColorbuffer->getFullViewDescription(&multisampleColorViewDesc);
+        multisampleFramebuffer = device->createFrameBuffer(width, height, 1, &multisampleColorViewDesc, &depthStencilViewDesc);
+        framebuffer = device->createFrameBuffer(width, height, 1, &colorViewDesc, nullptr);
+    }
+    else
+    {
+        framebuffer = device->createFrameBuffer(width, height, 1, &colorViewDesc, &depthStencilViewDesc);
+    }
+
+    if (!framebuffer || (sampleCount > 1 && !multisampleFramebuffer))
+    {
+        printError("Failed to create the offscreen framebuffer.\n");
+        return false;
+    }
+
+    // Create the render pass.
+    agpu_renderpass_color_attachment_description colorAttachment;
+    memset(&colorAttachment, 0, sizeof(colorAttachment));
+    colorAttachment.format = AGPU_TEXTURE_FORMAT_B8G8R8A8_UNORM;
+    colorAttachment.begin_action = AGPU_ATTACHMENT_CLEAR;
+    colorAttachment.end_action = AGPU_ATTACHMENT_KEEP;
+
+    agpu_renderpass_depth_stencil_description depthStencil;
+    memset(&depthStencil, 0, sizeof(depthStencil));
+    depthStencil.format = AGPU_TEXTURE_FORMAT_D24_UNORM_S8_UINT;
+    depthStencil.begin_action = AGPU_ATTACHMENT_CLEAR;
+    depthStencil.end_action = AGPU_ATTACHMENT_KEEP;
+    depthStencil.clear_value.depth = 1.0;
+
+    agpu_renderpass_description renderpassDescription;
+    memset(&renderpassDescription, 0, sizeof(renderpassDescription));
+    renderpassDescription.color_attachment_count = 1;
+    renderpassDescription.color_attachments = &colorAttachment;
+    renderpassDescription.depth_stencil_attachment = &depthStencil;
+    renderpass = device->createRenderPass(&renderpassDescription);
+    if (!renderpass)
+    {
+        printError("Failed to create the offscreen render pass.\n");
+        return false;
+    }
+
+    // Create the command list.
+    commandAllocator = device->createCommandAllocator(AGPU_COMMAND_LIST_TYPE_DIRECT, commandQueue.get());
+    if (!commandAllocator)
+    {
+        printError("Failed to create a command allocator.\n");
+        return false;
+    }
+
+    commandList = device->createCommandList(AGPU_COMMAND_LIST_TYPE_DIRECT, commandAllocator.get(), nullptr);
+    if (!commandList)
+    {
+        printError("Failed to create a command list.\n");
+        return false;
+    }
+    commandList->close();
+
+    fence = device->createFence();
+    if (!fence)
+    {
+        printError("Failed to create a fence.\n");
+        return false;
+    }
+
+    // Every render waits for the GPU, so a single canvas is enough.
+    canvasRingBuffers = AgpuCanvasRingBuffers::create(device);
+    if (!canvasRingBuffers)
+    {
+        printError("Failed to create the canvas ring buffers.\n");
+        return false;
+    }
+
+    canvas = AgpuCanvas::create(pipelineStateManager, canvasRingBuffers, false);
+    if (!canvas)
+    {
+        printError("Failed to create the offscreen canvas.\n");
+        return false;
+    }
+
+    globalShaderBinding = shaderSignature->createShaderResourceBinding(0);
+    if (!globalShaderBinding)
+    {
+        printError("Failed to create GUI shader resource binding\n");
+        return false;
+    }
+    globalShaderBinding->bindUniformBufferRange(0, transformationBuffer.get(), 0, TransformationBlock_AlignedSize);
+
+    return true;
+}
+
+bool OffscreenRenderTarget::render(Widget *widget)
+{
+    if (!widget)
+        return false;
+
+    return render([widget] (Canvas *canvas) {
+        widget->drawOn(canvas);
+    });
+}
+
+bool OffscreenRenderTarget::render(const DrawFunction &drawFunction)
+{
+    // Fill the canvas.
+    engine->getFontManager()->beginFrame();
+    canvas->setViewportSize(width, height);
+    canvas->reset();
+    drawFunction(canvas.get());
+    canvas->close();
+
+    // Compute the projection matrix
+    auto transformationBlock = reinterpret_cast<TransformationBlock*> (transformationBlockData);
+    transformationBlock->projectionMatrix = orthographicMatrix(0.0f, (float)width, (float)height, 0.0f, -2.0f, 2.0f, hasInvertedY);
+    transformationBlock->modelMatrix = glm::mat4();
+    transformationBlock->viewMatrix = glm::mat4();
+
+    // Build the command list
+    commandAllocator->reset();
+    commandList->reset(commandAllocator.get(), nullptr);
+    commandList->setShaderSignature(shaderSignature.get());
+    if (multisampleFramebuffer)
+        commandList->beginRenderPass(renderpass.get(), multisampleFramebuffer.get(), false);
+    else
+        commandList->beginRenderPass(renderpass.get(), framebuffer.get(), false);
+
+    commandList->setViewport(0, 0, width, height);
+    commandList->setScissor(0, 0, width, height);
+    commandList->useShaderResources(globalShaderBinding.get());
+    canvas->emitCommandsInto(commandList);
+    commandList->endRenderPass();
+
+    if (multisampleFramebuffer)
+        commandList->resolveFramebuffer(framebuffer.get(), multisampleFramebuffer.get());
+
+    commandList->close();
+
+    // Submit and wait, so the canvas and the color buffer can be used again.
+    commandQueue->addCommandList(commandList.get());
+    canvasRingBuffers->endFrame(fence);
+    commandQueue->signalFence(fence.get());
+    fence->waitOnClient();
+    return true;
+}
+
+Image::ImageBufferPtr OffscreenRenderTarget::readImage()
+{
+    auto pitch = width*4;
+    auto image = std::make_shared<Image::LocalImageBuffer> (width, height, 32, pitch);
+    colorbuffer->readTextureData(0, 0, pitch, pitch*height, image->get());
+
+    // The rows come bottom-up when the device has the OpenGL conventions.
+    auto data = image->get();
+    if (!hasInvertedY)
+    {
+        for (int y = 0; y < height / 2; ++y)
+            std::swap_ranges(data + y*pitch, data + (y + 1)*pitch, data + (height - y - 1)*pitch);
+    }
+
+    // Convert from BGRA into RGBA.
+    for (int i = 0; i < width*height; ++i)
+        std::swap(data[i*4], data[i*4 + 2]);
+
+    return image;
+}
+
+} // End of namespace GUI
+} // End of namespace Loden
@@ -0,0 +1,435 @@
+#include "Loden/GUI/ParagraphLayout.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace Loden
+{
+namespace GUI
+{
+
+static inline bool isLayoutSpace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+ParagraphLayout::ParagraphLayout()
+    : maxWidth(0.0f), lineHeight(16.0f), lineBreakMode(LineBreakMode::Greedy), lineCount(0), indicesDirty(true), measureCount(0), brokenLineCount(0)
+{
+    setText(std::string());
+}
+
+ParagraphLayout::~ParagraphLayout()
+{
+}
+
+void ParagraphLayout::setMeasurer(const Measurer &newMeasurer)
+{
+    measurer = newMeasurer;
+    setText(text);
+}
+
+void ParagraphLayout::setMaxWidth(float newMaxWidth)
+{
+    if (maxWidth == newMaxWidth)
+        return;
+
+    maxWidth = newMaxWidth;
+    relayoutAll();
+}
+
+void ParagraphLayout::setLineBreakMode(LineBreakMode newLineBreakMode)
+{
+    if (lineBreakMode == newLineBreakMode)
+        return;
+
+    lineBreakMode = newLineBreakMode;
+    relayoutAll();
+}
+
+void ParagraphLayout::setText(const std::string &newText)
+{
+    text = newText;
+    paragraphs.clear();
+    rebuildParagraphs(0, 0, 0, text.size());
+}
+
+void ParagraphLayout::replaceText(size_t offset, size_t removedSize, const std::string &insertedText)
+{
+    offset = std::min(offset, text.size());
+    removedSize = std::min(removedSize, text.size() - offset);
+    if (removedSize == 0 && insertedText.empty())
+        return;
+
+    updateIndices();
+    auto firstParagraph = findParagraph(offset);
+    auto lastParagraph = findParagraph(offset + removedSize);
+    text.replace(offset, removedSize, insertedText);
+
+    // Edits inside of a paragraph are laid out incrementally.
+    if (firstParagraph == lastParagraph && insertedText.find('\n') == std::string::npos)
+    {
+        auto &paragraph = paragraphs[firstParagraph];
+        paragraph.size = paragraph.size + insertedText.size() - removedSize;
+        editParagraph(paragraph, offset - paragraph.start, removedSize, insertedText.size());
+        indicesDirty = true;
+        return;
+    }
+
+    // Edits that add or remove line feeds rebuild the paragraphs that they touch.
+    auto &first = paragraphs[firstParagraph];
+    auto &last = paragraphs[lastParagraph];
+    auto start = first.start;
+    auto end = last.start + last.size + insertedText.size() - removedSize;
+    rebuildParagraphs(firstParagraph, lastParagraph + 1, start, end);
+}
+
+void ParagraphLayout::insertText(size_t offset, const std::string &insertedText)
+{
+    replaceText(offset, 0, insertedText);
+}
+
+void ParagraphLayout::eraseText(size_t offset, size_t size)
+{
+    replaceText(offset, size, std::string());
+}
+
+size_t ParagraphLayout::getLineCount()
+{
+    updateIndices();
+    return lineCount;
+}
+
+ParagraphLine ParagraphLayout::getLine(size_t index)
+{
+    updateIndices();
+    ParagraphLine result;
+    result.start = result.end = text.size();
+    result.width = 0.0f;
+    if (index >= lineCount)
+        return result;
+
+    auto it = std::upper_bound(paragraphs.begin(), paragraphs.end(), index, [](size_t lineIndex, const Paragraph &paragraph) {
+        return lineIndex < paragraph.firstLine;
+    });
+    auto &paragraph = *(it - 1);
+    auto &line = paragraph.lines[index - paragraph.firstLine];
+
+    result.width = line.width;
+    if (line.wordCount == 0)
+    {
+        result.start = result.end = paragraph.start;
+        return result;
+    }
+
+    result.start = paragraph.start + paragraph.words[line.firstWord].start;
+    result.end = paragraph.start + paragraph.words[line.firstWord + line.wordCount - 1].end;
+    return result;
+}
+
+size_t ParagraphLayout::findLineForOffset(size_t offset)
+{
+    updateIndices();
+    auto &paragraph = paragraphs[findParagraph(std::min(offset, text.size()))];
+    auto relativeOffset = offset - paragraph.start;
+
+    // Find the last line that starts before the offset.
+    auto it = std::upper_bound(paragraph.lines.begin(), paragraph.lines.end(), relativeOffset, [&](size_t value, const Line &line) {
+        return line.wordCount > 0 && value < paragraph.words[line.firstWord].start;
+    });
+
+    size_t lineIndex = it - paragraph.lines.begin();
+    return paragraph.firstLine + (lineIndex > 0 ? lineIndex - 1 : 0);
+}
+
+float ParagraphLayout::getWidth()
+{
+    float result = 0.0f;
+    for (auto &paragraph : paragraphs)
+    {
+        for (auto &line : paragraph.lines)
+            result = std::max(result, line.width);
+    }
+
+    return result;
+}
+
+float ParagraphLayout::getHeight()
+{
+    return getLineCount()*lineHeight;
+}
+
+float ParagraphLayout::measure(const char *string, size_t size)
+{
+    if (size == 0 || !measurer)
+        return 0.0f;
+
+    ++measureCount;
+    return measurer(string, size);
+}
+
+void ParagraphLayout::tokenize(Paragraph &paragraph, size_t relativeStart, size_t relativeEnd, std::vector<Word> &words)
+{
+    auto paragraphText = text.data() + paragraph.start;
+    auto position = relativeStart;
+    while (position < relativeEnd)
+    {
+        Word word;
+        word.start = uint32_t(position);
+        while (position < relativeEnd && !isLayoutSpace(paragraphText[position]))
+            ++position;
+        word.end = uint32_t(position);
+
+        while (position < relativeEnd && isLayoutSpace(paragraphText[position]))
+            ++position;
+        word.spaceEnd = uint32_t(position);
+
+        word.width = measure(paragraphText + word.start, word.end - word.start);
+        word.spaceWidth = measure(paragraphText + word.end, word.spaceEnd - word.end);
+        words.push_back(word);
+    }
+}
+
+ParagraphLayout::Paragraph ParagraphLayout::makeParagraph(size_t start, size_t size)
+{
+    Paragraph paragraph;
+    paragraph.start = start;
+    paragraph.size = size;
+    paragraph.firstLine = 0;
+    tokenize(paragraph, 0, size, paragraph.words);
+    breakLines(paragraph);
+    return paragraph;
+}
+
+void ParagraphLayout::breakLines(Paragraph &paragraph)
+{
+    if (lineBreakMode == LineBreakMode::Optimal)
+        breakLinesOptimal(paragraph);
+    else
+        breakLinesGreedy(paragraph, 0, 0, std::vector<Line> (), 0, std::numeric_limits<size_t>::max());
+}
+
+void ParagraphLayout::breakLinesGreedy(Paragraph &paragraph, size_t firstLine, size_t firstWord, const std::vector<Line> &oldLines, size_t oldSuffixWord, size_t newSuffixWord)
+{
+    auto &words = paragraph.words;
+    auto &lines = paragraph.lines;
+    lines.resize(std::min(firstLine, lines.size()));
+
+    auto wordCount = words.size();
+    if (wordCount == 0)
+    {
+        Line line = { 0, 0, 0.0f };
+        lines.push_back(line);
+        ++brokenLineCount;
+        return;
+    }
+
+    size_t oldLineIndex = 0;
+    auto word = firstWord;
+    while (word < wordCount)
+    {
+        // Once a line starts at the same word as before the edit, the
+        // remaining lines are the same.
+        if (word >= newSuffixWord)
+        {
+            auto oldWord = word - newSuffixWord + oldSuffixWord;
+            while (oldLineIndex < oldLines.size() && oldLines[oldLineIndex].firstWord < oldWord)
+                ++oldLineIndex;
+
+            if (oldLineIndex < oldLines.size() && oldLines[oldLineIndex].firstWord == oldWord)
+            {
+                for (; oldLineIndex < oldLines.size(); ++oldLineIndex)
+                {
+                    auto line = oldLines[oldLineIndex];
+                    line.firstWord = uint32_t(line.firstWord - oldSuffixWord + newSuffixWord);
+                    lines.push_back(line);
+                }
+                return;
+            }
+        }
+
+        Line line;
+        line.firstWord = uint32_t(word);
+        line.width = words[word].width;
+        ++word;
+
+        while (word < wordCount)
+        {
+            auto newWidth = line.width + words[word - 1].spaceWidth + words[word].width;
+            if (maxWidth > 0.0f && newWidth > maxWidth)
+                break;
+
+            line.width = newWidth;
+            ++word;
+        }
+
+        line.wordCount = uint32_t(word - line.firstWord);
+        lines.push_back(line);
+        ++brokenLineCount;
+    }
+}
+
+void ParagraphLayout::breakLinesOptimal(Paragraph &paragraph)
+{
+    auto &words = paragraph.words;
+    auto wordCount = words.size();
+    if (wordCount == 0 || maxWidth <= 0.0f)
+    {
+        breakLinesGreedy(paragraph, 0, 0, std::vector<Line> (), 0, std::numeric_limits<size_t>::max());
+        return;
+    }
+
+    // The cost of a break is the squared slack of the line. The last line
+    // is free, and overlong words are placed on their own line.
+    std::vector<double> costs(wordCount + 1, 0.0);
+    std::vector<size_t> nextBreaks(wordCount + 1, wordCount);
+    for (size_t i = wordCount; i-- > 0; )
+    {
+        auto bestCost = std::numeric_limits<double>::infinity();
+        double width = 0.0;
+        for (size_t j = i; j < wordCount; ++j)
+        {
+            width += (j > i ? words[j - 1].spaceWidth : 0.0f) + words[j].width;
+            if (width > maxWidth && j > i)
+                break;
+
+            auto slack = std::max(0.0, maxWidth - width);
+            auto lineCost = j + 1 == wordCount ? 0.0 : slack*slack;
+            auto cost = lineCost + costs[j + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                nextBreaks[i] = j + 1;
+            }
+        }
+
+        costs[i] = bestCost;
+    }
+
+    auto &lines = paragraph.lines;
+    lines.clear();
+    for (size_t word = 0; word < wordCount; word = nextBreaks[word])
+    {
+        Line line;
+        line.firstWord = uint32_t(word);
+        line.wordCount = uint32_t(nextBreaks[word] - word);
+        line.width = words[word].width;
+        for (size_t i = word + 1; i < nextBreaks[word]; ++i)
+            line.width += words[i - 1].spaceWidth + words[i].width;
+        lines.push_back(line);
+        ++brokenLineCount;
+    }
+}
+
+void ParagraphLayout::editParagraph(Paragraph &paragraph, size_t relativeOffset, size_t removedSize, size_t insertedSize)
+{
+    std::vector<Word> oldWords;
+    oldWords.swap(paragraph.words);
+
+    // Keep the words that are strictly before and after the edited range.
+    size_t prefixCount = 0;
+    while (prefixCount < oldWords.size() && oldWords[prefixCount].spaceEnd < relativeOffset)
+        ++prefixCount;
+
+    auto suffixStart = prefixCount;
+    while (suffixStart < oldWords.size() && oldWords[suffixStart].start <= relativeOffset + removedSize)
+        ++suffixStart;
+
+    auto delta = int64_t(insertedSize) - int64_t(removedSize);
+    auto middleStart = prefixCount > 0 ? size_t(oldWords[prefixCount - 1].spaceEnd) : 0;
+    auto middleEnd = suffixStart < oldWords.size() ? size_t(oldWords[suffixStart].start + delta) : paragraph.size;
+
+    auto &words = paragraph.words;
+    words.reserve(oldWords.size() + insertedSize);
+    words.insert(words.end(), oldWords.begin(), oldWords.begin() + prefixCount);
+    tokenize(paragraph, middleStart, middleEnd, words);
+
+    auto newSuffixStart = words.size();
+    for (auto i = suffixStart; i < oldWords.size(); ++i)
+    {
+        auto word = oldWords[i];
+        word.start = uint32_t(word.start + delta);
+        word.end = uint32_t(word.end + delta);
+        word.spaceEnd = uint32_t(word.spaceEnd + delta);
+        words.push_back(word);
+    }
+
+    if (lineBreakMode == LineBreakMode::Optimal)
+    {
+        breakLinesOptimal(paragraph);
+        return;
+    }
+
+    // Break again from the line before the one with the first edited word,
+    // since the edit may let its words move up.
+    std::vector<Line> oldLines;
+    oldLines.swap(paragraph.lines);
+
+    size_t firstLine = 0;
+    while (firstLine + 1 < oldLines.size() && oldLines[firstLine + 1].firstWord <= prefixCount)
+        ++firstLine;
+    if (firstLine > 0)
+        --firstLine;
+
+    paragraph.lines.assign(oldLines.begin(), oldLines.begin() + firstLine);
+    auto firstWord = firstLine < oldLines.size() ? size_t(oldLines[firstLine].firstWord) : 0;
+    breakLinesGreedy(paragraph, firstLine, firstWord, oldLines, suffixStart, newSuffixStart);
+}
+
+void ParagraphLayout::rebuildParagraphs(size_t firstParagraph, size_t lastParagraph, size_t start, size_t end)
+{
+    std::vector<Paragraph> newParagraphs;
+    auto paragraphStart = start;
+    for (;;)
+    {
+        auto lineFeed = text.find('\n', paragraphStart);
+        if (lineFeed == std::string::npos || lineFeed >= end)
+        {
+            newParagraphs.push_back(makeParagraph(paragraphStart, end - paragraphStart));
+            break;
+        }
+
+        newParagraphs.push_back(makeParagraph(paragraphStart, lineFeed - paragraphStart));
+        paragraphStart = lineFeed + 1;
+    }
+
+    paragraphs.erase(paragraphs.begin() + firstParagraph, paragraphs.begin() + lastParagraph);
+    paragraphs.insert(paragraphs.begin() + firstParagraph, newParagraphs.begin(), newParagraphs.end());
+    indicesDirty = true;
+}
+
+void ParagraphLayout::relayoutAll()
+{
+    for (auto &paragraph : paragraphs)
+        breakLines(paragraph);
+    indicesDirty = true;
+}
+
+void ParagraphLayout::updateIndices()
+{
+    if (!indicesDirty)
+        return;
+
+    size_t start = 0;
+    size_t line = 0;
+    for (auto &paragraph : paragraphs)
+    {
+        paragraph.start = start;
+        paragraph.firstLine = line;
+        start += paragraph.size + 1;
+        line += paragraph.lines.size();
+    }
+
+    lineCount = line;
+    indicesDirty = false;
+}
+
+size_t ParagraphLayout::findParagraph(size_t offset) const
+{
+    auto it = std::upper_bound(paragraphs.begin(), paragraphs.end(), offset, [](size_t value, const Paragraph &paragraph) {
+        return value < paragraph.start;
+    });
+    return it == paragraphs.begin() ? 0 : size_t(it - paragraphs.begin()) - 1;
+}
+
+} // End of namespace GUI
+} // End of namespace Loden
@@ -9,6 +9,7 @@ namespace GUI
 StatusBar::StatusBar(const SystemWindowPtr &systemWindow)
     : BaseType(systemWindow)
 {
+    setRetainingDrawing(true);
 }
 
 StatusBar::~StatusBar()
@@ -1,6 +1,8 @@
 #include "Loden/Printing.hpp"
 #include "Loden/GUI/SystemWindow.hpp"
 #include "Loden/GUI/AgpuCanvas.hpp"
+#include "Loden/GUI/OffscreenRenderTarget.hpp"
+#include "Loden/GUI/FontManager.hpp"
 #include "Loden/Matrices.hpp"
 #include "Loden/Settings.hpp"
 #include <algorithm>
@@ -32,7 +34,8 @@ SystemWindow::SystemWindow()
 
 SystemWindow::~SystemWindow()
 {
-	SDL_DestroyWindow(handle);
+    if (handle)
+        SDL_DestroyWindow(handle);
 }
 
 bool SystemWindow::isSystemWindow() const
@@ -55,6 +58,11 @@ bool SystemWindow::hasMultisampling() const
     return sampleCount > 1;
 }
 
+bool SystemWindow::isHeadless() const
+{
+    return offscreenTarget != nullptr;
+}
+
 SystemWindowPtr SystemWindow::create(const EnginePtr &engine, const std::string &title, int w, int h, int x, int y)
 {
     // Get some settings.
@@ -152,6 +160,27 @@ SystemWindowPtr SystemWindow::create(const EnginePtr &engine, const std::string
 	return window;
 }
 
+SystemWindowPtr SystemWindow::createHeadless(const EnginePtr &engine, int w, int h)
+{
+    // SDL is not initialized, so this does not need a display.
+    auto offscreenTarget = OffscreenRenderTarget::create(engine, w, h);
+    if (!offscreenTarget)
+    {
+        printError("Failed to create the headless window render target\n");
+        return nullptr;
+    }
+
+    auto window = SystemWindowPtr(new SystemWindow());
+    window->setSystemWindow(window);
+    window->setPosition(glm::vec2(0, 0));
+    window->setSize(glm::vec2(w, h));
+    window->engine = engine;
+    window->device = engine->getAgpuDevice();
+    window->commandQueue = engine->getGraphicsCommandQueue();
+    window->offscreenTarget = offscreenTarget;
+    return window;
+}
+
 bool SystemWindow::initialize()
 {
     // Create the transformation buffer.
@@ -186,6 +215,14 @@ bool SystemWindow::initialize()
         return false;
     }
 
+    // The screen canvases share their geometry buffers.
+    canvasRingBuffers = AgpuCanvasRingBuffers::create(device);
+    if(!canvasRingBuffers)
+    {
+        printError("Failed to create the canvas ring buffers.\n");
+        return false;
+    }
+
     // Color attachment
     agpu_renderpass_color_attachment_description colorAttachment;
     memset(&colorAttachment, 0, sizeof(colorAttachment));
@@ -286,7 +323,7 @@ bool SystemWindow::initialize()
             return false;
         }
 
-        screenCanvases[i] = AgpuCanvas::create(pipelineStateManager, false);
+        screenCanvases[i] = AgpuCanvas::create(pipelineStateManager, canvasRingBuffers, false);
         if(!screenCanvases[i])
         {
             printError("Failed to create the screen canvas.\n");
@@ -308,6 +345,9 @@ bool SystemWindow::initialize()
 
 void SystemWindow::pumpEvents()
 {
+	if(!handle)
+		return;
+
 	SDL_Event event;
 	while(SDL_PollEvent(&event))
 	{
@@ -462,11 +502,18 @@ void SystemWindow::setMouseFocusWidget(const WidgetPtr &newMouseFocus)
 void SystemWindow::setMouseCaptureWidget(const WidgetPtr &widget)
 {
 	mouseCaptureWidget = widget;
-	SDL_SetWindowGrab(handle, mouseCaptureWidget.get() ? SDL_TRUE : SDL_FALSE);
+	if(handle)
+		SDL_SetWindowGrab(handle, mouseCaptureWidget.get() ? SDL_TRUE : SDL_FALSE);
 }
 
 void SystemWindow::renderScreen()
 {
+    if (offscreenTarget)
+    {
+        offscreenTarget->render(this);
+        return;
+    }
+
     //printf("Render frame %d\n", frameIndex);
     auto& commandAllocator = commandAllocators[frameIndex];
     auto& commandList = commandLists[frameIndex];
@@ -475,16 +522,19 @@ void SystemWindow::renderScreen()
 
     // Ensure the frame data is not pending.
     frameFences[frameIndex]->waitOnClient();
+    engine->getFontManager()->beginFrame();
+
+	int screenWidth = (int)ceil(getWidth());
+	int screenHeight = (int)ceil(getHeight());
 
 	// Fill the screen canvas.
+    screenCanvas->setViewportSize(screenWidth, screenHeight);
 	screenCanvas->reset();
 	drawOn(screenCanvas.get());
 	screenCanvas->close();
 
     // Compute the screen projection matrix
     auto transformationBlock = reinterpret_cast<TransformationBlock*> (transformationBlockData + TransformationBlock_AlignedSize*frameIndex);
-	int screenWidth = (int)ceil(getWidth());
-	int screenHeight = (int)ceil(getHeight());
     transformationBlock->projectionMatrix = orthographicMatrix(0.0f, (float)screenWidth, (float)screenHeight, 0.0f, -2.0f, 2.0f, hasInvertedY);
     transformationBlock->modelMatrix = glm::mat4();
     transformationBlock->viewMatrix = glm::mat4();
@@ -524,14 +574,42 @@ void SystemWindow::renderScreen()
 
 	// Swap the buffers.
 	swapChain->swapBuffers();
+    canvasRingBuffers->endFrame(frameFences[frameIndex]);
     commandQueue->signalFence(frameFences[frameIndex].get());
 
     frameIndex = (frameIndex + 1) % frameCount;
 }
 
+void SystemWindow::drawChildrenOn(Canvas *canvas)
+{
+    // The top level widgets do not share drawing state, so the canvas can
+    // record them in parallel. The widgets are kept alive by the children.
+    childSegments.clear();
+    for (auto &child : getChildren())
+    {
+        if (!canvas->isVisible(child->getRectangle()))
+            continue;
+
+        auto widget = child.get();
+        childSegments.push_back([widget] (Canvas *segmentCanvas) {
+            widget->drawOn(segmentCanvas);
+        });
+    }
+
+    canvas->drawSegments(childSegments.data(), childSegments.size());
+}
+
+Image::ImageBufferPtr SystemWindow::readScreenImage()
+{
+    if (!offscreenTarget)
+        return nullptr;
+    return offscreenTarget->readImage();
+}
+
 void SystemWindow::setTitle(const std::string &title)
 {
-    SDL_SetWindowTitle(handle, title.c_str());
+    if (handle)
+        SDL_SetWindowTitle(handle, title.c_str());
 }
 
 void SystemWindow::activatePopUp(const WidgetPtr &popup, const WidgetPtr &popupGroup)
@@ -1,5 +1,6 @@
 #include "Loden/GUI/TextInput.hpp"
 #include "Loden/Color.hpp"
+#include "Loden/Unicode.hpp"
 
 namespace Loden
 {
@@ -11,6 +12,8 @@ TextInput::TextInput(const SystemWindowPtr &systemWindow)
 {
     fontSize = 14;
     cursor = 0;
+    measurerDirty = true;
+    textLayout.setLineHeight(fontSize*LineSpacing);
 }
 
 TextInput::~TextInput()
@@ -33,24 +36,25 @@ glm::vec2 TextInput::getMinimalSize()
 
 std::string TextInput::getText() const
 {
-    return std::string(textBuffer.begin(), textBuffer.end());
+    return textLayout.getText();
 }
 
 void TextInput::setText(const std::string &newText)
 {
-    textBuffer.clear();
-    textBuffer.insert(textBuffer.end(), newText.begin(), newText.end());
-    cursor = std::max(0, std::min(cursor, (int)textBuffer.size()));
+    textLayout.setText(newText);
+    cursor = std::max(0, std::min(cursor, (int)newText.size()));
 }
 
 size_t TextInput::getTextSize() const
 {
-    return textBuffer.size();
+    return textLayout.getText().size();
 }
 
 void TextInput::setFontSize(int newFontSize)
 {
     fontSize = newFontSize;
+    measurerDirty = true;
+    textLayout.setLineHeight(fontSize*LineSpacing);
 }
 
 int TextInput::getFontSize() const
@@ -58,8 +62,21 @@ int TextInput::getFontSize() const
     return fontSize;
 }
 
+ParagraphLayout &TextInput::getParagraphLayout()
+{
+    // The measurer needs the font, so it is set when the layout is used.
+    if (measurerDirty)
+    {
+        textLayout.setMeasurer(makeUtf8TextMeasurer(fontSize));
+        measurerDirty = false;
+    }
+
+    return textLayout;
+}
+
 void TextInput::handleKeyDown(KeyboardEvent &event)
 {
+    auto &text = textLayout.getText();
     switch (event.getSymbol())
     {
     case SDLK_RETURN:
@@ -76,27 +93,32 @@ void TextInput::handleKeyDown(KeyboardEvent &event)
         }
         break;
     case SDLK_LEFT:
-        cursor = std::min(cursor - 1, (int)textBuffer.size());
+        cursor = std::min(cursor, (int)text.size());
+        cursor = (int)previousUtf8CodePointStart(text.data(), cursor);
         break;
     case SDLK_RIGHT:
-        cursor = std::max(cursor + 1, (int)textBuffer.size());
+        cursor = (int)nextUtf8CodePointStart(text.data(), text.size(), cursor);
         break;
     case SDLK_HOME:
         cursor = 0;
         break;
     case SDLK_END:
-        cursor = textBuffer.size();
+        cursor = text.size();
         break;
     case SDLK_BACKSPACE:
         if (cursor > 0)
         {
-            textBuffer.erase(textBuffer.begin() + cursor - 1);
-            --cursor;
+            auto start = (int)previousUtf8CodePointStart(text.data(), cursor);
+            getParagraphLayout().eraseText(start, cursor - start);
+            cursor = start;
         }
         break;
     case SDLK_DELETE:
-        if (cursor <= (int)textBuffer.size())
-            textBuffer.erase(textBuffer.begin() + cursor);
+        if (cursor < (int)text.size())
+        {
+            auto end = (int)nextUtf8CodePointStart(text.data(), text.size(), cursor);
+            getParagraphLayout().eraseText(cursor, end - cursor);
+        }
         break;
     default:
         break;
@@ -113,8 +135,8 @@ void TextInput::handleKeyUp(KeyboardEvent &event)
 void TextInput::handleTextInput(TextInputEvent &event)
 {
     auto &text = event.getText();
-    cursor = std::min(cursor, (int)textBuffer.size());
-    textBuffer.insert(textBuffer.begin() + cursor, text.begin(), text.end());
+    cursor = std::min(cursor, (int)textLayout.getText().size());
+    getParagraphLayout().insertText(cursor, text);
     cursor += (int)text.size();
 
     BaseType::handleTextInput(event);
@@ -157,7 +179,21 @@ void TextInput::drawContentOn(Canvas *canvas)
     canvas->setColor(Colors::transparent()); // TODO: Implement the clip mask properly
     canvas->withClipRectangle(getLocalRectangle(), [&] {
         canvas->setColor(Colors::black());
-        canvas->drawText(getText(), fontSize, glm::vec2(5, getHeight() - 5));
+
+        // The last line is kept at the bottom.
+        auto &paragraph = getParagraphLayout();
+        auto &text = paragraph.getText();
+        auto lineCount = paragraph.getLineCount();
+        for (size_t i = 0; i < lineCount; ++i)
+        {
+            auto baseline = getHeight() - 5 - (lineCount - 1 - i)*paragraph.getLineHeight();
+            if (baseline < 0)
+                continue;
+
+            auto line = paragraph.getLine(i);
+            if (line.end > line.start)
+                canvas->drawText(text.substr(line.start, line.end - line.start), fontSize, glm::vec2(5, baseline));
+        }
     });
 }
 
@@ -0,0 +1,133 @@
+#include "Loden/GUI/TextLayout.hpp"
+#include "Loden/GUI/Font.hpp"
+
+namespace Loden
+{
+namespace GUI
+{
+
+TextLayout::TextLayout()
+    : bounds(glm::vec2(0, 0), glm::vec2(0, 0)), advance(0, 0)
+{
+}
+
+TextLayout::~TextLayout()
+{
+}
+
+glm::vec2 TextLayout::draw(Canvas *canvas, const glm::vec2 &position) const
+{
+    for (auto &run : runs)
+        run.face->drawLayoutRun(canvas, *this, run, position);
+    return position + advance;
+}
+
+void TextLayout::beginRun(FontFace *face, int pointSize)
+{
+    TextLayoutRun run;
+    run.face = face;
+    run.pointSize = pointSize;
+    run.firstGlyph = glyphs.size();
+    run.glyphCount = 0;
+    runs.push_back(run);
+}
+
+void TextLayout::addGlyph(uint32_t glyph, const glm::vec2 &position, const Rectangle &glyphBounds)
+{
+    TextLayoutGlyph layoutGlyph;
+    layoutGlyph.glyph = glyph;
+    layoutGlyph.position = position;
+    glyphs.push_back(layoutGlyph);
+    ++runs.back().glyphCount;
+
+    bounds.insertRectangle(glyphBounds);
+}
+
+void TextLayout::endRun(const glm::vec2 &newAdvance)
+{
+    advance = newAdvance;
+    if (runs.back().glyphCount == 0)
+        runs.pop_back();
+}
+
+size_t TextLayout::getMemoryCost() const
+{
+    return sizeof(TextLayout) + glyphs.capacity()*sizeof(TextLayoutGlyph) + runs.capacity()*sizeof(TextLayoutRun) + sourceText.capacity();
+}
+
+// Text layout cache
+TextLayoutCache::TextLayoutCache(size_t budget)
+    : cache(budget)
+{
+}
+
+TextLayoutCache::~TextLayoutCache()
+{
+}
+
+template<typename LF>
+TextLayoutPtr TextLayoutCache::getOrCreate(const Key &key, const std::string &sourceText, const LF &layoutFunction)
+{
+    // The hash can collide, so check the text of the cached layout.
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        auto cached = cache.find(key);
+        if (cached && (*cached)->getSourceText() == sourceText)
+            return *cached;
+    }
+
+    // Lay out the text without holding the lock, since the face may be slow.
+    auto layout = layoutFunction();
+    if (!layout)
+        return nullptr;
+
+    layout->setSourceText(sourceText);
+    std::unique_lock<std::mutex> l(mutex);
+    cache.insert(key, layout, layout->getMemoryCost() + sizeof(Key));
+    return layout;
+}
+
+TextLayoutPtr TextLayoutCache::getUtf8(FontFace *face, const std::string &text, int pointSize)
+{
+    if (!face)
+        return nullptr;
+
+    Key key;
+    key.face = face;
+    key.pointSize = pointSize;
+    key.wide = false;
+    key.hash = std::hash<std::string> ()(text);
+    return getOrCreate(key, text, [&] {
+        return face->layoutUtf8(text, pointSize);
+    });
+}
+
+TextLayoutPtr TextLayoutCache::getUtf16(FontFace *face, const std::wstring &text, int pointSize)
+{
+    if (!face)
+        return nullptr;
+
+    Key key;
+    key.face = face;
+    key.pointSize = pointSize;
+    key.wide = true;
+    key.hash = std::hash<std::wstring> ()(text);
+    return getOrCreate(key, std::string(reinterpret_cast<const char*> (text.data()), text.size()*sizeof(wchar_t)), [&] {
+        return face->layoutUtf16(text, pointSize);
+    });
+}
+
+void TextLayoutCache::clear()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    cache.clear();
+}
+
+void TextLayoutCache::setBudget(size_t budget)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    cache.setBudget(budget);
+}
+
+} // End of namespace GUI
+} // End of namespace Loden
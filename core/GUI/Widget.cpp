@@ -15,6 +15,7 @@ Widget::Widget(const SystemWindowPtr &systemWindow)
 {
 	hasKeyboardFocus_ = false;
 	hasMouseOver_ = false;
+    retainingDrawing = false;
 }
 
 Widget::~Widget()
@@ -92,22 +93,51 @@ FontFacePtr Widget::getDefaultFontFace()
     return font->getDefaultFace();
 }
 
-Rectangle Widget::computeUtf16TextRectangle(const std::wstring &text, int pointSize)
+TextLayoutPtr Widget::layoutUtf16Text(const std::wstring &text, int pointSize)
 {
     auto fontFace = getDefaultFontFace();
     if (!fontFace)
-        return Rectangle();
+        return nullptr;
 
-    return fontFace->computeUtf16TextRectangle(text, pointSize);
+    return getEngine()->getFontManager()->getTextLayoutCache().getUtf16(fontFace.get(), text, pointSize);
 }
 
-Rectangle Widget::computeUtf8TextRectangle(const std::string &text, int pointSize)
+TextLayoutPtr Widget::layoutUtf8Text(const std::string &text, int pointSize)
 {
     auto fontFace = getDefaultFontFace();
     if (!fontFace)
+        return nullptr;
+
+    return getEngine()->getFontManager()->getTextLayoutCache().getUtf8(fontFace.get(), text, pointSize);
+}
+
+ParagraphLayout::Measurer Widget::makeUtf8TextMeasurer(int pointSize)
+{
+    // Measure with uncached layouts, to keep the words out of the layout cache.
+    return [this, pointSize](const char *text, size_t size) {
+        auto fontFace = getDefaultFontFace();
+        if (!fontFace)
+            return 0.0f;
+        return fontFace->layoutUtf8(std::string(text, size), pointSize)->getAdvance().x;
+    };
+}
+
+Rectangle Widget::computeUtf16TextRectangle(const std::wstring &text, int pointSize)
+{
+    auto layout = layoutUtf16Text(text, pointSize);
+    if (!layout)
+        return Rectangle();
+
+    return layout->getBounds();
+}
+
+Rectangle Widget::computeUtf8TextRectangle(const std::string &text, int pointSize)
+{
+    auto layout = layoutUtf8Text(text, pointSize);
+    if (!layout)
         return Rectangle();
 
-    return fontFace->computeUtf8TextRectangle(text, pointSize);
+    return layout->getBounds();
 }
 
 glm::vec2 Widget::computeUtf16TextSize(const std::wstring &text, int pointSize)
@@ -193,6 +223,7 @@ void Widget::setSize(const glm::vec2 &newSize)
 {
     SizeChangedEvent event(size, newSize);
 	size = newSize;
+    invalidateDrawing();
     handleSizeChanged(event);
 }
 
@@ -214,6 +245,7 @@ const glm::vec4 &Widget::getBackgroundColor()
 void Widget::setBackgroundColor(const glm::vec4 &newColor)
 {
 	backgroundColor = newColor;
+    invalidateDrawing();
 }
 
 Rectangle Widget::getRectangle() const
@@ -241,7 +273,7 @@ void Widget::drawOn(Canvas *canvas)
 {
 	canvas->withTranslation(getPosition(), [&] {
 		// Draw the content
-		drawContentOn(canvas);
+		drawRetainedContentOn(canvas);
 	});
 }
 
@@ -249,6 +281,45 @@ void Widget::drawContentOn(Canvas *canvas)
 {
 }
 
+bool Widget::isRetainingDrawing() const
+{
+    return retainingDrawing;
+}
+
+void Widget::setRetainingDrawing(bool newRetainingDrawing)
+{
+    retainingDrawing = newRetainingDrawing;
+    invalidateDrawing();
+}
+
+void Widget::invalidateDrawing()
+{
+    displayList.reset();
+}
+
+void Widget::drawRetainedContentOn(Canvas *canvas)
+{
+    if (!retainingDrawing)
+    {
+        drawContentOn(canvas);
+        return;
+    }
+
+    // Replay the display list when it is still valid.
+    if (displayList && canvas->drawDisplayList(displayList))
+        return;
+
+    displayList.reset();
+    if (!canvas->beginDisplayListRecording())
+    {
+        drawContentOn(canvas);
+        return;
+    }
+
+    drawContentOn(canvas);
+    displayList = canvas->endDisplayListRecording();
+}
+
 void Widget::handleKeyDown(KeyboardEvent &event)
 {
 	keyDownEvent(event);
@@ -272,24 +343,28 @@ void Widget::handleRemovedFromParent(ParentChangedEvent &event)
 void Widget::handleGotFocus(FocusEvent &event)
 {
 	hasKeyboardFocus_ = true;
+    invalidateDrawing();
 	gotFocusEvent(event);
 }
 
 void Widget::handleLostFocus(FocusEvent &event)
 {
 	hasKeyboardFocus_ = false;
+    invalidateDrawing();
 	lostFocusEvent(event);
 }
 
 void Widget::handleMouseEnter(MouseFocusEvent &event)
 {
 	hasMouseOver_ = true;
+    invalidateDrawing();
 	mouseEnterEvent(event);
 }
 
 void Widget::handleMouseLeave(MouseFocusEvent &event)
 {
 	hasMouseOver_ = false ;
+    invalidateDrawing();
 	mouseLeaveEvent(event);
 }
 
@@ -0,0 +1,136 @@
+#include "Loden/GpuRingBuffer.hpp"
+#include "Loden/Printing.hpp"
+#include <algorithm>
+
+namespace Loden
+{
+
+GpuRingBuffer::GpuRingBuffer(const agpu_device_ref &device, agpu_buffer_binding_type binding, size_t elementSize)
+    : device(device), binding(binding), elementSize(elementSize), mappedData(nullptr), capacity(0),
+      head(0), tail(0), liveCount(0), currentFrameCount(0)
+{
+}
+
+GpuRingBuffer::~GpuRingBuffer()
+{
+    if (buffer)
+        buffer->unmapBuffer();
+}
+
+GpuRingBufferPtr GpuRingBuffer::create(const agpu_device_ref &device, agpu_buffer_binding_type binding, size_t elementSize, size_t initialCapacity)
+{
+    auto result = std::make_shared<GpuRingBuffer> (device, binding, elementSize);
+    if (!result->createBuffer(initialCapacity))
+        return nullptr;
+    return result;
+}
+
+bool GpuRingBuffer::createBuffer(size_t newCapacity)
+{
+    agpu_buffer_description desc;
+    desc.size = agpu_uint(newCapacity*elementSize);
+    desc.usage = AGPU_DYNAMIC;
+    desc.binding = binding;
+    desc.mapping_flags = AGPU_MAP_WRITE_BIT | AGPU_MAP_PERSISTENT_BIT | AGPU_MAP_COHERENT_BIT;
+    desc.stride = agpu_uint(elementSize);
+    agpu_buffer_ref newBuffer = device->createBuffer(&desc, nullptr);
+    if (!newBuffer)
+    {
+        printError("Failed to create a ring buffer.\n");
+        return false;
+    }
+
+    auto newMappedData = (uint8_t*)newBuffer->mapBuffer(AGPU_WRITE_ONLY);
+    if (!newMappedData)
+    {
+        printError("Failed to map a ring buffer.\n");
+        return false;
+    }
+
+    // The frames in flight may still read the old buffer. The fence of the
+    // current frame is signaled after theirs, so the old buffer is released
+    // with the current frame.
+    if (buffer)
+        currentFrameRetiredBuffers.push_back(buffer);
+    for (auto &frame : pendingFrames)
+    {
+        for (auto &retiredBuffer : frame.retiredBuffers)
+            currentFrameRetiredBuffers.push_back(retiredBuffer);
+    }
+    pendingFrames.clear();
+
+    buffer = newBuffer;
+    mappedData = newMappedData;
+    capacity = newCapacity;
+    head = tail = 0;
+    liveCount = 0;
+    currentFrameCount = 0;
+    return true;
+}
+
+bool GpuRingBuffer::allocate(size_t count, Allocation &result)
+{
+    for (;;)
+    {
+        // The allocations are contiguous, so a region that reaches past the
+        // end of the buffer wastes the remainder and starts at zero.
+        auto position = head;
+        size_t waste = 0;
+        if (head + count > capacity)
+        {
+            waste = capacity - head;
+            position = 0;
+        }
+
+        if (count <= capacity && liveCount + waste + count <= capacity)
+        {
+            head = position + count;
+            liveCount += waste + count;
+            currentFrameCount += waste + count;
+
+            result.buffer = buffer.get();
+            result.data = mappedData + position*elementSize;
+            result.offset = position;
+            return true;
+        }
+
+        if (!pendingFrames.empty())
+        {
+            retireOldestFrame();
+            continue;
+        }
+
+        if (!createBuffer(std::max(capacity*2, count*2)))
+            return false;
+    }
+}
+
+void GpuRingBuffer::endFrame(const agpu_fence_ref &fence)
+{
+    if (currentFrameCount == 0 && currentFrameRetiredBuffers.empty())
+        return;
+
+    PendingFrame frame;
+    frame.fence = fence;
+    frame.end = head;
+    frame.count = currentFrameCount;
+    frame.retiredBuffers.swap(currentFrameRetiredBuffers);
+    pendingFrames.push_back(frame);
+    currentFrameCount = 0;
+}
+
+void GpuRingBuffer::retireOldestFrame()
+{
+    auto &frame = pendingFrames.front();
+    frame.fence->waitOnClient();
+
+    tail = frame.end;
+    liveCount -= frame.count;
+    pendingFrames.pop_front();
+
+    // Start again from the beginning when the ring is empty.
+    if (liveCount == 0)
+        head = tail = 0;
+}
+
+} // End of namespace Loden
@@ -867,14 +867,36 @@ bool PipelineStateManager::loadVertexLayoutsFromFile(const std::string &filename
         auto bufferCount = bufferArray.Size();
         for (size_t i = 0; i < bufferCount; ++i)
         {
+            // A buffer is either a structure name, or an object with the
+            // structure name and the instance divisor.
             auto &bufferSpec = bufferArray[i];
-            if (!bufferSpec.IsString())
+            const char *structureName = nullptr;
+            agpu_uint divisor = 0;
+            if (bufferSpec.IsString())
+            {
+                structureName = bufferSpec.GetString();
+            }
+            else if (bufferSpec.IsObject() && bufferSpec.HasMember("structure") && bufferSpec["structure"].IsString())
+            {
+                structureName = bufferSpec["structure"].GetString();
+                if (bufferSpec.HasMember("divisor"))
+                {
+                    auto &divisorValue = bufferSpec["divisor"];
+                    if (!divisorValue.IsUint())
+                    {
+                        printError("Expected an unsigned integer as the divisor of a buffer used by vertex layout '%s'.\n", name);
+                        return false;
+                    }
+
+                    divisor = divisorValue.GetUint();
+                }
+            }
+            else
             {
                 printError("Expected a structure name to specify a buffer used by a vertex layout.\n");
                 return false;
             }
 
-            auto structureName = bufferSpec.GetString();
             auto structure = getStructure(structureName);
             if (!structure)
             {
@@ -894,7 +916,7 @@ bool PipelineStateManager::loadVertexLayoutsFromFile(const std::string &filename
                 attribute.buffer = (agpu_uint)i;
                 attribute.binding = field.binding;
                 attribute.rows = type.rows;
-                attribute.divisor = 0; // TODO: Fetch a divisor from some place.
+                attribute.divisor = divisor;
                 attribute.offset = field.offset;
                 attribute.format = field.format;
                 layoutAttributes.push_back(attribute);
@@ -1220,4 +1242,33 @@ PipelineStateTemplatePtr PipelineStateManager::getPipelineStateTemplate(const st
     return nullptr;
 }
 
+agpu_pipeline_state_ref PipelineStateManager::getPipelineStateVariant(const std::string &name, const std::string &variantName, const PipelineStateTemplate::BuildAction &buildAction)
+{
+    auto fullName = name + "." + variantName;
+    auto existing = getPipelineState(fullName);
+    if (existing)
+        return existing;
+
+    auto stateTemplate = getPipelineStateTemplate(name);
+    if (!stateTemplate)
+        return nullptr;
+
+    agpu_pipeline_builder_ref builder = device->createPipelineBuilder();
+    if (!stateTemplate->instantiateOn(builder) || !buildAction(builder))
+    {
+        printError("Failed to instantiate pipeline state %s\n", fullName.c_str());
+        return nullptr;
+    }
+
+    agpu_pipeline_state_ref state = builder->build();
+    if (!state)
+    {
+        printError("Failed to build pipeline state %s\n", fullName.c_str());
+        return nullptr;
+    }
+
+    addPipelineState(fullName, state);
+    return state;
+}
+
 } // End of namespace Loden
@@ -0,0 +1,99 @@
+#include "Loden/ThreadPool.hpp"
+
+namespace Loden
+{
+
+ThreadPool::ThreadPool()
+    : runningTaskCount(0), shuttingDown(false)
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+    shutdown();
+}
+
+bool ThreadPool::initialize(size_t threadCount)
+{
+    // Leave a core for the main thread.
+    if (threadCount == 0)
+    {
+        auto hardwareThreads = std::thread::hardware_concurrency();
+        threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    for (size_t i = 0; i < threadCount; ++i)
+        threads.push_back(std::thread([this] { workerMain(); }));
+    return true;
+}
+
+void ThreadPool::shutdown()
+{
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        shuttingDown = true;
+    }
+    taskAvailableCondition.notify_all();
+
+    for (auto &thread : threads)
+        thread.join();
+    threads.clear();
+
+    // Run the tasks that were left behind, if any.
+    while (!tasks.empty())
+    {
+        auto task = tasks.front();
+        tasks.pop_front();
+        task();
+    }
+}
+
+void ThreadPool::submit(const Task &task)
+{
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        if (!threads.empty() && !shuttingDown)
+        {
+            tasks.push_back(task);
+            taskAvailableCondition.notify_one();
+            return;
+        }
+    }
+
+    // Without workers, run the task in the calling thread.
+    task();
+}
+
+void ThreadPool::waitIdle()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    while (!tasks.empty() || runningTaskCount > 0)
+        idleCondition.wait(l);
+}
+
+void ThreadPool::workerMain()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    for (;;)
+    {
+        while (tasks.empty() && !shuttingDown)
+            taskAvailableCondition.wait(l);
+
+        if (tasks.empty())
+            return;
+
+        auto task = tasks.front();
+        tasks.pop_front();
+        ++runningTaskCount;
+
+        l.unlock();
+        task();
+        l.lock();
+
+        --runningTaskCount;
+        if (tasks.empty() && runningTaskCount == 0)
+            idleCondition.notify_all();
+    }
+}
+
+} // End of namespace Loden
@@ -14,6 +14,7 @@ LODEN_DECLARE_CLASS(FontManager);
 
 LODEN_DECLARE_CLASS(Engine);
 LODEN_DECLARE_CLASS(Settings);
+LODEN_DECLARE_CLASS(ThreadPool);
 LODEN_DECLARE_CLASS(PipelineStateManager);
 LODEN_DECLARE_CLASS(VirtualFileSystem);
 
@@ -38,10 +39,12 @@ public:
 
     const PipelineStateManagerPtr &getPipelineStateManager() const;
     const GUI::FontManagerPtr &getFontManager() const;
+    const ThreadPoolPtr &getThreadPool() const;
 
 private:
     bool createDevice();
     bool loadSettings(int argc, const char **argv);
+    bool createThreadPool();
     bool createPipelineStateManager();
     bool createFontManager();
 
@@ -49,6 +52,7 @@ private:
     agpu_command_queue_ref graphicsCommandQueue;
 
     SettingsPtr settings;
+    ThreadPoolPtr threadPool;
     PipelineStateManagerPtr pipelineStateManager;
     GUI::FontManagerPtr fontManager;
 };
@@ -3,9 +3,15 @@
 
 #include "Loden/Common.hpp"
 #include "Loden/GUI/Canvas.hpp"
+#include "Loden/GpuRingBuffer.hpp"
+#include "Loden/LRUCache.hpp"
 #include "Loden/PipelineStateManager.hpp"
 #include "AGPU/agpu.hpp"
+#include <algorithm>
+#include <memory>
+#include <mutex>
 #include <vector>
+#include <type_traits>
 #include <glm/vec3.hpp>
 #include <functional>
 
@@ -15,7 +21,26 @@ namespace GUI
 {
 
 LODEN_DECLARE_CLASS(AgpuCanvas);
+LODEN_DECLARE_CLASS(AgpuCanvasRingBuffers);
+LODEN_DECLARE_CLASS(AgpuShapeTessellationCache);
 
+inline uint16_t packUnorm16(float value)
+{
+    return uint16_t(std::min(std::max(value, 0.0f), 1.0f)*65535.0f + 0.5f);
+}
+
+inline uint32_t packColorRGBA8(const glm::vec4 &color)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < 4; ++i)
+        result |= uint32_t(std::min(std::max(color[i], 0.0f), 1.0f)*255.0f + 0.5f) << (i*8);
+    return result;
+}
+
+/**
+ * A canvas vertex, in the float CanvasVertex2D layout of the pipeline
+ * states. It is copied into the vertex ring without conversion.
+ */
 struct AgpuCanvasVertex
 {
 	AgpuCanvasVertex() {}
@@ -29,6 +54,297 @@ struct AgpuCanvasVertex
 	glm::vec4 color;
 };
 
+static_assert(sizeof(AgpuCanvasVertex) == 32, "Unexpected canvas vertex size");
+
+/**
+ * A glyph of an instanced glyph run. The vertex shader expands it into a
+ * quad, by interpolating the destination and the source rectangles with
+ * the corner of a shared unit quad. The instanced text is experimental, and
+ * it is only drawn when the ExperimentalInstancedText setting is enabled.
+ */
+struct AgpuCanvasGlyphInstance
+{
+    // The device space rectangle, as min x, min y, max x, max y.
+    glm::vec4 destRectangle;
+
+    // The atlas rectangle, in unsigned normalized 16 bits.
+    uint16_t sourceRectangle[4];
+
+    // The color, in RGBA8.
+    uint32_t color;
+};
+
+static_assert(sizeof(AgpuCanvasGlyphInstance) == 28, "Unexpected glyph instance size");
+
+/**
+ * A filled or stroked rounded rectangle or ellipse of an instanced shape
+ * run. The vertex shader expands the shared unit quad into its rectangle,
+ * grown by the stroke and by one pixel, and the fragment shader takes the
+ * antialiased coverage from the signed distance to the shape. The analytic
+ * shapes are experimental, and they are only drawn when the
+ * ExperimentalAnalyticShapes setting is enabled.
+ */
+struct AgpuCanvasShapeInstance
+{
+    static constexpr float RoundedRectangleKind = 0.0f;
+    static constexpr float EllipseKind = 1.0f;
+
+    // The device space rectangle, as min x, min y, max x, max y.
+    glm::vec4 rectangle;
+
+    // The device space corner radii. A rectangle with zero radii has
+    // mitered stroke corners.
+    glm::vec2 radii;
+
+    // The device space stroke width, or zero for filling the shape.
+    float strokeWidth;
+    float kind;
+
+    // The color, in RGBA8.
+    uint32_t color;
+};
+
+static_assert(sizeof(AgpuCanvasShapeInstance) == 36, "Unexpected shape instance size");
+
+/**
+ * The push constants of the text effect pipelines. The text effects are
+ * experimental, and they are only drawn when the ExperimentalTextEffects
+ * setting is enabled.
+ */
+struct AgpuCanvasTextEffectConstants
+{
+    glm::vec4 outlineColor;
+    glm::vec4 shadowColor;
+    glm::vec2 shadowOffset;
+    float outlineWidth;
+    float shadowSoftness;
+};
+
+/**
+ * A recorded canvas command. The commands are plain data stored in a
+ * contiguous array, so recording a frame does not allocate once the array
+ * has grown to its steady size.
+ */
+struct AgpuCanvasCommand
+{
+    enum Type : uint32_t
+    {
+        UsePipelineState = 0,
+        UseShaderResources,
+        DrawElements,
+        DrawGlyphInstances,
+        DrawShapeInstances,
+        SetStencilReference,
+        PushTextEffectConstants,
+        SetScissor,
+    };
+
+    struct DrawArguments
+    {
+        uint32_t indexCount;
+        uint32_t instanceCount;
+        uint32_t firstIndex;
+        int32_t baseVertex;
+        uint32_t firstInstance;
+    };
+
+    // A scissor rectangle, in device pixels.
+    struct ScissorRectangle
+    {
+        bool operator==(const ScissorRectangle &o) const
+        {
+            return x == o.x && y == o.y && width == o.width && height == o.height;
+        }
+
+        bool operator!=(const ScissorRectangle &o) const
+        {
+            return !(*this == o);
+        }
+
+        int32_t x;
+        int32_t y;
+        int32_t width;
+        int32_t height;
+    };
+
+    Type type;
+    union
+    {
+        agpu_pipeline_state *pipeline;
+        agpu_shader_resource_binding *binding;
+        DrawArguments draw;
+        uint32_t stencilReference;
+        uint32_t textEffectConstantsIndex;
+        ScissorRectangle scissor;
+    };
+};
+
+static_assert(std::is_trivially_copyable<AgpuCanvasCommand>::value, "Canvas commands must be plain data");
+
+/**
+ * The geometry ring buffers shared by the canvases of a window. The owner
+ * calls endFrame with the fence of each frame that used them.
+ */
+class LODEN_CORE_EXPORT AgpuCanvasRingBuffers
+{
+public:
+    static AgpuCanvasRingBuffersPtr create(const agpu_device_ref &device);
+
+    void endFrame(const agpu_fence_ref &fence);
+
+    GpuRingBufferPtr vertices;
+    GpuRingBufferPtr shortIndices;
+    GpuRingBufferPtr indices;
+    GpuRingBufferPtr glyphInstances;
+    GpuRingBufferPtr shapeInstances;
+};
+
+/**
+ * A display list recorded by an AGPU canvas. It holds copies of the
+ * geometry and of the commands, with offsets relative to the list.
+ */
+class AgpuCanvasDisplayList : public CanvasDisplayList
+{
+public:
+    glm::mat3 transform;
+    size_t maxSubmeshVertexCount;
+
+    // A list that changes the clip state can only be replayed under the
+    // clip state in which it was recorded, moved by whole pixels. Any list
+    // is only replayed at the stencil clip depth where it was recorded.
+    bool changesClipState;
+    AgpuCanvasCommand::ScissorRectangle scissor;
+    uint32_t clipStencilDepth;
+
+    std::vector<AgpuCanvasVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<AgpuCanvasGlyphInstance> glyphInstances;
+    std::vector<AgpuCanvasShapeInstance> shapeInstances;
+    std::vector<AgpuCanvasCommand> commands;
+    std::vector<AgpuCanvasTextEffectConstants> textEffectConstants;
+
+    // The distinct bindings of the list. They are marked as used on each
+    // replay, so the glyph atlas keeps the pages that the list samples.
+    std::vector<agpu_shader_resource_binding*> shaderResources;
+};
+
+/**
+ * A recorded fill path command. The unused points are zero.
+ */
+struct AgpuPathCommand
+{
+    enum Type : uint32_t
+    {
+        MoveTo = 0,
+        LineTo,
+        QuadTo,
+        CubicTo,
+        Close,
+    };
+
+    bool operator==(const AgpuPathCommand &o) const
+    {
+        return type == o.type && points[0] == o.points[0] && points[1] == o.points[1] && points[2] == o.points[2];
+    }
+
+    bool operator!=(const AgpuPathCommand &o) const
+    {
+        return !(*this == o);
+    }
+
+    Type type;
+    glm::vec2 points[3];
+};
+
+/**
+ * A tessellated fill path. The device space vertices are relative to the
+ * transformed start point of the path, so the shape can be drawn again
+ * anywhere by moving the vertices.
+ * Each part is drawn with a single pipeline, and its indices are relative
+ * to its first vertex.
+ */
+struct AgpuTessellatedShape
+{
+    struct Part
+    {
+        int shapeType;
+        agpu_pipeline_state *pipeline;
+        size_t firstVertex;
+        size_t firstIndex;
+    };
+
+    size_t getMemoryCost() const
+    {
+        return sizeof(AgpuTessellatedShape) + parts.capacity()*sizeof(Part) +
+            vertices.capacity()*sizeof(AgpuCanvasVertex) + indices.capacity()*sizeof(uint32_t);
+    }
+
+    std::vector<Part> parts;
+    std::vector<AgpuCanvasVertex> vertices;
+    std::vector<uint32_t> indices;
+};
+
+typedef std::shared_ptr<const AgpuTessellatedShape> AgpuTessellatedShapePtr;
+
+/**
+ * Cache of tessellated fill paths, keyed by the path relative to its start
+ * point, the fill rule and the linear part of the transform. It is thread
+ * safe, so it is shared by the segment canvases.
+ */
+class LODEN_CORE_EXPORT AgpuShapeTessellationCache
+{
+public:
+    static constexpr size_t DefaultBudget = 2 << 20;
+
+    // The hash of the path can collide, so the keys also compare the path.
+    struct Key
+    {
+        bool operator==(const Key &other) const
+        {
+            return hash == other.hash && fillRule == other.fillRule &&
+                linear[0] == other.linear[0] && linear[1] == other.linear[1] &&
+                linear[2] == other.linear[2] && linear[3] == other.linear[3] &&
+                path == other.path;
+        }
+
+        size_t getMemoryCost() const
+        {
+            return sizeof(Key) + path.size()*sizeof(AgpuPathCommand);
+        }
+
+        size_t hash;
+        int fillRule;
+        float linear[4];
+        std::vector<AgpuPathCommand> path;
+    };
+
+    AgpuShapeTessellationCache(size_t budget = DefaultBudget);
+    ~AgpuShapeTessellationCache();
+
+    AgpuTessellatedShapePtr find(const Key &key);
+    void insert(const Key &key, const AgpuTessellatedShapePtr &shape);
+
+    void clear();
+    void setBudget(size_t budget);
+
+    size_t getHitCount() const;
+    size_t getMissCount() const;
+    size_t getUsedMemory() const;
+    void resetStatistics();
+
+private:
+    struct KeyHasher
+    {
+        size_t operator()(const Key &key) const
+        {
+            return key.hash ^ (size_t(key.fillRule) * 31);
+        }
+    };
+
+    mutable std::mutex mutex;
+    LRUCache<Key, AgpuTessellatedShapePtr, KeyHasher> cache;
+};
+
 class AgpuCanvasPathProcessor;
 
 /**
@@ -42,7 +358,7 @@ public:
 
 	~AgpuCanvas();
 
-	static AgpuCanvasPtr create(const PipelineStateManagerPtr &stateManager, bool usingBundle);
+	static AgpuCanvasPtr create(const PipelineStateManagerPtr &stateManager, const AgpuCanvasRingBuffersPtr &ringBuffers, bool usingBundle);
 
 	virtual void setColor(const glm::vec4 &color);
 
@@ -55,14 +371,23 @@ public:
 	virtual void drawFillRectangle(const Rectangle &rectangle);
     virtual void drawFillRoundedRectangle(const Rectangle &rectangle, float cornerRadius);
 
+    virtual void drawEllipse(const Rectangle &rectangle);
+    virtual void drawFillEllipse(const Rectangle &rectangle);
+
     // Text drawing
     virtual glm::vec2 drawText(const std::string &text, int pointSize, glm::vec2 position);
     virtual glm::vec2 drawTextUtf16(const std::wstring &text, int pointSize, glm::vec2 position) ;
+    virtual glm::vec2 drawTextLayout(const TextLayoutPtr &layout, glm::vec2 position);
+
+    // Text effects
+    virtual const TextEffect &getTextEffect() const;
+    virtual void setTextEffect(const TextEffect &effect);
 
     // Bitmap text drawing
     virtual void beginBitmapTextDrawing(void *binding, bool distanceField);
     virtual void drawBitmapCharacter(const Rectangle &destRectangle, Rectangle &sourceRectangle);
     virtual void endBitmapTextDrawing();
+    virtual void drawGlyphRun(void *binding, bool distanceField, const CanvasGlyph *glyphs, size_t count);
 
     // Fill paths.
     virtual void beginFillPath(PathFillRule fillRule = PathFillRule::EvenOdd);
@@ -74,6 +399,8 @@ public:
     virtual void endFillPath();
 
     // Stroke paths
+    virtual const StrokeStyle &getStrokeStyle() const;
+    virtual void setStrokeStyle(const StrokeStyle &style);
     virtual void beginStrokePath();
     virtual void endStrokePath();
 
@@ -81,42 +408,149 @@ public:
     virtual void beginClipPath(PathFillRule fillRule = PathFillRule::EvenOdd);
     virtual void endClipPath();
     virtual void popClipPath();
+    virtual void pushClipRectangle(const Rectangle &rectangle);
+
+    // Culling
+    virtual bool isVisible(const Rectangle &rectangle) const;
+
+    // The visible region of the device, which is the scissor of the clips.
+    Rectangle getClipBounds() const;
+
+    // Retained drawing
+    virtual bool beginDisplayListRecording();
+    virtual CanvasDisplayListPtr endDisplayListRecording();
+    virtual bool drawDisplayList(const CanvasDisplayListPtr &displayList);
+
+    // Parallel recording
+    virtual void drawSegments(const SegmentRecorder *segments, size_t count);
 
 	virtual const glm::mat3 &getTransform() const;
 	virtual void setTransform(const glm::mat3 &newTransform);
 
+    // The scissor rectangle of the frame, which is restored when the
+    // clips are removed. It is set before reset.
+    void setViewportSize(int width, int height);
+
 	void reset();
 	void close();
     void emitCommandsInto(agpu_command_list_ref &commandList);
 
 	const agpu_ref<agpu_command_list> &getCommandBundle();
 
+    // The cache of the fill paths, or null when it is disabled.
+    const AgpuShapeTessellationCachePtr &getShapeTessellationCache() const
+    {
+        return shapeCache;
+    }
+
 private:
-	glm::vec2 transformPosition(const glm::vec2 &pos)
+	glm::vec2 transformPosition(const glm::vec2 &pos) const
 	{
 		auto v3 = transform * glm::vec3(pos, 1.0);
 		return glm::vec2(v3.x, v3.y);
 	}
 
     void coverBox(const Rectangle &rectangle);
+    void coverDeviceRectangle(const Rectangle &rectangle, agpu_pipeline_state *pipeline);
+
+    bool canUseStencilClip() const
+    {
+        return !clippedPipelines.empty() && clipStencilDepth < MaxClipStencilDepth;
+    }
+
+    bool createStencilClipPipelines();
+    void addClippedPipeline(const agpu_pipeline_state_ref &pipeline, const agpu_pipeline_state_ref &clipped);
+    bool addClippedColorPipeline(const agpu_pipeline_state_ref &pipeline, const char *name);
+    agpu_pipeline_state *getClippedPipeline(agpu_pipeline_state *pipeline) const;
+    agpu_pipeline_state *getUnclippedPipeline(agpu_pipeline_state *pipeline) const;
+
+    Rectangle transformRectangleBounds(const Rectangle &rectangle) const;
+    void pushClipPath(const Rectangle &bounds, bool hasGeometry, bool stenciled);
+    void pushScissor(const Rectangle &deviceRectangle);
+    void setScissor(const AgpuCanvasCommand::ScissorRectangle &scissor);
+    void setStencilReference(uint32_t clipDepth);
+    void addStrokeRing(const glm::vec2 *outerPoints, const glm::vec2 *innerPoints, size_t count);
+    void addStrokeStrip(const glm::vec2 *leftPoints, const glm::vec2 *rightPoints, size_t count, bool closed);
+    void addStrokeFan(const glm::vec2 &center, float radius, float startAngle, float sweepAngle);
+
+    // The text effects are only drawn by their experimental pipelines.
+    bool isUsingTextEffect(bool distanceField) const
+    {
+        return distanceField && !textEffect.isNone() &&
+            (textSdfEffectsColorPipeline || textSdfInstancedEffectsColorPipeline);
+    }
+
+    void useTextEffectConstants();
+    void resetRecordingState();
+    void forgetDrawingState();
+    void appendDrawing(const std::vector<AgpuCanvasVertex> &sourceVertices, const std::vector<uint32_t> &sourceIndices,
+        const std::vector<AgpuCanvasGlyphInstance> &sourceGlyphInstances, const std::vector<AgpuCanvasShapeInstance> &sourceShapeInstances,
+        const std::vector<AgpuCanvasCommand> &sourceCommands,
+        const std::vector<AgpuCanvasTextEffectConstants> &sourceTextEffectConstants, size_t sourceMaxSubmeshVertexCount, const glm::vec2 &delta);
+
+    AgpuCanvasPtr createSegmentCanvas();
+    void beginSegment(const AgpuCanvas &parent);
+
+    /**
+     * A draw seen by the batch merger, with the state that it uses and its
+     * device space bounds. The batches of a group are chained in order.
+     */
+    struct DrawBatch
+    {
+        AgpuCanvasCommand command;
+        agpu_pipeline_state *pipeline;
+        agpu_shader_resource_binding *binding;
+        uint32_t textEffectConstantsIndex;
+        uint32_t vertexCount;
+        Rectangle bounds;
+        int next;
+    };
+
+    struct DrawBatchGroup
+    {
+        int firstBatch;
+        int lastBatch;
+        Rectangle bounds;
+    };
 
-	void createVertexBuffer();
-	void createIndexBuffer();
+    bool usesFontBinding(agpu_pipeline_state *pipeline) const;
+    bool usesTextEffectConstants(agpu_pipeline_state *pipeline) const;
+    bool isReorderablePipeline(agpu_pipeline_state *pipeline) const;
+    void computeBatchBounds(DrawBatch &batch) const;
+    void mergeBatches();
+    void addBatch(const DrawBatch &batch);
+    void flushBatchGroups();
+    void emitBatchState(const DrawBatch &batch);
+
+    bool createQuadBuffers();
+    bool createGlyphQuadBuffers();
+    bool createShapeQuadBuffers();
+    bool canDrawShapeInstance() const;
+    bool drawShapeInstance(const Rectangle &rectangle, const glm::vec2 &radii, bool stroked, float kind);
+    bool uploadGeometry();
+
+    float getCurveTolerance() const;
+
+    void recordPathCommand(AgpuPathCommand::Type type, const glm::vec2 &p1 = glm::vec2(), const glm::vec2 &p2 = glm::vec2(), const glm::vec2 &p3 = glm::vec2());
+    void endCachedFillPath();
+    void processRecordedPath();
+    void drawTessellatedShape(const AgpuTessellatedShape &shape, const glm::vec2 &offset);
+
+    bool isTranslationTransform() const
+    {
+        return transform[0][0] == 1.0f && transform[0][1] == 0.0f &&
+            transform[1][0] == 0.0f && transform[1][1] == 1.0f;
+    }
 
 	enum ShapeType
 	{
 		ST_Unknown = -1,
 		ST_Line,
-		ST_Triangle
+		ST_Triangle,
+        ST_GlyphInstance,
+        ST_ShapeInstance
 	};
 
-    enum CoverType
-    {
-        CT_Draw = 0,
-        CT_ClipPath,
-        CT_ClipPathPop,
-    };
-
 	AgpuCanvas();
 
 	void beginConvexLines();
@@ -124,28 +558,114 @@ private:
     void beginShapeWithPipeline(ShapeType newShapeType, agpu_pipeline_state *pipeline, agpu_shader_resource_binding *textureBinding=nullptr, agpu_shader_resource_binding *fontBinding=nullptr);
     void withNewBaseVertex();
 
+    void addCommand(AgpuCanvasCommand::Type type)
+    {
+        AgpuCanvasCommand command;
+        command.type = type;
+        drawCommands.push_back(command);
+    }
+
+    void addUsePipelineStateCommand(agpu_pipeline_state *pipeline);
+    void addUseShaderResourcesCommand(agpu_shader_resource_binding *binding);
+    void addDrawElementsCommand(AgpuCanvasCommand::Type type, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t baseVertex, uint32_t firstInstance);
+    void addSetStencilReferenceCommand(uint32_t reference);
+    void addSetScissorCommand(const AgpuCanvasCommand::ScissorRectangle &scissor);
+
 	void endSubmesh();
+    void endGlyphInstances();
+    void endShapeInstances();
 	void addVertex(const AgpuCanvasVertex &vertex);
     void addVertexPosition(const glm::vec2 &position);
 	void addIndex(int index);
+    AgpuCanvasVertex *addQuads(size_t quadCount);
+    void addQuadVertices(AgpuCanvasVertex *destVertices, const Rectangle &destRectangle, const Rectangle &sourceRectangle, const glm::vec4 &color);
 
     // Current canvas state
 	glm::vec4 currentColor;
 	glm::mat3 transform;
+    TextEffect textEffect;
+    StrokeStyle strokeStyle;
 
     // Current font state
     FontFacePtr fontFace;
 
     // Buffer states
-	size_t vertexCapacity;
-	size_t indexCapacity;
 	int startIndex;
+    size_t submeshBaseVertex;
+    size_t maxSubmeshVertexCount;
+    size_t startGlyphInstance;
+    size_t startShapeInstance;
+
+    // Clip stack. The clip depth is stored in the high stencil bits, and
+    // the fill paths wind in the low bits. The stencil clips are also
+    // scissored to their device bounds.
+    static constexpr uint32_t MaxClipStencilDepth = 15;
+
+    struct ClipState
+    {
+        AgpuCanvasCommand::ScissorRectangle scissor;
+        uint32_t stencilDepth;
+        bool usesStencil;
+        Rectangle coverRectangle;
+    };
+
+    std::vector<ClipState> clipStack;
+    AgpuCanvasCommand::ScissorRectangle viewportScissor;
+    AgpuCanvasCommand::ScissorRectangle currentScissor;
+    uint32_t clipStencilDepth;
+
+    // Display list recording
+    bool recordingDisplayList;
+    glm::mat3 recordingTransform;
+    size_t recordingVertexStart;
+    size_t recordingIndexStart;
+    size_t recordingGlyphInstanceStart;
+    size_t recordingShapeInstanceStart;
+    size_t recordingCommandStart;
+    size_t recordingTextEffectConstantsStart;
+    size_t recordingOuterMaxSubmeshVertexCount;
+    AgpuCanvasCommand::ScissorRectangle recordingScissor;
+    uint32_t recordingClipStencilDepth;
+
+    // Culling of the draws outside of the clip bounds. It is disabled while
+    // recording a display list, which can be replayed somewhere else.
+    bool culling;
+
+    // Parallel recording. The segment canvases share the pipelines of this
+    // canvas, and they are kept between frames to reuse their arrays.
+    bool parallelRecording;
+    std::vector<AgpuCanvasPtr> segmentCanvases;
+
+    // Fill path caching. The fill paths are recorded until their end, and
+    // their tessellation is looked up in the cache before processing them.
+    AgpuShapeTessellationCachePtr shapeCache;
+    bool recordingFillPath;
+    PathFillRule recordedFillRule;
+    std::vector<AgpuPathCommand> recordedPath;
+    AgpuShapeTessellationCache::Key recordedPathKey;
+    AgpuTessellatedShape *capturedShape;
+    glm::vec2 capturedOrigin;
+
+    // Batch merging. The draws with the same state are merged at close,
+    // unless a draw with another state that overlaps them is in between.
+    bool mergingBatches;
+    std::vector<DrawBatch> drawBatches;
+    std::vector<DrawBatchGroup> drawBatchGroups;
+    std::vector<uint32_t> mergedIndices;
+    std::vector<AgpuCanvasGlyphInstance> mergedGlyphInstances;
+    std::vector<AgpuCanvasShapeInstance> mergedShapeInstances;
+    std::vector<AgpuCanvasCommand> mergedCommands;
+    agpu_pipeline_state *mergedPipeline;
+    agpu_shader_resource_binding *mergedBinding;
+    uint32_t mergedTextEffectConstantsIndex;
+    size_t mergedMaxSubmeshVertexCount;
 	int baseVertex;
 	ShapeType shapeType;
     agpu_pipeline_state *currentPipeline;
-    CoverType coveringType;
     agpu_shader_resource_binding *currentTextureBinding;
     agpu_shader_resource_binding *currentFontBinding;
+    TextEffect pushedTextEffect;
+    bool textEffectPushed;
 
 	agpu_ref<agpu_command_allocator> allocator;
 	agpu_ref<agpu_command_list> bundleCommandList;
@@ -153,16 +673,29 @@ private:
 	PipelineStateManagerPtr stateManager;
     bool usingBundle;
 	agpu_device_ref device;
-	agpu_buffer_ref vertexBuffer;
 	agpu_vertex_binding_ref vertexBufferBinding;
 
-	agpu_buffer_ref indexBuffer;
+    // The geometry of the frame is written into the shared ring buffers.
+    // The draws are offset by the position of the frame in the rings.
+    AgpuCanvasRingBuffersPtr ringBuffers;
+    agpu_buffer *boundVertexBuffer;
+    agpu_buffer *boundGlyphInstanceBuffer;
+    agpu_buffer *boundShapeInstanceBuffer;
+    agpu_buffer *frameIndexBuffer;
+    size_t frameVertexOffset;
+    size_t frameIndexOffset;
+    size_t frameGlyphInstanceOffset;
+    size_t frameShapeInstanceOffset;
     agpu_shader_signature_ref shaderSignature;
 
     agpu_pipeline_state_ref stencilNonZeroPipeline;
     agpu_pipeline_state_ref stencilEvenOddPipeline;
     agpu_pipeline_state_ref coverColorPipeline;
 
+    // Quadratic curve triangles. These pipelines are optional.
+    agpu_pipeline_state_ref stencilNonZeroCurvePipeline;
+    agpu_pipeline_state_ref stencilEvenOddCurvePipeline;
+
 	agpu_pipeline_state_ref convexColorLinePipeline;
 	agpu_pipeline_state_ref convexColorTrianglePipeline;
 
@@ -176,17 +709,60 @@ private:
     agpu_pipeline_state_ref textColorPipeline;
     agpu_pipeline_state_ref textSdfColorPipeline;
 
+    // The unit quad that is expanded by the instanced pipelines.
+    agpu_buffer_ref quadCornerBuffer;
+    agpu_buffer_ref quadIndexBuffer;
+
+    // Instanced bitmap text. These pipelines are optional.
+    agpu_pipeline_state_ref textInstancedColorPipeline;
+    agpu_pipeline_state_ref textSdfInstancedColorPipeline;
+    agpu_vertex_binding_ref glyphInstanceBinding;
+
+    // Analytic antialiased shapes. This pipeline is optional, and the
+    // shapes are drawn as paths when it is missing.
+    agpu_pipeline_state_ref shapeInstancedColorPipeline;
+    agpu_vertex_binding_ref shapeInstanceBinding;
+
+    // Single pass text effects. These pipelines are optional, and the text
+    // is drawn without its effects when they are missing.
+    agpu_pipeline_state_ref textSdfEffectsColorPipeline;
+    agpu_pipeline_state_ref textSdfInstancedEffectsColorPipeline;
+
+    // Stencil clips. The drawing pipelines are replaced by their clipped
+    // variants inside of a stencil clip, and the clip paths are reduced to
+    // their bounding box scissor when the variants cannot be built.
+    struct ClippedPipelineState
+    {
+        agpu_pipeline_state *pipeline;
+        agpu_pipeline_state_ref clipped;
+    };
+
+    std::vector<ClippedPipelineState> clippedPipelines;
+    agpu_pipeline_state_ref clipStencilNonZeroPipeline;
+    agpu_pipeline_state_ref clipStencilEvenOddPipeline;
+    agpu_pipeline_state_ref clipStencilNonZeroCurvePipeline;
+    agpu_pipeline_state_ref clipStencilEvenOddCurvePipeline;
+    agpu_pipeline_state_ref clipPushCoverPipeline;
+    agpu_pipeline_state_ref clipPopCoverPipeline;
+
     // Sampler
     agpu_shader_resource_binding_ref sampler;
 
 	std::vector<AgpuCanvasVertex> vertices;
-	std::vector<int> indices;
-	std::vector<std::function<void (agpu_command_list_ref &commandList)> > drawCommandsToAdd;
+	std::vector<uint32_t> indices;
+    std::vector<AgpuCanvasGlyphInstance> glyphInstances;
+    std::vector<AgpuCanvasShapeInstance> shapeInstances;
+	std::vector<AgpuCanvasCommand> drawCommands;
+    std::vector<AgpuCanvasTextEffectConstants> textEffectConstants;
+    std::vector<glm::vec2> strokeRingPoints;
 
     // Path processing strategies.
     friend class AgpuCanvasPathProcessor;
+    friend class AgpuSoftwareTessellationPathProcessor;
     friend class AgpuConvexPathProcessor;
     friend class AgpuNoWidthStrokePathProcessor;
+    friend class AgpuStrokePathProcessor;
+    friend class AgpuClipPathProcessor;
     friend class AgpuStencilPathProcessor;
     friend class AgpuStencilEvenOddPathProcessor;
     friend class AgpuStencilNonZeroPathProcessor;
@@ -198,6 +774,7 @@ private:
     std::unique_ptr<AgpuCanvasPathProcessor> convexPathProcessor;
     std::unique_ptr<AgpuCanvasPathProcessor> evenOddRulePathProcessor;
     std::unique_ptr<AgpuCanvasPathProcessor> nonZeroRulePathProcessor;
+    std::unique_ptr<AgpuCanvasPathProcessor> clipPathProcessor;
 
 };
 
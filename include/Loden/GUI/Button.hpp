@@ -38,7 +38,10 @@ public:
     EventSocket<ActionEvent> actionEvent;
 
 private:
+	const TextLayoutPtr &getLabelLayout();
+
 	std::string label;
+	TextLayoutPtr labelLayout;
 	bool isButtonDown_;
 	
 };
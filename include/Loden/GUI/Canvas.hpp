@@ -16,6 +16,8 @@ namespace GUI
 {
 LODEN_DECLARE_CLASS(Font);
 LODEN_DECLARE_CLASS(FontFace);
+LODEN_DECLARE_CLASS(TextLayout);
+LODEN_DECLARE_CLASS(CanvasDisplayList);
 
 /**
  * Path fill rule.
@@ -27,6 +29,142 @@ enum class PathFillRule
     Convex,
 };
 
+/**
+ * The shape of the corners of a stroked path.
+ */
+enum class StrokeJoin
+{
+    Miter = 0,
+    Round,
+    Bevel,
+};
+
+/**
+ * The shape of the ends of an open stroked path.
+ */
+enum class StrokeCap
+{
+    Butt = 0,
+    Round,
+    Square,
+};
+
+/**
+ * How the paths are stroked. The strokes of one unit or less of width are
+ * drawn as hairlines, which ignore the joins and the caps.
+ */
+struct StrokeStyle
+{
+    StrokeStyle()
+        : width(1), join(StrokeJoin::Miter), cap(StrokeCap::Butt), miterLimit(4)
+    {
+    }
+
+    bool isHairline() const
+    {
+        return width <= 1.0f;
+    }
+
+    bool operator==(const StrokeStyle &o) const
+    {
+        return width == o.width && join == o.join && cap == o.cap && miterLimit == o.miterLimit;
+    }
+
+    bool operator!=(const StrokeStyle &o) const
+    {
+        return !(*this == o);
+    }
+
+    float width;
+    StrokeJoin join;
+    StrokeCap cap;
+
+    // The longest miter, relative to the width, before it is beveled.
+    float miterLimit;
+};
+
+/**
+ * A glyph quad of a glyph run.
+ */
+struct CanvasGlyph
+{
+    Rectangle destRectangle;
+    Rectangle sourceRectangle;
+};
+
+/**
+ * Effects of signed distance field text, which are evaluated in the same
+ * fragment pass as the glyphs when the canvas has the effect pipelines.
+ * The outline width, the shadow offset and the shadow softness are in
+ * pixels, and they are limited by the distance field margin of the glyphs.
+ */
+struct TextEffect
+{
+    TextEffect()
+        : outlineWidth(0), outlineColor(0, 0, 0, 1),
+          shadowOffset(0, 0), shadowSoftness(0), shadowColor(0, 0, 0, 0)
+    {
+    }
+
+    bool hasOutline() const
+    {
+        return outlineWidth > 0 && outlineColor.a > 0;
+    }
+
+    bool hasShadow() const
+    {
+        return shadowColor.a > 0;
+    }
+
+    bool isNone() const
+    {
+        return !hasOutline() && !hasShadow();
+    }
+
+    bool operator==(const TextEffect &o) const
+    {
+        return outlineWidth == o.outlineWidth && outlineColor == o.outlineColor &&
+            shadowOffset == o.shadowOffset && shadowSoftness == o.shadowSoftness &&
+            shadowColor == o.shadowColor;
+    }
+
+    bool operator!=(const TextEffect &o) const
+    {
+        return !(*this == o);
+    }
+
+    float outlineWidth;
+    glm::vec4 outlineColor;
+
+    glm::vec2 shadowOffset;
+    float shadowSoftness;
+    glm::vec4 shadowColor;
+};
+
+/**
+ * Drawing retained by a canvas, which can be replayed at another
+ * translation. A display list can only be replayed by the kind of canvas
+ * that recorded it. It expires when the global drawing epoch changes, for
+ * example when a glyph atlas page that it may reference is evicted.
+ */
+class LODEN_CORE_EXPORT CanvasDisplayList
+{
+public:
+    CanvasDisplayList();
+    virtual ~CanvasDisplayList();
+
+    bool isExpired() const
+    {
+        return epoch != getGlobalEpoch();
+    }
+
+    static uint32_t getGlobalEpoch();
+    static void invalidateAll();
+
+private:
+    uint32_t epoch;
+};
+
 /**
  * 2D Canvas rendering interface
  */
@@ -45,14 +183,24 @@ public:
 	virtual void drawFillRectangle(const Rectangle &rectangle) = 0;
     virtual void drawFillRoundedRectangle(const Rectangle &rectangle, float cornerRadius) = 0;
 
+    // Ellipses inscribed in a rectangle. They are drawn as paths by default.
+    virtual void drawEllipse(const Rectangle &rectangle);
+    virtual void drawFillEllipse(const Rectangle &rectangle);
+
     // Text drawing
     virtual glm::vec2 drawText(const std::string &text, int pointSize, glm::vec2 position) = 0;
     virtual glm::vec2 drawTextUtf16(const std::wstring &text, int pointSize, glm::vec2 position) = 0;
+    virtual glm::vec2 drawTextLayout(const TextLayoutPtr &layout, glm::vec2 position) = 0;
+
+    // Text effects
+    virtual const TextEffect &getTextEffect() const = 0;
+    virtual void setTextEffect(const TextEffect &effect) = 0;
 
     // Bitmap text drawing
     virtual void beginBitmapTextDrawing(void *binding, bool distanceField) = 0;
     virtual void drawBitmapCharacter(const Rectangle &destRectangle, Rectangle &sourceRectangle) = 0;
     virtual void endBitmapTextDrawing() = 0;
+    virtual void drawGlyphRun(void *binding, bool distanceField, const CanvasGlyph *glyphs, size_t count);
 
     // Fill paths.
     virtual void beginFillPath(PathFillRule fillRule = PathFillRule::EvenOdd) = 0;
@@ -64,13 +212,33 @@ public:
     virtual void endFillPath() = 0;
 
     // Stroke paths
+    virtual const StrokeStyle &getStrokeStyle() const = 0;
+    virtual void setStrokeStyle(const StrokeStyle &style) = 0;
     virtual void beginStrokePath() = 0;
     virtual void endStrokePath() = 0;
 
-    // Clip paths
+    // Clip paths. The clips nest, and popClipPath removes the last clip,
+    // including the clip rectangles.
     virtual void beginClipPath(PathFillRule fillRule = PathFillRule::EvenOdd) = 0;
     virtual void endClipPath() = 0;
     virtual void popClipPath() = 0;
+    virtual void pushClipRectangle(const Rectangle &rectangle);
+
+    // Culling. Returns false when nothing drawn inside of the rectangle, in
+    // the current coordinates, can reach the visible pixels.
+    virtual bool isVisible(const Rectangle &rectangle) const;
+
+    // Retained drawing. A canvas that cannot retain drawing refuses to
+    // record and to replay, and the caller draws directly instead.
+    virtual bool beginDisplayListRecording();
+    virtual CanvasDisplayListPtr endDisplayListRecording();
+    virtual bool drawDisplayList(const CanvasDisplayListPtr &displayList);
+
+    // Independent segments of drawing, such as the top level widgets. They
+    // are always drawn in order, but a canvas may record them in parallel
+    // into separate canvases that start with its current state.
+    typedef std::function<void (Canvas *canvas)> SegmentRecorder;
+    virtual void drawSegments(const SegmentRecorder *segments, size_t count);
 
 	virtual const glm::mat3 &getTransform() const = 0;
 	virtual void setTransform(const glm::mat3 &transform) = 0;
@@ -85,6 +253,24 @@ public:
 		setTransform(oldTransform);
 	}
 
+    template<typename FT>
+    void withTextEffect(const TextEffect &effect, const FT &f)
+    {
+        auto oldEffect = getTextEffect();
+        setTextEffect(effect);
+        f();
+        setTextEffect(oldEffect);
+    }
+
+    template<typename FT>
+    void withStrokeStyle(const StrokeStyle &style, const FT &f)
+    {
+        auto oldStyle = getStrokeStyle();
+        setStrokeStyle(style);
+        f();
+        setStrokeStyle(oldStyle);
+    }
+
     template<typename CP, typename FT>
     void withClipPath(const CP &clipPath, const FT &f)
     {
@@ -98,13 +284,9 @@ public:
     template<typename FT>
     void withClipRectangle(const Rectangle &rectangle, const FT &f)
     {
-        withClipPath([&] {
-            moveTo(rectangle.getBottomLeft());
-            lineTo(rectangle.getBottomRight());
-            lineTo(rectangle.getTopRight());
-            lineTo(rectangle.getTopLeft());
-            closePath();
-        }, f);
+        pushClipRectangle(rectangle);
+        f();
+        popClipPath();
     }
 };
 
@@ -44,6 +44,12 @@ public:
     virtual void fitLayout();
     virtual void updateLayout();
 
+protected:
+    const std::vector<WidgetPtr> &getChildren() const
+    {
+        return children;
+    }
+
 private:
 	std::vector<WidgetPtr> children;
     LayoutPtr layout;
@@ -4,9 +4,14 @@
 #include "Loden/Common.hpp"
 #include "Loden/Object.hpp"
 #include "Loden/Rectangle.hpp"
+#include "Loden/GUI/TextLayout.hpp"
+#include "Loden/GUI/FontCoverage.hpp"
 #include <glm/vec2.hpp>
+#include <functional>
 #include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace Loden
 {
@@ -18,34 +23,63 @@ LODEN_DECLARE_CLASS(FontFace);
 
 
 /**
- * A font is a container of font faces
+ * A font is a container of font faces. Faces can be added already loaded,
+ * or as lazy faces that are loaded on first use. A font also has an ordered
+ * chain of fallback faces, which are used by its faces for the characters
+ * that they do not cover. The faces can be requested and loaded from any
+ * thread.
  */
 class LODEN_CORE_EXPORT Font
 {
 public:
-    typedef std::map<std::string, FontFacePtr> Faces;
+    typedef std::function<FontFacePtr ()> FaceLoader;
+    typedef std::vector<FontFacePtr> FallbackFaces;
 
     Font();
     ~Font();
 
     void addFace(const std::string &name, const FontFacePtr &face);
+    void addLazyFace(const std::string &name, const FaceLoader &loader);
     void release();
 
-    const Faces &getFaces() const;
+    std::vector<std::string> getFaceNames() const;
     FontFacePtr getFace(const std::string &name);
+    bool isFaceLoaded(const std::string &name) const;
+    void preloadFaces();
+
+    void addFallbackFace(const FontFacePtr &face);
+    FallbackFaces getFallbackFaces() const;
 
     void loadSpecialFaces();
-    const FontFacePtr &getDefaultFace() const;
-    const FontFacePtr &getBoldFace() const;
-    const FontFacePtr &getBoldItalicFace() const;
-    const FontFacePtr &getItalicFace() const;
+    FontFacePtr getDefaultFace();
+    FontFacePtr getBoldFace();
+    FontFacePtr getBoldItalicFace();
+    FontFacePtr getItalicFace();
 
 private:
-    FontFacePtr defaultFace;
-    FontFacePtr boldFace;
-    FontFacePtr boldItalicFace;
-    FontFacePtr italicFace;
+    struct FaceEntry
+    {
+        FaceEntry()
+            : loadFailed(false) {}
+
+        FaceLoader loader;
+        FontFacePtr face;
+        bool loadFailed;
+    };
+
+    typedef std::map<std::string, FaceEntry> Faces;
+
+    FontFacePtr getEntryFace(FaceEntry *entry);
+    FaceEntry *findEntry(const std::string &name);
+    void updateFallbackChain(const FontFacePtr &face);
+
+    mutable std::mutex mutex;
+    FaceEntry *defaultFace;
+    FaceEntry *boldFace;
+    FaceEntry *boldItalicFace;
+    FaceEntry *italicFace;
     Faces faces;
+    FallbackFaces fallbackFaces;
 };
 
 /**
@@ -57,12 +91,50 @@ class LODEN_CORE_EXPORT FontFace : public ObjectInterfaceSubclass<FontFace, Obje
 public:
     virtual void release() = 0;
 
-    virtual glm::vec2 drawCharacter(Canvas *canvas, int character, int pointSize, const glm::vec2 &position) = 0;
-    virtual glm::vec2 drawUtf8(Canvas *canvas, const std::string &text, int pointSize, const glm::vec2 &position) = 0;
-    virtual glm::vec2 drawUtf16(Canvas *canvas, const std::wstring &text, int pointSize, const glm::vec2 &position) = 0;
+    virtual glm::vec2 drawCharacter(Canvas *canvas, int character, int pointSize, const glm::vec2 &position);
+    virtual glm::vec2 drawUtf8(Canvas *canvas, const std::string &text, int pointSize, const glm::vec2 &position);
+    virtual glm::vec2 drawUtf16(Canvas *canvas, const std::wstring &text, int pointSize, const glm::vec2 &position);
+
+    virtual Rectangle computeUtf8TextRectangle(const std::string &text, int pointSize);
+    virtual Rectangle computeUtf16TextRectangle(const std::wstring &text, int pointSize);
+
+    // Text layout
+    virtual void layoutCodePoints(TextLayout &layout, const uint32_t *codePoints, size_t count, int pointSize) = 0;
+    virtual void drawLayoutRun(Canvas *canvas, const TextLayout &layout, const TextLayoutRun &run, const glm::vec2 &position) = 0;
+
+    TextLayoutPtr layoutUtf8(const std::string &text, int pointSize);
+    TextLayoutPtr layoutUtf16(const std::wstring &text, int pointSize);
 
-    virtual Rectangle computeUtf8TextRectangle(const std::string &text, int pointSize) = 0;
-    virtual Rectangle computeUtf16TextRectangle(const std::wstring &text, int pointSize) = 0;
+    // Character coverage and fallback
+    const FontCoverage &getCoverage() const
+    {
+        return coverage;
+    }
+
+    bool hasCharacter(uint32_t codePoint) const
+    {
+        return coverage.contains(codePoint);
+    }
+
+    const std::vector<FontFace*> &getFallbackChain() const
+    {
+        return fallbackChain;
+    }
+
+    void setFallbackChain(const std::vector<FontFace*> &newFallbackChain)
+    {
+        fallbackChain = newFallbackChain;
+    }
+
+    FontFace *resolveFaceForCharacter(uint32_t codePoint);
+    void layoutCodePointsWithFallback(TextLayout &layout, const uint32_t *codePoints, size_t count, int pointSize);
+
+protected:
+    FontCoverage coverage;
+
+private:
+    // The fallback faces are owned by their fonts.
+    std::vector<FontFace*> fallbackChain;
 };
 
 } // End of namespace GUI
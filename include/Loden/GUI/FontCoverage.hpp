@@ -0,0 +1,93 @@
+#ifndef LODEN_GUI_FONT_COVERAGE_HPP
+#define LODEN_GUI_FONT_COVERAGE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Loden
+{
+namespace GUI
+{
+
+/**
+ * The set of code points covered by a font face. It is stored as a sparse
+ * block map: the code space is split in blocks of 256 code points, and each
+ * block index points into a table of 256 bits bitsets. The block zero is
+ * always empty, so testing a code point is a single bit test.
+ */
+class FontCoverage
+{
+public:
+    static constexpr uint32_t BlockBits = 8;
+    static constexpr uint32_t BlockSize = 1 << BlockBits;
+    static constexpr uint32_t CodePointCount = 0x110000;
+    static constexpr uint32_t BlockCount = CodePointCount / BlockSize;
+
+    FontCoverage()
+        : blocks(1)
+    {
+    }
+
+    bool contains(uint32_t codePoint) const
+    {
+        if (codePoint >= CodePointCount || blockIndices.empty())
+            return false;
+
+        auto &block = blocks[blockIndices[codePoint >> BlockBits]];
+        return (block.bits[(codePoint >> 6) & 3] >> (codePoint & 63)) & 1;
+    }
+
+    void insert(uint32_t codePoint)
+    {
+        if (codePoint >= CodePointCount)
+            return;
+
+        if (blockIndices.empty())
+            blockIndices.resize(BlockCount, 0);
+
+        auto &blockIndex = blockIndices[codePoint >> BlockBits];
+        if (blockIndex == 0)
+        {
+            blockIndex = uint16_t(blocks.size());
+            blocks.push_back(Block());
+        }
+
+        blocks[blockIndex].bits[(codePoint >> 6) & 3] |= uint64_t(1) << (codePoint & 63);
+    }
+
+    void clear()
+    {
+        blockIndices.clear();
+        blocks.resize(1);
+    }
+
+    bool isEmpty() const
+    {
+        return blocks.size() == 1;
+    }
+
+    size_t getMemoryCost() const
+    {
+        return blockIndices.capacity()*sizeof(uint16_t) + blocks.capacity()*sizeof(Block);
+    }
+
+private:
+    struct Block
+    {
+        Block()
+        {
+            bits[0] = bits[1] = bits[2] = bits[3] = 0;
+        }
+
+        uint64_t bits[BlockSize / 64];
+    };
+
+    std::vector<uint16_t> blockIndices;
+    std::vector<Block> blocks;
+};
+
+} // End of namespace GUI
+} // End of namespace Loden
+
+#endif //LODEN_GUI_FONT_COVERAGE_HPP
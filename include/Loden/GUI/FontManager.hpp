@@ -3,7 +3,10 @@
 
 #include "Loden/Object.hpp"
 #include "Loden/GUI/Font.hpp"
+#include "Loden/GUI/TextLayout.hpp"
 #include "Loden/Engine.hpp"
+#include <condition_variable>
+#include <mutex>
 #include <vector>
 
 namespace Loden
@@ -22,10 +25,15 @@ struct LODEN_CORE_EXPORT FontLoader: public ObjectInterfaceSubclass<FontLoader,
 
     virtual bool canLoadFaceFromFile(const std::string &fileName) = 0;
     virtual FontFacePtr loadFaceFromFile(const std::string &fileName) = 0;
+
+    virtual void beginFrame() {}
+    virtual void markShaderResourcesUsed(agpu_shader_resource_binding *const *bindings, size_t count) {}
 };
 
 /**
- * Font manager
+ * Font manager. The faces listed in the font description files are loaded
+ * lazily, on their first use. The faces of the warm set of the description
+ * files are preloaded in the background.
  */
 class LODEN_CORE_EXPORT FontManager
 {
@@ -36,6 +44,12 @@ public:
     bool initialize();
     void shutdown();
 
+    // Called once per presented frame, before recording it.
+    void beginFrame();
+
+    // Keeps the font resources bound by replayed drawing alive.
+    void markShaderResourcesUsed(agpu_shader_resource_binding *const *bindings, size_t count);
+
     void addFont(const std::string &name, const FontPtr &font);
     FontPtr getFont(const std::string &name);
 
@@ -44,9 +58,17 @@ public:
     FontPtr getDefaultSerifFont() const;
     FontPtr getDefaultMonospaceFont() const;
 
+    void queuePreload(const FontPtr &font, const std::string &faceName = std::string());
+    void waitPendingPreloads();
+
+    TextLayoutCache &getTextLayoutCache();
+
 private:
     typedef std::map<std::string, FontPtr> Fonts;
+    typedef std::vector<std::pair<std::string, std::string> > WarmSet;
+
     bool loadFontsFromFile(const std::string &fontsDescriptionFileName);
+    void preloadWarmSet();
     FontFacePtr loadFaceFromFile(const std::string &fileName);
 
     Engine *engine;
@@ -57,6 +79,14 @@ private:
     FontPtr defaultSansFont;
     FontPtr defaultMononospacedFont;
     Fonts fonts;
+    std::mutex fontsMutex;
+    WarmSet warmSet;
+
+    std::mutex preloadMutex;
+    std::condition_variable preloadFinishedCondition;
+    size_t pendingPreloadCount;
+
+    TextLayoutCache textLayoutCache;
 };
 
 } // End of namespace GUI
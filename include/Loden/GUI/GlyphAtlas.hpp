@@ -0,0 +1,137 @@
+#ifndef LODEN_GUI_GLYPH_ATLAS_HPP
+#define LODEN_GUI_GLYPH_ATLAS_HPP
+
+#include "Loden/Object.hpp"
+#include "Loden/Engine.hpp"
+#include "Loden/Rectangle.hpp"
+#include "Loden/Texture.hpp"
+#include "AGPU/agpu.hpp"
+#include <glm/vec2.hpp>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace Loden
+{
+namespace GUI
+{
+
+LODEN_DECLARE_CLASS(GlyphAtlas);
+
+/**
+ * A glyph stored in a glyph atlas.
+ */
+struct GlyphAtlasEntry
+{
+    static constexpr int EmptyPage = -1;
+    static constexpr int UnavailablePage = -2;
+
+    // Page that holds the glyph. Empty glyphs have EmptyPage, and the
+    // glyphs that could not be stored have UnavailablePage.
+    int page;
+
+    // Texture coordinates of the glyph, including its padding.
+    Rectangle sourceRectangle;
+
+    // Offset and size of the quad, relative to the pen position.
+    glm::vec2 offset;
+    glm::vec2 size;
+
+    float advance;
+};
+
+/**
+ * Glyph atlas. It packs rasterized glyphs on demand into a set of
+ * single channel texture pages, which are shared by all the faces that use
+ * the atlas. Glyphs are packed in shelves, and uploaded with sub-rectangle
+ * uploads. When every page is full, the least recently used page that is
+ * not being used by the frames in flight is evicted. The frames are counted
+ * by beginFrame, which the windows call once per presented frame.
+ * The atlas is locked by each query, so the canvases that are recorded
+ * in parallel can share it. The entries are returned by copy, since an
+ * eviction from another thread may erase them.
+ * The glyphs that do not fit are remembered as unavailable, so they are
+ * not rasterized again on each frame. The glyphs that only failed because
+ * the pages were in use are retried after EvictionFrameLatency frames.
+ */
+class LODEN_CORE_EXPORT GlyphAtlas : public ObjectSubclass<GlyphAtlas, Object>
+{
+    LODEN_OBJECT_TYPE(GlyphAtlas);
+public:
+    static constexpr int DefaultPageSize = 1024;
+    static constexpr int DefaultMaxPageCount = 4;
+    static constexpr int GlyphPadding = 1;
+    static constexpr uint64_t EvictionFrameLatency = 8;
+
+    GlyphAtlas();
+    ~GlyphAtlas();
+
+    static GlyphAtlasPtr create(Engine *engine, int pageSize = DefaultPageSize, int maxPageCount = DefaultMaxPageCount);
+
+    static uint64_t makeGlyphKey(uint32_t faceId, uint32_t glyphIndex, int pixelSize)
+    {
+        return (uint64_t(faceId & 0xFFFF) << 48) | (uint64_t(pixelSize & 0xFFFF) << 32) | uint64_t(glyphIndex);
+    }
+
+    uint32_t allocateFaceId();
+    void beginFrame();
+
+    // Marks the pages of these bindings as used by the current frame. The
+    // replayed drawing calls it, since it does not look up its glyphs.
+    void markPageBindingsUsed(agpu_shader_resource_binding *const *bindings, size_t count);
+
+    bool findGlyph(uint64_t key, GlyphAtlasEntry &result);
+    bool insertGlyph(uint64_t key, int width, int height, int pitch, const uint8_t *pixels, const glm::vec2 &offset, float advance, GlyphAtlasEntry &result);
+
+    // Remembers a glyph that cannot be rasterized into the atlas.
+    void insertUnavailableGlyph(uint64_t key, float advance);
+
+    agpu_shader_resource_binding *getPageBinding(int page) const;
+    size_t getPageCount() const
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        return pages.size();
+    }
+
+private:
+    struct Shelf
+    {
+        int y;
+        int height;
+        int nextX;
+    };
+
+    struct Page
+    {
+        TexturePtr texture;
+        agpu_shader_resource_binding_ref binding;
+        std::vector<Shelf> shelves;
+        std::vector<uint64_t> glyphKeys;
+        int nextShelfY;
+        uint64_t lastUsedFrame;
+    };
+
+    bool createPage();
+    bool allocateInPage(Page &page, int width, int height, int &x, int &y);
+    int allocateRegion(int width, int height, int &x, int &y);
+    void evictPage(Page &page);
+    void retryUnavailableGlyphs();
+
+    mutable std::mutex mutex;
+    Engine *engine;
+    agpu_shader_signature_ref shaderSignature;
+    int pageSize;
+    int maxPageCount;
+    uint32_t nextFaceId;
+    uint64_t currentFrame;
+    std::vector<Page> pages;
+    std::vector<uint8_t> uploadBuffer;
+    std::unordered_map<uint64_t, GlyphAtlasEntry> glyphs;
+    std::vector<uint64_t> retriedGlyphKeys;
+    uint64_t retryFrame;
+};
+
+} // End of namespace GUI
+} // End of namespace Loden
+
+#endif //LODEN_GUI_GLYPH_ATLAS_HPP
@@ -30,15 +30,41 @@ public:
     int getTextSize() const;
     void setTextSize(int newTextSize);
 
+    bool getWordWrap() const;
+    void setWordWrap(bool newWordWrap);
+
+    bool isMultiline() const;
+    ParagraphLayout &getParagraphLayout();
+
     const glm::vec4 &getForegroundColor();
     void setForegroundColor(const glm::vec4 &newForeground);
 
+    const TextEffect &getTextEffect() const;
+    void setTextEffect(const TextEffect &newTextEffect);
+
     virtual void drawContentOn(Canvas *canvas);
 
+    virtual void handleSizeChanged(SizeChangedEvent &event);
+
 private:
+    static constexpr float LineSpacing = 1.25f;
+
+    const TextLayoutPtr &getTextLayout();
+    void drawMultilineText(Canvas *canvas);
+
+    // The paragraph wraps at the label width, which is kept up to date by
+    // the size changes instead of by the drawing.
+    float getWrapWidth() const;
+    void updateWrapWidth();
+
     std::string text;
+    TextLayoutPtr textLayout;
+    ParagraphLayout paragraphLayout;
     glm::vec4 foregroundColor;
+    TextEffect textEffect;
     int textSize;
+    bool wordWrap;
+    bool paragraphLayoutDirty;
 };
 } // End of namespace GUI
 } // End of namespace Loden
@@ -53,6 +53,7 @@ public:
 
 private:
     std::string text;
+    TextLayoutPtr textLayout;
     MenuPtr menu;
 
     glm::vec2 textSize;
@@ -0,0 +1,85 @@
+#ifndef LODEN_GUI_OFFSCREEN_RENDER_TARGET_HPP
+#define LODEN_GUI_OFFSCREEN_RENDER_TARGET_HPP
+
+#include "Loden/Engine.hpp"
+#include "Loden/Image/ImageBuffer.hpp"
+#include <functional>
+
+namespace Loden
+{
+namespace GUI
+{
+
+LODEN_DECLARE_CLASS(OffscreenRenderTarget);
+LODEN_DECLARE_CLASS(AgpuCanvas);
+LODEN_DECLARE_CLASS(AgpuCanvasRingBuffers);
+class Canvas;
+class Widget;
+
+/**
+ * A framebuffer for drawing canvases without a window. Each render waits
+ * for the GPU, so the result can be read back into an image right away.
+ * It does not need a display, which allows rendering with a software
+ * OpenGL implementation in the tests and in batch tools.
+ */
+class LODEN_CORE_EXPORT OffscreenRenderTarget
+{
+public:
+    typedef std::function<void (Canvas *canvas)> DrawFunction;
+
+    ~OffscreenRenderTarget();
+
+    static OffscreenRenderTargetPtr create(const EnginePtr &engine, int width, int height);
+
+    int getWidth() const
+    {
+        return width;
+    }
+
+    int getHeight() const
+    {
+        return height;
+    }
+
+    bool render(const DrawFunction &drawFunction);
+    bool render(Widget *widget);
+
+    // Reads the last rendered frame as a top-down RGBA image.
+    Image::ImageBufferPtr readImage();
+
+private:
+    OffscreenRenderTarget();
+    bool initialize();
+    agpu_texture_ref createRenderTexture(agpu_texture_format format, agpu_texture_flags flags, unsigned int samples, unsigned int quality);
+
+    EnginePtr engine;
+    int width;
+    int height;
+
+    agpu_device_ref device;
+    agpu_command_queue_ref commandQueue;
+    agpu_shader_signature_ref shaderSignature;
+
+    agpu_buffer_ref transformationBuffer;
+    uint8_t *transformationBlockData;
+
+    agpu_texture_ref colorbuffer;
+    agpu_framebuffer_ref framebuffer;
+    agpu_framebuffer_ref multisampleFramebuffer;
+    agpu_renderpass_ref renderpass;
+    agpu_command_allocator_ref commandAllocator;
+    agpu_command_list_ref commandList;
+    agpu_fence_ref fence;
+    agpu_shader_resource_binding_ref globalShaderBinding;
+    AgpuCanvasPtr canvas;
+    AgpuCanvasRingBuffersPtr canvasRingBuffers;
+
+    unsigned int sampleCount;
+    unsigned int sampleQuality;
+    bool hasInvertedY;
+};
+
+} // End of namespace GUI
+} // End of namespace Loden
+
+#endif //LODEN_GUI_OFFSCREEN_RENDER_TARGET_HPP
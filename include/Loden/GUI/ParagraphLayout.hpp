@@ -0,0 +1,176 @@
+#ifndef LODEN_GUI_PARAGRAPH_LAYOUT_HPP
+#define LODEN_GUI_PARAGRAPH_LAYOUT_HPP
+
+#include "Loden/Common.hpp"
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Loden
+{
+namespace GUI
+{
+
+/**
+ * The line breaking algorithm of a paragraph layout.
+ */
+enum class LineBreakMode
+{
+    // Fill each line with as many words as possible.
+    Greedy = 0,
+
+    // Minimize the squared slack of every line but the last one.
+    Optimal,
+};
+
+/**
+ * A laid out line. The offsets are bytes of the UTF-8 text, and the end
+ * excludes the trailing spaces and the line feed.
+ */
+struct ParagraphLine
+{
+    size_t start;
+    size_t end;
+    float width;
+};
+
+/**
+ * Multi-line text layout. The text is split in paragraphs at the line
+ * feeds, and each paragraph is broken into lines that fit a maximum width.
+ * The width of each word is measured once and cached, so changing the
+ * maximum width does not measure the text again. An edit re-measures the
+ * words that it touches, and breaks the lines again from the line before
+ * the edit, stopping as soon as the line breaks realign with the old ones.
+ */
+class LODEN_CORE_EXPORT ParagraphLayout
+{
+public:
+    typedef std::function<float (const char *text, size_t size)> Measurer;
+
+    ParagraphLayout();
+    ~ParagraphLayout();
+
+    void setMeasurer(const Measurer &newMeasurer);
+
+    float getMaxWidth() const
+    {
+        return maxWidth;
+    }
+
+    // A non-positive maximum width disables the line wrapping.
+    void setMaxWidth(float newMaxWidth);
+
+    float getLineHeight() const
+    {
+        return lineHeight;
+    }
+
+    void setLineHeight(float newLineHeight)
+    {
+        lineHeight = newLineHeight;
+    }
+
+    LineBreakMode getLineBreakMode() const
+    {
+        return lineBreakMode;
+    }
+
+    void setLineBreakMode(LineBreakMode newLineBreakMode);
+
+    const std::string &getText() const
+    {
+        return text;
+    }
+
+    void setText(const std::string &newText);
+    void replaceText(size_t offset, size_t removedSize, const std::string &insertedText);
+    void insertText(size_t offset, const std::string &insertedText);
+    void eraseText(size_t offset, size_t size);
+
+    size_t getLineCount();
+    ParagraphLine getLine(size_t index);
+    size_t findLineForOffset(size_t offset);
+
+    float getWidth();
+    float getHeight();
+
+    // Statistics for checking the incremental reflow.
+    size_t getMeasureCount() const
+    {
+        return measureCount;
+    }
+
+    size_t getBrokenLineCount() const
+    {
+        return brokenLineCount;
+    }
+
+    void resetStatistics()
+    {
+        measureCount = 0;
+        brokenLineCount = 0;
+    }
+
+private:
+    /**
+     * A word and its trailing spaces, with offsets relative to the start of
+     * the paragraph.
+     */
+    struct Word
+    {
+        uint32_t start;
+        uint32_t end;
+        uint32_t spaceEnd;
+        float width;
+        float spaceWidth;
+    };
+
+    struct Line
+    {
+        uint32_t firstWord;
+        uint32_t wordCount;
+        float width;
+    };
+
+    struct Paragraph
+    {
+        size_t start;
+        size_t size;
+        size_t firstLine;
+        std::vector<Word> words;
+        std::vector<Line> lines;
+    };
+
+    float measure(const char *string, size_t size);
+    void tokenize(Paragraph &paragraph, size_t relativeStart, size_t relativeEnd, std::vector<Word> &words);
+    Paragraph makeParagraph(size_t start, size_t size);
+
+    void breakLines(Paragraph &paragraph);
+    void breakLinesGreedy(Paragraph &paragraph, size_t firstLine, size_t firstWord, const std::vector<Line> &oldLines, size_t oldSuffixWord, size_t newSuffixWord);
+    void breakLinesOptimal(Paragraph &paragraph);
+
+    void editParagraph(Paragraph &paragraph, size_t relativeOffset, size_t removedSize, size_t insertedSize);
+    void rebuildParagraphs(size_t firstParagraph, size_t lastParagraph, size_t start, size_t end);
+    void relayoutAll();
+    void updateIndices();
+    size_t findParagraph(size_t offset) const;
+
+    Measurer measurer;
+    float maxWidth;
+    float lineHeight;
+    LineBreakMode lineBreakMode;
+
+    std::string text;
+    std::vector<Paragraph> paragraphs;
+    size_t lineCount;
+    bool indicesDirty;
+
+    size_t measureCount;
+    size_t brokenLineCount;
+};
+
+} // End of namespace GUI
+} // End of namespace Loden
+
+#endif //LODEN_GUI_PARAGRAPH_LAYOUT_HPP
@@ -3,10 +3,12 @@
 
 #include "Loden/GUI/ContainerWidget.hpp"
 #include "Loden/Engine.hpp"
+#include "Loden/Image/ImageBuffer.hpp"
 #include "Loden/TransformationBlock.hpp"
 #include "SDL.h"
 #include <string>
 #include <set>
+#include <vector>
 
 namespace Loden
 {
@@ -15,6 +17,8 @@ namespace GUI
 
 LODEN_DECLARE_CLASS(SystemWindow);
 LODEN_DECLARE_CLASS(AgpuCanvas);
+LODEN_DECLARE_CLASS(AgpuCanvasRingBuffers);
+LODEN_DECLARE_CLASS(OffscreenRenderTarget);
 
 /**
  * The system window.
@@ -27,6 +31,9 @@ public:
 
 	static SystemWindowPtr create(const EnginePtr &engine, const std::string &title, int w, int h, int x = SDL_WINDOWPOS_CENTERED, int y = SDL_WINDOWPOS_CENTERED);
 
+    // A window without a display, which renders into an offscreen target.
+    static SystemWindowPtr createHeadless(const EnginePtr &engine, int w, int h);
+
 	virtual bool isSystemWindow() const;
     virtual EnginePtr getEngine();
 
@@ -39,6 +46,12 @@ public:
 	void pumpEvents();
 	void renderScreen();
 
+    bool isHeadless() const;
+
+    // Reads the last rendered frame of a headless window.
+    Image::ImageBufferPtr readScreenImage();
+
+    virtual void drawChildrenOn(Canvas *canvas) override;
     virtual void handleMouseButtonDown(MouseButtonEvent &event) override;
 
 	virtual void handleKeyDown(KeyboardEvent &event) override;
@@ -82,14 +95,20 @@ private:
     agpu_fence_ref frameFences[3];
     agpu_shader_resource_binding_ref globalShaderBindings[3];
     AgpuCanvasPtr screenCanvases[3];
+    AgpuCanvasRingBuffersPtr canvasRingBuffers;
     int frameCount;
     int frameIndex;
 
+    // The top level widgets are recorded as independent canvas segments.
+    std::vector<Canvas::SegmentRecorder> childSegments;
+
     std::set<WidgetPtr> popups;
     WidgetPtr currentPopUpGroup;
     unsigned int sampleCount;
     unsigned int sampleQuality;
     bool hasInvertedY;
+
+    OffscreenRenderTargetPtr offscreenTarget;
 };
 
 } // End of namespace GUI
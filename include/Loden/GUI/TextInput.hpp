@@ -2,7 +2,7 @@
 #define LODEN_GUI_TEXT_INPUT_HPP
 
 #include "Loden/GUI/Widget.hpp"
-#include <vector>
+#include "Loden/GUI/ParagraphLayout.hpp"
 
 namespace Loden
 {
@@ -33,6 +33,8 @@ public:
     void setFontSize(int newFontSize);
     int getFontSize() const;
 
+    ParagraphLayout &getParagraphLayout();
+
     virtual void handleKeyDown(KeyboardEvent &event) override;
     virtual void handleKeyUp(KeyboardEvent &event) override;
     virtual void handleTextInput(TextInputEvent &event) override;
@@ -51,7 +53,10 @@ public:
     EventSocket<ActionEvent> cancelActionEvent;
 
 private:
-    std::vector<char> textBuffer;
+    static constexpr float LineSpacing = 1.25f;
+
+    ParagraphLayout textLayout;
+    bool measurerDirty;
     int fontSize;
     int cursor;
 };
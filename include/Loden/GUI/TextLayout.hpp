@@ -0,0 +1,168 @@
+#ifndef LODEN_GUI_TEXT_LAYOUT_HPP
+#define LODEN_GUI_TEXT_LAYOUT_HPP
+
+#include "Loden/Object.hpp"
+#include "Loden/Rectangle.hpp"
+#include "Loden/LRUCache.hpp"
+#include <glm/vec2.hpp>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Loden
+{
+namespace GUI
+{
+LODEN_DECLARE_CLASS(Canvas);
+LODEN_DECLARE_CLASS(FontFace);
+LODEN_DECLARE_CLASS(TextLayout);
+
+/**
+ * A positioned glyph. The glyph identifier is specific to the face that
+ * produced it.
+ */
+struct TextLayoutGlyph
+{
+    uint32_t glyph;
+    glm::vec2 position;
+};
+
+/**
+ * A run of glyphs that share the same face and size.
+ */
+struct TextLayoutRun
+{
+    FontFace *face;
+    int pointSize;
+    size_t firstGlyph;
+    size_t glyphCount;
+};
+
+/**
+ * The result of laying out a string. It holds positioned glyph runs,
+ * relative to the text origin, that can be drawn or measured again without
+ * going through the character maps and the glyph metrics.
+ */
+class LODEN_CORE_EXPORT TextLayout : public ObjectSubclass<TextLayout, Object>
+{
+    LODEN_OBJECT_TYPE(TextLayout);
+public:
+    typedef std::vector<TextLayoutGlyph> Glyphs;
+    typedef std::vector<TextLayoutRun> Runs;
+
+    TextLayout();
+    ~TextLayout();
+
+    glm::vec2 draw(Canvas *canvas, const glm::vec2 &position) const;
+
+    void beginRun(FontFace *face, int pointSize);
+    void addGlyph(uint32_t glyph, const glm::vec2 &position, const Rectangle &glyphBounds);
+    void endRun(const glm::vec2 &newAdvance);
+
+    const Glyphs &getGlyphs() const
+    {
+        return glyphs;
+    }
+
+    const Runs &getRuns() const
+    {
+        return runs;
+    }
+
+    const Rectangle &getBounds() const
+    {
+        return bounds;
+    }
+
+    glm::vec2 getSize() const
+    {
+        return bounds.getSize();
+    }
+
+    const glm::vec2 &getAdvance() const
+    {
+        return advance;
+    }
+
+    const std::string &getSourceText() const
+    {
+        return sourceText;
+    }
+
+    void setSourceText(const std::string &newSourceText)
+    {
+        sourceText = newSourceText;
+    }
+
+    size_t getMemoryCost() const;
+
+private:
+    Glyphs glyphs;
+    Runs runs;
+    Rectangle bounds;
+    glm::vec2 advance;
+    std::string sourceText;
+};
+
+/**
+ * Cache of text layouts, keyed by face, size and the hash of the text.
+ * It is thread safe, so it can be shared by the canvases that are recorded
+ * in parallel.
+ */
+class LODEN_CORE_EXPORT TextLayoutCache
+{
+public:
+    static constexpr size_t DefaultBudget = 4 << 20;
+
+    TextLayoutCache(size_t budget = DefaultBudget);
+    ~TextLayoutCache();
+
+    TextLayoutPtr getUtf8(FontFace *face, const std::string &text, int pointSize);
+    TextLayoutPtr getUtf16(FontFace *face, const std::wstring &text, int pointSize);
+
+    void clear();
+    void setBudget(size_t budget);
+
+    size_t getHitCount() const
+    {
+        return cache.getHitCount();
+    }
+
+    size_t getMissCount() const
+    {
+        return cache.getMissCount();
+    }
+
+private:
+    struct Key
+    {
+        bool operator==(const Key &other) const
+        {
+            return face == other.face && pointSize == other.pointSize && wide == other.wide && hash == other.hash;
+        }
+
+        FontFace *face;
+        int pointSize;
+        bool wide;
+        size_t hash;
+    };
+
+    struct KeyHasher
+    {
+        size_t operator()(const Key &key) const
+        {
+            return key.hash ^ (std::hash<FontFace*> ()(key.face) * 31 + size_t(key.pointSize));
+        }
+    };
+
+    template<typename LF>
+    TextLayoutPtr getOrCreate(const Key &key, const std::string &sourceText, const LF &layoutFunction);
+
+    std::mutex mutex;
+    LRUCache<Key, TextLayoutPtr, KeyHasher> cache;
+};
+
+} // End of namespace GUI
+} // End of namespace Loden
+
+#endif //LODEN_GUI_TEXT_LAYOUT_HPP
@@ -6,6 +6,7 @@
 #include "Loden/GUI/Canvas.hpp"
 #include "Loden/GUI/EventSocket.hpp"
 #include "Loden/GUI/Events.hpp"
+#include "Loden/GUI/ParagraphLayout.hpp"
 #include <glm/vec2.hpp>
 #include <glm/vec4.hpp>
 
@@ -21,6 +22,7 @@ LODEN_DECLARE_CLASS(SystemWindow)
 LODEN_DECLARE_CLASS(Widget)
 LODEN_DECLARE_CLASS(Font)
 LODEN_DECLARE_CLASS(FontFace)
+LODEN_DECLARE_CLASS(TextLayout)
 	 
 /**
  * Widget class
@@ -51,12 +53,17 @@ public:
     FontPtr getDefaultFont();
     FontFacePtr getDefaultFontFace();
 
+    TextLayoutPtr layoutUtf16Text(const std::wstring &text, int pointSize);
+    TextLayoutPtr layoutUtf8Text(const std::string &text, int pointSize);
+
     Rectangle computeUtf16TextRectangle(const std::wstring &text, int pointSize);
     Rectangle computeUtf8TextRectangle(const std::string &text, int pointSize);
 
     glm::vec2 computeUtf16TextSize(const std::wstring &text, int pointSize);
     glm::vec2 computeUtf8TextSize(const std::string &text, int pointSize);
 
+    ParagraphLayout::Measurer makeUtf8TextMeasurer(int pointSize);
+
 	void captureMouse();
 	void releaseMouse();
 	
@@ -93,6 +100,12 @@ public:
 	virtual void drawOn(Canvas *canvas);
 	virtual void drawContentOn(Canvas *canvas);
 
+    // Retained drawing. A widget that retains its drawing records its
+    // content once into a display list, and replays it until invalidated.
+    bool isRetainingDrawing() const;
+    void setRetainingDrawing(bool newRetainingDrawing);
+    void invalidateDrawing();
+
     virtual void handleAddedToParent(ParentChangedEvent &event);
     virtual void handleRemovedFromParent(ParentChangedEvent &event);
 
@@ -135,6 +148,9 @@ public:
     EventSocket<PositionChangedEvent> positionChangedEvent;
 	
     EventSocket<PopUpsKilledEvent> popUpsKilledEvent;
+protected:
+    void drawRetainedContentOn(Canvas *canvas);
+
 private:
 	glm::vec2 position;
 	glm::vec2 size;
@@ -144,6 +160,9 @@ private:
 	
 	bool hasKeyboardFocus_;
 	bool hasMouseOver_;
+
+    bool retainingDrawing;
+    CanvasDisplayListPtr displayList;
 };
 
 } // End of namespace GUI
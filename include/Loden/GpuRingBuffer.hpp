@@ -0,0 +1,85 @@
+#ifndef LODEN_GPU_RING_BUFFER_HPP
+#define LODEN_GPU_RING_BUFFER_HPP
+
+#include "Loden/Common.hpp"
+#include "AGPU/agpu.hpp"
+#include <deque>
+#include <vector>
+
+namespace Loden
+{
+
+LODEN_DECLARE_CLASS(GpuRingBuffer);
+
+/**
+ * A persistently mapped buffer that is suballocated as a ring of elements.
+ * The elements written during a frame are released once the fence passed
+ * to endFrame is signaled. When a frame does not fit, the buffer is replaced
+ * by one at least twice as large, and the old buffer is kept alive until the
+ * GPU is done with the current frame.
+ */
+class LODEN_CORE_EXPORT GpuRingBuffer
+{
+public:
+    /**
+     * A region of the ring. The offset is in elements, so it can be used
+     * as a base vertex, a first index or a first instance.
+     */
+    struct Allocation
+    {
+        agpu_buffer *buffer;
+        void *data;
+        size_t offset;
+    };
+
+    GpuRingBuffer(const agpu_device_ref &device, agpu_buffer_binding_type binding, size_t elementSize);
+    ~GpuRingBuffer();
+
+    static GpuRingBufferPtr create(const agpu_device_ref &device, agpu_buffer_binding_type binding, size_t elementSize, size_t initialCapacity);
+
+    bool allocate(size_t count, Allocation &result);
+    void endFrame(const agpu_fence_ref &fence);
+
+    size_t getCapacity() const
+    {
+        return capacity;
+    }
+
+    size_t getElementSize() const
+    {
+        return elementSize;
+    }
+
+private:
+    struct PendingFrame
+    {
+        agpu_fence_ref fence;
+        size_t end;
+        size_t count;
+        std::vector<agpu_buffer_ref> retiredBuffers;
+    };
+
+    bool createBuffer(size_t newCapacity);
+    void retireOldestFrame();
+
+    agpu_device_ref device;
+    agpu_buffer_binding_type binding;
+    size_t elementSize;
+
+    agpu_buffer_ref buffer;
+    uint8_t *mappedData;
+    size_t capacity;
+
+    // The live elements go from the tail to the head, wrapping around.
+    size_t head;
+    size_t tail;
+    size_t liveCount;
+
+    size_t currentFrameCount;
+    std::vector<agpu_buffer_ref> currentFrameRetiredBuffers;
+    std::deque<PendingFrame> pendingFrames;
+};
+
+} // End of namespace Loden
+
+#endif //LODEN_GPU_RING_BUFFER_HPP
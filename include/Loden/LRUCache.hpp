@@ -0,0 +1,167 @@
+#ifndef LODEN_LRU_CACHE_HPP
+#define LODEN_LRU_CACHE_HPP
+
+#include "Loden/Common.hpp"
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace Loden
+{
+
+/**
+ * Least recently used cache with a memory budget.
+ * Each entry carries an explicit cost in bytes. When the accumulated cost
+ * goes over the budget, the least recently used entries are evicted.
+ */
+template<typename K, typename V, typename H = std::hash<K> >
+class LRUCache
+{
+public:
+    typedef K KeyType;
+    typedef V ValueType;
+
+    LRUCache(size_t budget = 0)
+        : budget(budget), usedMemory(0), hitCount(0), missCount(0), evictionCount(0)
+    {
+    }
+
+    /**
+     * Looks for an entry. Returns nullptr when it is not cached. A found
+     * entry becomes the most recently used one.
+     */
+    V *find(const K &key)
+    {
+        auto it = entryMap.find(key);
+        if (it == entryMap.end())
+        {
+            ++missCount;
+            return nullptr;
+        }
+
+        ++hitCount;
+        entries.splice(entries.begin(), entries, it->second);
+        return &it->second->value;
+    }
+
+    /**
+     * Inserts or replaces an entry, evicting old entries to keep in budget.
+     */
+    V &insert(const K &key, V value, size_t cost)
+    {
+        auto it = entryMap.find(key);
+        if (it != entryMap.end())
+        {
+            usedMemory -= it->second->cost;
+            entries.erase(it->second);
+            entryMap.erase(it);
+        }
+
+        entries.push_front(Entry(key, std::move(value), cost));
+        entryMap[key] = entries.begin();
+        usedMemory += cost;
+        trim();
+        return entries.front().value;
+    }
+
+    bool remove(const K &key)
+    {
+        auto it = entryMap.find(key);
+        if (it == entryMap.end())
+            return false;
+
+        usedMemory -= it->second->cost;
+        entries.erase(it->second);
+        entryMap.erase(it);
+        return true;
+    }
+
+    void clear()
+    {
+        entries.clear();
+        entryMap.clear();
+        usedMemory = 0;
+    }
+
+    void setBudget(size_t newBudget)
+    {
+        budget = newBudget;
+        trim();
+    }
+
+    size_t getBudget() const
+    {
+        return budget;
+    }
+
+    size_t getUsedMemory() const
+    {
+        return usedMemory;
+    }
+
+    size_t size() const
+    {
+        return entries.size();
+    }
+
+    size_t getHitCount() const
+    {
+        return hitCount;
+    }
+
+    size_t getMissCount() const
+    {
+        return missCount;
+    }
+
+    size_t getEvictionCount() const
+    {
+        return evictionCount;
+    }
+
+    void resetStatistics()
+    {
+        hitCount = 0;
+        missCount = 0;
+        evictionCount = 0;
+    }
+
+private:
+    struct Entry
+    {
+        Entry(const K &key, V &&value, size_t cost)
+            : key(key), value(std::move(value)), cost(cost) {}
+
+        K key;
+        V value;
+        size_t cost;
+    };
+
+    typedef std::list<Entry> Entries;
+
+    void trim()
+    {
+        // Always keep the most recently used entry, even when it alone is over budget.
+        while (usedMemory > budget && entries.size() > 1)
+        {
+            auto &last = entries.back();
+            usedMemory -= last.cost;
+            entryMap.erase(last.key);
+            entries.pop_back();
+            ++evictionCount;
+        }
+    }
+
+    size_t budget;
+    size_t usedMemory;
+    size_t hitCount;
+    size_t missCount;
+    size_t evictionCount;
+    Entries entries;
+    std::unordered_map<K, typename Entries::iterator, H> entryMap;
+};
+
+} // End of namespace Loden
+
+#endif //LODEN_LRU_CACHE_HPP
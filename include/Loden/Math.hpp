@@ -3,6 +3,8 @@
 
 #include "Loden/Common.hpp"
 #include <algorithm>
+#include <math.h>
+#include <glm/geometric.hpp>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
@@ -114,6 +116,148 @@ inline int sameOrNextPowerOfTwo(int v)
     return 1 << (log2 + 1);
 }
 
+// The largest number of segments used for flattening a single curve.
+static constexpr int MaxCurveSegmentCount = 256;
+
+/**
+ * Wang's formula: the number of uniform segments that keep the chords of a
+ * degree n Bezier curve within the tolerance, where secondDifference is
+ * the longest second difference of its control points.
+ */
+inline int curveSegmentCount(int degree, float secondDifference, float tolerance)
+{
+    if (!(tolerance > 0.0f))
+        return MaxCurveSegmentCount;
+
+    auto count = ceilf(sqrtf(degree*(degree - 1)*secondDifference / (8.0f*tolerance)));
+    if (!(count < float(MaxCurveSegmentCount)))
+        return MaxCurveSegmentCount;
+    return std::max(1, int(count));
+}
+
+inline int quadraticBezierSegmentCount(const glm::vec2 &P1, const glm::vec2 &P2, const glm::vec2 &P3, float tolerance)
+{
+    return curveSegmentCount(2, glm::length(P1 - 2.0f*P2 + P3), tolerance);
+}
+
+inline int cubicBezierSegmentCount(const glm::vec2 &P1, const glm::vec2 &P2, const glm::vec2 &P3, const glm::vec2 &P4, float tolerance)
+{
+    auto secondDifference = std::max(glm::length(P1 - 2.0f*P2 + P3), glm::length(P2 - 2.0f*P3 + P4));
+    return curveSegmentCount(3, secondDifference, tolerance);
+}
+
+/**
+ * Flattens a quadratic Bezier curve into chords that stay within the
+ * tolerance. The segment count is computed up front, and the points are
+ * evaluated by forward differencing. The start point is not emitted, and
+ * the end point is emitted exactly.
+ */
+template<typename F>
+void flattenQuadraticBezier(const glm::vec2 &P1, const glm::vec2 &P2, const glm::vec2 &P3, float tolerance, const F &emitPoint)
+{
+    auto count = quadraticBezierSegmentCount(P1, P2, P3, tolerance);
+    auto step = 1.0f / count;
+    auto step2 = step*step;
+
+    auto a = P1 - 2.0f*P2 + P3;
+    auto b = 2.0f*(P2 - P1);
+
+    auto point = P1;
+    auto d1 = a*step2 + b*step;
+    auto d2 = 2.0f*a*step2;
+    for (int i = 1; i < count; ++i)
+    {
+        point += d1;
+        d1 += d2;
+        emitPoint(point);
+    }
+
+    emitPoint(P3);
+}
+
+/**
+ * Flattens a cubic Bezier curve into chords that stay within the
+ * tolerance, in the same way as flattenQuadraticBezier.
+ */
+template<typename F>
+void flattenCubicBezier(const glm::vec2 &P1, const glm::vec2 &P2, const glm::vec2 &P3, const glm::vec2 &P4, float tolerance, const F &emitPoint)
+{
+    auto count = cubicBezierSegmentCount(P1, P2, P3, P4, tolerance);
+    auto step = 1.0f / count;
+    auto step2 = step*step;
+    auto step3 = step2*step;
+
+    auto a = 3.0f*(P2 - P3) + P4 - P1;
+    auto b = 3.0f*(P1 - 2.0f*P2 + P3);
+    auto c = 3.0f*(P2 - P1);
+
+    auto point = P1;
+    auto d1 = a*step3 + b*step2 + c*step;
+    auto d2 = 6.0f*a*step3 + 2.0f*b*step2;
+    auto d3 = 6.0f*a*step3;
+    for (int i = 1; i < count; ++i)
+    {
+        point += d1;
+        d1 += d2;
+        d2 += d3;
+        emitPoint(point);
+    }
+
+    emitPoint(P4);
+}
+
+/**
+ * Returns the number of quadratic Bezier curves that approximate a cubic
+ * Bezier curve within the tolerance. A single quadratic is off by at most
+ * sqrt(3)/36 of the third difference of the control points, and splitting
+ * the cubic in n parts divides that error by n cubed.
+ */
+inline int cubicToQuadraticCount(const glm::vec2 &P1, const glm::vec2 &P2, const glm::vec2 &P3, const glm::vec2 &P4, float tolerance)
+{
+    if (!(tolerance > 0.0f))
+        return MaxCurveSegmentCount;
+
+    auto thirdDifference = glm::length(P4 - 3.0f*P3 + 3.0f*P2 - P1);
+    auto count = ceilf(cbrtf(0.0481125224f*thirdDifference / tolerance));
+    if (!(count < float(MaxCurveSegmentCount)))
+        return MaxCurveSegmentCount;
+    return std::max(1, int(count));
+}
+
+/**
+ * Approximates a cubic Bezier curve with quadratic Bezier curves, split at
+ * uniform parameters. Each part is passed as its control point and its end
+ * point, and the last end point is exact.
+ */
+template<typename F>
+void approximateCubicWithQuadratics(const glm::vec2 &P1, const glm::vec2 &P2, const glm::vec2 &P3, const glm::vec2 &P4, float tolerance, const F &emitQuadratic)
+{
+    auto count = cubicToQuadraticCount(P1, P2, P3, P4, tolerance);
+    auto step = 1.0f / count;
+
+    // The derivative, scaled by a third of the parameter step.
+    auto tangent = [&](float t) {
+        auto it = 1.0f - t;
+        return step*(it*it*(P2 - P1) + 2.0f*t*it*(P3 - P2) + t*t*(P4 - P3));
+    };
+
+    auto start = P1;
+    auto startTangent = tangent(0.0f);
+    for (int i = 1; i <= count; ++i)
+    {
+        auto t = i*step;
+        auto end = i == count ? P4 : cubicBezier(P1, P2, P3, P4, t);
+        auto endTangent = tangent(t);
+
+        // Average the quadratic control points implied by each end.
+        auto control = (3.0f*(start + startTangent + end - endTangent) - start - end)*0.25f;
+        emitQuadratic(control, end);
+
+        start = end;
+        startTangent = endTangent;
+    }
+}
+
 } // End of namesapce Loden
 
 #endif //LODEN_MATH_HPP
@@ -117,6 +117,10 @@ public:
 	agpu_pipeline_state_ref getPipelineState(const std::string &name);
     PipelineStateTemplatePtr getPipelineStateTemplate(const std::string &name);
 
+    // Builds a variant of a loaded pipeline state, by applying an extra
+    // build action to its template. The variant is cached as name.variantName.
+    agpu_pipeline_state_ref getPipelineStateVariant(const std::string &name, const std::string &variantName, const PipelineStateTemplate::BuildAction &buildAction);
+
     Engine *getEngine() const
     {
         return engine;
@@ -0,0 +1,53 @@
+#ifndef LODEN_THREAD_POOL_HPP
+#define LODEN_THREAD_POOL_HPP
+
+#include "Loden/Common.hpp"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Loden
+{
+
+LODEN_DECLARE_CLASS(ThreadPool);
+
+/**
+ * A pool of worker threads that run queued tasks in submission order.
+ */
+class LODEN_CORE_EXPORT ThreadPool
+{
+public:
+    typedef std::function<void ()> Task;
+
+    ThreadPool();
+    ~ThreadPool();
+
+    bool initialize(size_t threadCount = 0);
+    void shutdown();
+
+    void submit(const Task &task);
+    void waitIdle();
+
+    size_t getThreadCount() const
+    {
+        return threads.size();
+    }
+
+private:
+    void workerMain();
+
+    std::mutex mutex;
+    std::condition_variable taskAvailableCondition;
+    std::condition_variable idleCondition;
+    std::deque<Task> tasks;
+    std::vector<std::thread> threads;
+    size_t runningTaskCount;
+    bool shuttingDown;
+};
+
+} // End of namespace Loden
+
+#endif //LODEN_THREAD_POOL_HPP
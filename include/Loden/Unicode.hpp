@@ -0,0 +1,282 @@
+#ifndef LODEN_UNICODE_HPP
+#define LODEN_UNICODE_HPP
+
+#include "Loden/Common.hpp"
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LODEN_UNICODE_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace Loden
+{
+
+static constexpr uint32_t UnicodeReplacementCharacter = 0xFFFD;
+static constexpr uint32_t UnicodeMaxCodePoint = 0x10FFFF;
+
+/**
+ * Returns the length of the pure ASCII prefix of a byte sequence. The
+ * bytes are checked 32 at a time with AVX2, 16 at a time with SSE2, and 8
+ * at a time otherwise.
+ */
+inline size_t countAsciiPrefix(const uint8_t *data, size_t size)
+{
+    size_t position = 0;
+#ifdef __AVX2__
+    for (; position + 32 <= size; position += 32)
+    {
+        auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (data + position));
+        if (_mm256_movemask_epi8(chunk) != 0)
+            break;
+    }
+#endif
+
+#ifdef LODEN_UNICODE_USE_SSE2
+    for (; position + 16 <= size; position += 16)
+    {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*> (data + position));
+        auto mask = _mm_movemask_epi8(chunk);
+        if (mask != 0)
+        {
+            while ((mask & 1) == 0)
+            {
+                mask >>= 1;
+                ++position;
+            }
+            return position;
+        }
+    }
+#endif
+
+    for (; position + 8 <= size; position += 8)
+    {
+        uint64_t chunk;
+        memcpy(&chunk, data + position, 8);
+        if (chunk & 0x8080808080808080ull)
+            break;
+    }
+
+    while (position < size && data[position] < 0x80)
+        ++position;
+    return position;
+}
+
+/**
+ * Widens a run of ASCII bytes into code points.
+ */
+inline void widenAscii(const uint8_t *data, size_t size, uint32_t *out)
+{
+    size_t i = 0;
+#ifdef LODEN_UNICODE_USE_SSE2
+    auto zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16)
+    {
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*> (data + i));
+        auto low = _mm_unpacklo_epi8(bytes, zero);
+        auto high = _mm_unpackhi_epi8(bytes, zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i*> (out + i), _mm_unpacklo_epi16(low, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*> (out + i + 4), _mm_unpackhi_epi16(low, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*> (out + i + 8), _mm_unpacklo_epi16(high, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*> (out + i + 12), _mm_unpackhi_epi16(high, zero));
+    }
+#endif
+    for (; i < size; ++i)
+        out[i] = data[i];
+}
+
+/**
+ * Decodes a single UTF-8 sequence starting at position, which must be in
+ * range. Invalid or truncated sequences produce the replacement character
+ * and consume their maximal valid prefix, at least one byte.
+ * Returns the position of the next sequence.
+ */
+inline size_t decodeUtf8CodePoint(const uint8_t *data, size_t size, size_t position, uint32_t &codePoint)
+{
+    uint32_t lead = data[position];
+    if (lead < 0x80)
+    {
+        codePoint = lead;
+        return position + 1;
+    }
+
+    size_t length;
+    uint8_t secondMin = 0x80;
+    uint8_t secondMax = 0xBF;
+    if (lead < 0xC2)
+    {
+        codePoint = UnicodeReplacementCharacter;
+        return position + 1;
+    }
+    else if (lead < 0xE0)
+    {
+        length = 2;
+        codePoint = lead & 0x1F;
+    }
+    else if (lead < 0xF0)
+    {
+        length = 3;
+        codePoint = lead & 0x0F;
+        if (lead == 0xE0)
+            secondMin = 0xA0; // Overlong encoding.
+        else if (lead == 0xED)
+            secondMax = 0x9F; // Surrogates.
+    }
+    else if (lead < 0xF5)
+    {
+        length = 4;
+        codePoint = lead & 0x07;
+        if (lead == 0xF0)
+            secondMin = 0x90; // Overlong encoding.
+        else if (lead == 0xF4)
+            secondMax = 0x8F; // Above U+10FFFF.
+    }
+    else
+    {
+        codePoint = UnicodeReplacementCharacter;
+        return position + 1;
+    }
+
+    for (size_t i = 1; i < length; ++i)
+    {
+        auto index = position + i;
+        auto minValue = i == 1 ? secondMin : 0x80;
+        auto maxValue = i == 1 ? secondMax : 0xBF;
+        if (index >= size || data[index] < minValue || data[index] > maxValue)
+        {
+            codePoint = UnicodeReplacementCharacter;
+            return index;
+        }
+
+        codePoint = (codePoint << 6) | (data[index] & 0x3F);
+    }
+
+    return position + length;
+}
+
+/**
+ * Decodes UTF-8 text, appending the code points into a vector.
+ */
+inline void decodeUtf8(const char *text, size_t size, std::vector<uint32_t> &codePoints)
+{
+    auto data = reinterpret_cast<const uint8_t*> (text);
+    codePoints.reserve(codePoints.size() + size);
+
+    size_t position = 0;
+    while (position < size)
+    {
+        // Skip the ASCII runs in bulk.
+        auto asciiCount = countAsciiPrefix(data + position, size - position);
+        if (asciiCount > 0)
+        {
+            auto destIndex = codePoints.size();
+            codePoints.resize(destIndex + asciiCount);
+            widenAscii(data + position, asciiCount, &codePoints[destIndex]);
+            position += asciiCount;
+            if (position >= size)
+                break;
+        }
+
+        uint32_t codePoint;
+        position = decodeUtf8CodePoint(data, size, position, codePoint);
+        codePoints.push_back(codePoint);
+    }
+}
+
+inline void decodeUtf8(const std::string &text, std::vector<uint32_t> &codePoints)
+{
+    decodeUtf8(text.data(), text.size(), codePoints);
+}
+
+/**
+ * Decodes UTF-16 text, appending the code points into a vector. Unpaired
+ * surrogates produce the replacement character.
+ */
+inline void decodeUtf16(const uint16_t *text, size_t size, std::vector<uint32_t> &codePoints)
+{
+    codePoints.reserve(codePoints.size() + size);
+    size_t position = 0;
+    while (position < size)
+    {
+        uint32_t unit = text[position++];
+        if (unit < 0xD800 || unit > 0xDFFF)
+        {
+            codePoints.push_back(unit);
+        }
+        else if (unit <= 0xDBFF && position < size && text[position] >= 0xDC00 && text[position] <= 0xDFFF)
+        {
+            uint32_t low = text[position++];
+            codePoints.push_back(0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+        }
+        else
+        {
+            codePoints.push_back(UnicodeReplacementCharacter);
+        }
+    }
+}
+
+/**
+ * Decodes UTF-32 text, appending the code points into a vector. Surrogates
+ * and values out of the Unicode range produce the replacement character.
+ */
+inline void decodeUtf32(const uint32_t *text, size_t size, std::vector<uint32_t> &codePoints)
+{
+    codePoints.reserve(codePoints.size() + size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        auto codePoint = text[i];
+        if (codePoint > UnicodeMaxCodePoint || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+            codePoint = UnicodeReplacementCharacter;
+        codePoints.push_back(codePoint);
+    }
+}
+
+/**
+ * Decodes a wide string. Wide strings hold UTF-16 on platforms with a 16
+ * bits wchar_t, and UTF-32 on the others.
+ */
+inline void decodeUtf16(const std::wstring &text, std::vector<uint32_t> &codePoints)
+{
+    if (sizeof(wchar_t) == 2)
+        decodeUtf16(reinterpret_cast<const uint16_t*> (text.data()), text.size(), codePoints);
+    else
+        decodeUtf32(reinterpret_cast<const uint32_t*> (text.data()), text.size(), codePoints);
+}
+
+/**
+ * Returns the start of the UTF-8 sequence that precedes position.
+ */
+inline size_t previousUtf8CodePointStart(const char *text, size_t position)
+{
+    if (position == 0)
+        return 0;
+
+    // Skip at most three continuation bytes.
+    auto start = position - 1;
+    for (int i = 0; i < 3 && start > 0 && (uint8_t(text[start]) & 0xC0) == 0x80; ++i)
+        --start;
+    return start;
+}
+
+/**
+ * Returns the start of the UTF-8 sequence that follows the one at position.
+ */
+inline size_t nextUtf8CodePointStart(const char *text, size_t size, size_t position)
+{
+    if (position >= size)
+        return size;
+
+    uint32_t codePoint;
+    return decodeUtf8CodePoint(reinterpret_cast<const uint8_t*> (text), size, position, codePoint);
+}
+
+} // End of namespace Loden
+
+#endif //LODEN_UNICODE_HPP
@@ -0,0 +1,50 @@
+#include "Loden/GUI/FontCoverage.hpp"
+#include "UnitTest++/UnitTest++.h"
+
+using namespace Loden::GUI;
+
+SUITE(FontCoverage)
+{
+    TEST(Empty)
+    {
+        FontCoverage coverage;
+        CHECK(coverage.isEmpty());
+        CHECK(!coverage.contains(0));
+        CHECK(!coverage.contains('A'));
+        CHECK(!coverage.contains(0x10FFFF));
+        CHECK(!coverage.contains(0x110000));
+    }
+
+    TEST(Insert)
+    {
+        FontCoverage coverage;
+        coverage.insert('A');
+        coverage.insert(0x4E2D);
+        coverage.insert(0x1F600);
+        coverage.insert(0x10FFFF);
+        coverage.insert(0x110000);
+
+        CHECK(!coverage.isEmpty());
+        CHECK(coverage.contains('A'));
+        CHECK(!coverage.contains('B'));
+        CHECK(!coverage.contains('A' + 64));
+        CHECK(coverage.contains(0x4E2D));
+        CHECK(!coverage.contains(0x4E2C));
+        CHECK(coverage.contains(0x1F600));
+        CHECK(!coverage.contains(0x1F700));
+        CHECK(coverage.contains(0x10FFFF));
+        CHECK(!coverage.contains(0x110000));
+    }
+
+    TEST(Clear)
+    {
+        FontCoverage coverage;
+        for (uint32_t c = 0x20; c < 0x7F; ++c)
+            coverage.insert(c);
+        CHECK(coverage.contains('z'));
+
+        coverage.clear();
+        CHECK(coverage.isEmpty());
+        CHECK(!coverage.contains('z'));
+    }
+}
@@ -1,5 +1,6 @@
 #include "Loden/Math.hpp"
 #include "UnitTest++/UnitTest++.h"
+#include <vector>
 
 using namespace Loden;
 
@@ -12,4 +13,92 @@ SUITE(Math)
         CHECK(!closeTo(1.0, 0.0));
         CHECK(closeTo(0.9 + 0.1, 1.0));
     }
+
+    TEST(CurveSegmentCount)
+    {
+        // A straight curve is a single segment.
+        CHECK_EQUAL(1, quadraticBezierSegmentCount(glm::vec2(0, 0), glm::vec2(5, 0), glm::vec2(10, 0), 0.25f));
+        CHECK_EQUAL(1, cubicBezierSegmentCount(glm::vec2(0, 0), glm::vec2(3, 3), glm::vec2(6, 6), glm::vec2(9, 9), 0.25f));
+
+        // Scaling the curve by four doubles the segment count.
+        auto small = quadraticBezierSegmentCount(glm::vec2(0, 0), glm::vec2(50, 100), glm::vec2(100, 0), 0.25f);
+        auto large = quadraticBezierSegmentCount(glm::vec2(0, 0), glm::vec2(200, 400), glm::vec2(400, 0), 0.25f);
+        CHECK(small > 1);
+        CHECK(large >= 2*small - 1 && large <= 2*small + 1);
+
+        CHECK_EQUAL(MaxCurveSegmentCount, quadraticBezierSegmentCount(glm::vec2(0, 0), glm::vec2(50, 100), glm::vec2(100, 0), 0.0f));
+        CHECK_EQUAL(MaxCurveSegmentCount, cubicBezierSegmentCount(glm::vec2(0, 0), glm::vec2(0, 1e20f), glm::vec2(1, 1e20f), glm::vec2(1, 0), 0.25f));
+    }
+
+    TEST(FlattenQuadraticBezier)
+    {
+        glm::vec2 p1(0, 0), p2(50, 100), p3(100, 0);
+        std::vector<glm::vec2> points;
+        flattenQuadraticBezier(p1, p2, p3, 0.25f, [&](const glm::vec2 &p) {
+            points.push_back(p);
+        });
+
+        CHECK_EQUAL(quadraticBezierSegmentCount(p1, p2, p3, 0.25f), int(points.size()));
+        CHECK(points.back() == p3);
+
+        // The points lie on the curve, at uniform parameters.
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            auto expected = quadraticBezier(p1, p2, p3, float(i + 1) / points.size());
+            CHECK(glm::length(points[i] - expected) < 0.001f);
+        }
+    }
+
+    TEST(FlattenCubicBezier)
+    {
+        glm::vec2 p1(0, 0), p2(0, 100), p3(100, 100), p4(100, 0);
+        std::vector<glm::vec2> points;
+        flattenCubicBezier(p1, p2, p3, p4, 0.1f, [&](const glm::vec2 &p) {
+            points.push_back(p);
+        });
+
+        CHECK_EQUAL(cubicBezierSegmentCount(p1, p2, p3, p4, 0.1f), int(points.size()));
+        CHECK(points.back() == p4);
+
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            auto expected = cubicBezier(p1, p2, p3, p4, float(i + 1) / points.size());
+            CHECK(glm::length(points[i] - expected) < 0.01f);
+        }
+
+        // The midpoints of the chords stay within the tolerance of the curve.
+        auto start = p1;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            auto chordMidpoint = midpoint(start, points[i]);
+            auto curveMidpoint = cubicBezier(p1, p2, p3, p4, (i + 0.5f) / points.size());
+            CHECK(glm::length(chordMidpoint - curveMidpoint) <= 0.1f);
+            start = points[i];
+        }
+    }
+
+    TEST(ApproximateCubicWithQuadratics)
+    {
+        glm::vec2 p1(0, 0), p2(0, 100), p3(100, 100), p4(100, 0);
+        auto count = cubicToQuadraticCount(p1, p2, p3, p4, 0.1f);
+        CHECK(count > 1);
+
+        // An elevated quadratic is a single part.
+        glm::vec2 q1(0, 0), q2(50, 100), q3(100, 0);
+        CHECK_EQUAL(1, cubicToQuadraticCount(q1, q1 + (q2 - q1)*(2.0f/3.0f), q3 + (q2 - q3)*(2.0f/3.0f), q3, 0.1f));
+
+        int parts = 0;
+        auto start = p1;
+        approximateCubicWithQuadratics(p1, p2, p3, p4, 0.1f, [&](const glm::vec2 &control, const glm::vec2 &end) {
+            // Each part meets the cubic at its ends and stays close in the middle.
+            CHECK(glm::length(end - cubicBezier(p1, p2, p3, p4, float(parts + 1) / count)) < 0.01f);
+            auto middle = quadraticBezier(start, control, end, 0.5f);
+            CHECK(glm::length(middle - cubicBezier(p1, p2, p3, p4, (parts + 0.5f) / count)) <= 0.1f);
+            start = end;
+            ++parts;
+        });
+
+        CHECK_EQUAL(count, parts);
+        CHECK(start == p4);
+    }
 }
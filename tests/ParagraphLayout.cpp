@@ -0,0 +1,147 @@
+#include "Loden/GUI/ParagraphLayout.hpp"
+#include "UnitTest++/UnitTest++.h"
+
+using namespace Loden::GUI;
+
+// Every byte is ten units wide.
+static float measureMonospace(const char *text, size_t size)
+{
+    return float(size)*10.0f;
+}
+
+static std::string getLineText(ParagraphLayout &layout, size_t index)
+{
+    auto line = layout.getLine(index);
+    return layout.getText().substr(line.start, line.end - line.start);
+}
+
+static void checkSameLines(ParagraphLayout &layout, ParagraphLayout &expected)
+{
+    CHECK_EQUAL(expected.getLineCount(), layout.getLineCount());
+    for (size_t i = 0; i < expected.getLineCount() && i < layout.getLineCount(); ++i)
+    {
+        CHECK_EQUAL(getLineText(expected, i), getLineText(layout, i));
+        CHECK_CLOSE(expected.getLine(i).width, layout.getLine(i).width, 0.001f);
+    }
+}
+
+SUITE(ParagraphLayout)
+{
+    TEST(NoWrapping)
+    {
+        ParagraphLayout layout;
+        layout.setMeasurer(measureMonospace);
+        layout.setText("hello world");
+        CHECK_EQUAL(1u, layout.getLineCount());
+        CHECK_EQUAL("hello world", getLineText(layout, 0));
+        CHECK_CLOSE(110.0f, layout.getLine(0).width, 0.001f);
+    }
+
+    TEST(LineFeeds)
+    {
+        ParagraphLayout layout;
+        layout.setMeasurer(measureMonospace);
+        layout.setText("first\n\nthird");
+        CHECK_EQUAL(3u, layout.getLineCount());
+        CHECK_EQUAL("first", getLineText(layout, 0));
+        CHECK_EQUAL("", getLineText(layout, 1));
+        CHECK_EQUAL("third", getLineText(layout, 2));
+        CHECK_EQUAL(2u, layout.findLineForOffset(8));
+    }
+
+    TEST(GreedyBreaking)
+    {
+        ParagraphLayout layout;
+        layout.setMeasurer(measureMonospace);
+        layout.setMaxWidth(100.0f);
+        layout.setText("aaa bb cc ddddd e");
+        CHECK_EQUAL(2u, layout.getLineCount());
+        CHECK_EQUAL("aaa bb cc", getLineText(layout, 0));
+        CHECK_EQUAL("ddddd e", getLineText(layout, 1));
+        CHECK_EQUAL(1u, layout.findLineForOffset(12));
+    }
+
+    TEST(OptimalBreaking)
+    {
+        ParagraphLayout layout;
+        layout.setMeasurer(measureMonospace);
+        layout.setMaxWidth(60.0f);
+        layout.setText("aaa bb cc dddddd");
+
+        // Greedy leaves a short second line.
+        CHECK_EQUAL(3u, layout.getLineCount());
+        CHECK_EQUAL("aaa bb", getLineText(layout, 0));
+        CHECK_EQUAL("cc", getLineText(layout, 1));
+
+        // Optimal balances the first two lines.
+        layout.setLineBreakMode(LineBreakMode::Optimal);
+        CHECK_EQUAL(3u, layout.getLineCount());
+        CHECK_EQUAL("aaa", getLineText(layout, 0));
+        CHECK_EQUAL("bb cc", getLineText(layout, 1));
+        CHECK_EQUAL("dddddd", getLineText(layout, 2));
+    }
+
+    TEST(ChangingWidthDoesNotMeasure)
+    {
+        ParagraphLayout layout;
+        layout.setMeasurer(measureMonospace);
+        layout.setText("the quick brown fox jumps over the lazy dog");
+        layout.resetStatistics();
+        layout.setMaxWidth(100.0f);
+        CHECK_EQUAL(0u, layout.getMeasureCount());
+        CHECK(layout.getLineCount() > 1);
+    }
+
+    TEST(IncrementalEdits)
+    {
+        std::string paragraph;
+        for (int i = 0; i < 200; ++i)
+            paragraph += "word" + std::to_string(i % 10) + " ";
+
+        ParagraphLayout layout;
+        layout.setMeasurer(measureMonospace);
+        layout.setMaxWidth(200.0f);
+        layout.setText(paragraph);
+        auto lineCount = layout.getLineCount();
+
+        // A one character edit only measures the word that it touches, and
+        // breaks a few lines.
+        layout.resetStatistics();
+        layout.insertText(300, "x");
+        CHECK(layout.getMeasureCount() <= 4);
+        CHECK(layout.getBrokenLineCount() <= 3);
+        CHECK(layout.getLineCount() >= lineCount);
+
+        ParagraphLayout expected;
+        expected.setMeasurer(measureMonospace);
+        expected.setMaxWidth(200.0f);
+        expected.setText(layout.getText());
+        checkSameLines(layout, expected);
+
+        layout.eraseText(300, 1);
+        layout.eraseText(10, 25);
+        layout.insertText(0, "  lead ");
+        layout.insertText(layout.getText().size(), "tail");
+        expected.setText(layout.getText());
+        checkSameLines(layout, expected);
+    }
+
+    TEST(EditsAcrossParagraphs)
+    {
+        ParagraphLayout layout;
+        layout.setMeasurer(measureMonospace);
+        layout.setMaxWidth(100.0f);
+        layout.setText("one two three\nfour five six\nseven");
+
+        layout.eraseText(13, 1);
+        layout.insertText(5, "\nnew ");
+        layout.replaceText(0, 3, "1\n2");
+
+        ParagraphLayout expected;
+        expected.setMeasurer(measureMonospace);
+        expected.setMaxWidth(100.0f);
+        expected.setText(layout.getText());
+        checkSameLines(layout, expected);
+        CHECK_EQUAL(std::string("1\n2 \ntwonew three four five six\nseven").size(), layout.getText().size());
+    }
+}
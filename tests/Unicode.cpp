@@ -0,0 +1,83 @@
+#include "Loden/Unicode.hpp"
+#include "UnitTest++/UnitTest++.h"
+
+using namespace Loden;
+
+static std::vector<uint32_t> decodeUtf8String(const std::string &text)
+{
+    std::vector<uint32_t> result;
+    decodeUtf8(text, result);
+    return result;
+}
+
+SUITE(Unicode)
+{
+    TEST(DecodeAscii)
+    {
+        std::string text = "The quick brown fox jumps over the lazy dog";
+        auto codePoints = decodeUtf8String(text);
+        CHECK_EQUAL(text.size(), codePoints.size());
+        for (size_t i = 0; i < text.size(); ++i)
+            CHECK_EQUAL(uint32_t(text[i]), codePoints[i]);
+    }
+
+    TEST(DecodeMultiByte)
+    {
+        // A, e acute, euro sign, G clef.
+        auto codePoints = decodeUtf8String("A\xC3\xA9\xE2\x82\xAC\xF0\x9D\x84\x9E");
+        CHECK_EQUAL(4u, codePoints.size());
+        CHECK_EQUAL(0x41u, codePoints[0]);
+        CHECK_EQUAL(0xE9u, codePoints[1]);
+        CHECK_EQUAL(0x20ACu, codePoints[2]);
+        CHECK_EQUAL(0x1D11Eu, codePoints[3]);
+    }
+
+    TEST(DecodeAfterLongAsciiRun)
+    {
+        auto codePoints = decodeUtf8String("0123456789abcdefghijklmnopqrstuvwxyz\xC3\xA9!");
+        CHECK_EQUAL(38u, codePoints.size());
+        CHECK_EQUAL(uint32_t('z'), codePoints[35]);
+        CHECK_EQUAL(0xE9u, codePoints[36]);
+        CHECK_EQUAL(uint32_t('!'), codePoints[37]);
+    }
+
+    TEST(RejectInvalidSequences)
+    {
+        // Overlong encoding, surrogate, truncated sequence and invalid lead byte.
+        CHECK_EQUAL(2u, decodeUtf8String("\xC0\xAF").size());
+        CHECK_EQUAL(UnicodeReplacementCharacter, decodeUtf8String("\xC0\xAF")[0]);
+
+        auto surrogate = decodeUtf8String("\xED\xA0\x80");
+        CHECK_EQUAL(3u, surrogate.size());
+        CHECK_EQUAL(UnicodeReplacementCharacter, surrogate[0]);
+
+        auto truncated = decodeUtf8String("\xE2\x82" "A");
+        CHECK_EQUAL(2u, truncated.size());
+        CHECK_EQUAL(UnicodeReplacementCharacter, truncated[0]);
+        CHECK_EQUAL(uint32_t('A'), truncated[1]);
+
+        auto invalidLead = decodeUtf8String("\xFF" "A");
+        CHECK_EQUAL(2u, invalidLead.size());
+        CHECK_EQUAL(UnicodeReplacementCharacter, invalidLead[0]);
+    }
+
+    TEST(DecodeUtf16)
+    {
+        const uint16_t text[] = {0x41, 0xD834, 0xDD1E, 0xDC00, 0x42};
+        std::vector<uint32_t> codePoints;
+        decodeUtf16(text, 5, codePoints);
+        CHECK_EQUAL(4u, codePoints.size());
+        CHECK_EQUAL(0x41u, codePoints[0]);
+        CHECK_EQUAL(0x1D11Eu, codePoints[1]);
+        CHECK_EQUAL(UnicodeReplacementCharacter, codePoints[2]);
+        CHECK_EQUAL(0x42u, codePoints[3]);
+    }
+
+    TEST(CodePointBoundaries)
+    {
+        std::string text = "a\xC3\xA9z";
+        CHECK_EQUAL(1u, previousUtf8CodePointStart(text.data(), 3));
+        CHECK_EQUAL(3u, nextUtf8CodePointStart(text.data(), text.size(), 1));
+        CHECK_EQUAL(0u, previousUtf8CodePointStart(text.data(), 1));
+    }
+}